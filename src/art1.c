@@ -23,8 +23,12 @@
  *  - A set of patterns: it's the cluster members, they shape the cluster
  *    prototype.
  * 
- * In this programm a cluster is represented by the Cluster structure (yes, 
- * really!) 
+ * In this programm the clusters are stored in a ClustStore structure, the
+ * cluster at index i being made of the i-th element of each of its arrays.
+ *
+ * Each cluster also counts, for every bit index, how many of its patterns have
+ * a 1 there. When a pattern leaves the cluster the prototype is rebuilt from
+ * these counters so its cost dosen't depend on the size of the cluster.
  *
  * FLUCTUATION
  * -----------
@@ -40,444 +44,2615 @@
 
 /*=====| INCLUDES |===========================================================*/
 #include <limits.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
 #include "art1.h"
 #include "utls.h"
 #include "io.h"
 #include "ccl_internal.h"
 
+/*=====| TYPEDEFS & STRUCTURES |==============================================*/
+/** The structure holds the score of a cluster for a pattern, which is
+ * com / (beta + ones).
+ */
+typedef struct {
+    /** @var Score::com
+     * The number of 1 the prototype and the pattern have in common.
+     */
+    ulong com;
+
+    /** @var Score::ones
+     * The number of 1 of the prototype.
+     */
+    ulong ones;
+} Score;
+
+/** The structure holds the search of the best matching cluster of a pattern.
+ *
+ * The search only counts the common 1 of the clusters which can still beat
+ * the best score found so far (see can_match()), so most of the prototypes
+ * matrix is skipped once a good cluster is known.
+ */
+typedef struct {
+    /** @var CandSearch::pat
+     * The pattern the clusters are matched against, NULL if it is sparse
+     * (its 1 are then only in patBits).
+     */
+    const BitWord *pat;
+
+    /** @var CandSearch::patOnes
+     * The number of 1 of the pattern.
+     */
+    ulong patOnes;
+
+    /** @var CandSearch::patRest
+     * The number of 1 of the pattern after each chunk of COM_ONES_CHUNK
+     * words.
+     */
+    ulong *patRest;
+
+    /** @var CandSearch::patBits
+     * The indexes of the 1 of the pattern, by increasing index.
+     */
+    uint32_t *patBits;
+
+    /** @var CandSearch::patKey
+     * The fingerprint of the pattern, to find the prototypes equal to it.
+     */
+    BitWord patKey;
+
+    /** @var CandSearch::beta
+     * The network beta parameter.
+     */
+    Ratio beta;
+
+    /** @var CandSearch::vigilance
+     * The network vigilance parameter.
+     */
+    Ratio vigilance;
+
+    /** @var CandSearch::constrained
+     * Whether the clusters must pass the choice and vigilance tests (while
+     * training) or not (while testing).
+     */
+    bool constrained;
+
+    /** @var CandSearch::choice
+     * beta + len, scaled by the denominator of beta: a cluster passes the
+     * choice test if com * choice >= patOnes * (beta + ones).
+     */
+    uwide choice;
+
+    /** @var CandSearch::vigMin
+     * The number of common 1 a cluster needs to pass the vigilance test.
+     */
+    ulong vigMin;
+
+    /** @var CandSearch::minOnes
+     * The number of 1 a prototype needs to pass both tests, 0 for an
+     * unconstrained search.
+     */
+    ulong minOnes;
+
+    /** @var CandSearch::floor
+     * A score reached by a cluster passing the tests: the clusters with a
+     * lower score are skipped.
+     */
+    Score floor;
+
+    /** @var CandSearch::hasFloor
+     * Whether floor is set.
+     */
+    bool hasFloor;
+
+    /** @var CandSearch::ties
+     * The clusters sharing the best score, by increasing index.
+     */
+    ulong *ties;
+
+    /** @var CandSearch::nTies
+     * The number of clusters in ties.
+     */
+    ulong nTies;
+
+    /** @var CandSearch::capacity
+     * The number of clusters the ties array can hold before growing.
+     */
+    ulong capacity;
+
+    /** @var CandSearch::rng
+     * The random generator breaking the ties.
+     */
+    Rng *rng;
+
+    /** @var CandSearch::pool
+     * The workers matching the clusters, NULL if they are matched by the
+     * calling thread only.
+     */
+    ThreadPool *pool;
+
+    /** @var CandSearch::nParts
+     * The number of parts the clusters are split in when they are matched by
+     * the pool: one per thread.
+     */
+    ulong nParts;
+
+    /** @var CandSearch::partBest
+     * The best score of each part.
+     */
+    Score *partBest;
+
+    /** @var CandSearch::partTies
+     * The number of clusters having the best score of each part.
+     */
+    ulong *partTies;
+} CandSearch;
+
+/** The structure holds what the matching of a part of the clusters needs.
+ */
+typedef struct {
+    /** @var ScoreJob::search
+     * The search receiving the best scores and the ties.
+     */
+    CandSearch *search;
+
+    /** @var ScoreJob::clusts
+     * The network clusters.
+     */
+    ClustStore *clusts;
+
+    /** @var ScoreJob::nParts
+     * The number of parts the clusters are split in.
+     */
+    ulong nParts;
+} ScoreJob;
+
+/** The structure holds the assignment of the training patterns to clusters.
+ *
+ * It is the authoritative answer to "which cluster does this pattern belong
+ * to?": it is updated every time a pattern joins or leaves a cluster so the
+ * patterns sets never have to be searched.
+ */
+typedef struct {
+    /** @var Assignment::clust
+     * The index of the cluster of each pattern. NOT_FOUND if the pattern
+     * dosen't belong to any cluster yet.
+     */
+    ulong *clust;
+
+    /** @var Assignment::pos
+     * The position of each pattern in its cluster patterns set.
+     */
+    ulong *pos;
+} Assignment;
+
+/** The structure holds what the assignment of a batch of training patterns
+ * needs (see network_train()).
+ *
+ * Every arrays with one element per part are written by a single thread.
+ */
+typedef struct {
+    /** @var BatchJob::pats
+     * The training patterns.
+     */
+    PatSet *pats;
+
+    /** @var BatchJob::clusts
+     * The network clusters, only read while the batch is assigned.
+     */
+    ClustStore *clusts;
+
+    /** @var BatchJob::asg
+     * The assignment of the training patterns.
+     */
+    Assignment *asg;
+
+    /** @var BatchJob::from
+     * The index of the first pattern of the batch.
+     */
+    ulong from;
+
+    /** @var BatchJob::to
+     * The index after the last pattern of the batch.
+     */
+    ulong to;
+
+    /** @var BatchJob::nParts
+     * The number of parts the batch is split in.
+     */
+    ulong nParts;
+
+    /** @var BatchJob::seed
+     * The seed of the random generators breaking ties during the pass.
+     */
+    unsigned int seed;
+
+    /** @var BatchJob::scratch
+     * The constrained search of each part.
+     */
+    CandSearch *scratch;
+
+    /** @var BatchJob::choice
+     * The best matching cluster of each pattern of the batch (the first
+     * pattern of the batch being at index 0), NOT_FOUND if it needs a new
+     * cluster.
+     */
+    ulong *choice;
+} BatchJob;
+
+/** The structure holds the best matching clusters of a training pattern.
+ */
+typedef struct {
+    /** @var PatMatch::nTies
+     * The number of clusters having the best score (only the first
+     * MATCH_MAX_TIES are kept).
+     */
+    ulong nTies;
+
+    /** @var PatMatch::best
+     * The best score, set if nTies > 0.
+     */
+    Score best;
+
+    /** @var PatMatch::ties
+     * The clusters having the best score, by increasing ID.
+     */
+    ulong ties[MATCH_MAX_TIES];
+} PatMatch;
+
+/** The structure holds the last best matching clusters of every training
+ * pattern and the log of the modified clusters (see network_train()).
+ *
+ * The log entries are numbered from the start of the training: the best
+ * matching clusters of a pattern are still right if none of the clusters
+ * modified by the entries following its stamp can change them.
+ */
+typedef struct {
+    /** @var MatchCache::matches
+     * The last best matching clusters of each pattern.
+     */
+    PatMatch *matches;
+
+    /** @var MatchCache::stamps
+     * The number of log entries when the best matching clusters of each
+     * pattern were found, NOT_FOUND if they never were.
+     */
+    ulong *stamps;
+
+    /** @var MatchCache::log
+     * The index of the modified cluster of each entry kept, the first one
+     * being the entry logStart.
+     */
+    ulong *log;
+
+    /** @var MatchCache::logStart
+     * The number of the first entry kept.
+     */
+    ulong logStart;
+
+    /** @var MatchCache::logEnd
+     * The number of the next entry.
+     */
+    ulong logEnd;
+
+    /** @var MatchCache::logCapacity
+     * The number of entries the log array can hold.
+     */
+    ulong logCapacity;
+
+    /** @var MatchCache::lastEntry
+     * The number of the last entry of each cluster index.
+     */
+    ulong *lastEntry;
+
+    /** @var MatchCache::nLastEntries
+     * The number of elements of the lastEntry array.
+     */
+    ulong nLastEntries;
+} MatchCache;
+
+/** The structure holds what the speculative assignment of a window of
+ * training patterns needs (see network_train()).
+ *
+ * The patterns are handed out to the threads one by one, so a thread done
+ * with a cheap pattern takes the next one instead of waiting for the others.
+ */
+typedef struct {
+    /** @var SpecJob::pats
+     * The training patterns.
+     */
+    PatSet *pats;
+
+    /** @var SpecJob::clusts
+     * The network clusters, only read while the window is speculated.
+     */
+    ClustStore *clusts;
+
+    /** @var SpecJob::asg
+     * The assignment of the training patterns.
+     */
+    Assignment *asg;
+
+    /** @var SpecJob::from
+     * The index of the first pattern of the window.
+     */
+    ulong from;
+
+    /** @var SpecJob::to
+     * The index after the last pattern of the window.
+     */
+    ulong to;
+
+    /** @var SpecJob::next
+     * The index of the next pattern to speculate.
+     */
+    ulong next;
+
+    /** @var SpecJob::nParts
+     * The number of threads speculating the window.
+     */
+    ulong nParts;
+
+    /** @var SpecJob::scratch
+     * The constrained search of each thread.
+     */
+    CandSearch *scratch;
+
+    /** @var SpecJob::res
+     * The speculative best matching clusters of each pattern of the window
+     * (the first pattern of the window being at index 0).
+     */
+    PatMatch *res;
+
+    /** @var SpecJob::cache
+     * The last best matching clusters of the patterns and the log of the
+     * modified clusters.
+     */
+    MatchCache *cache;
+
+    /** @var SpecJob::stamp
+     * The number of log entries at the start of the window.
+     */
+    ulong stamp;
+} SpecJob;
+
+/** The structure holds what the lock-free assignment of the training patterns
+ * needs (see network_train()).
+ *
+ * Every arrays with one element per part are written by a single thread.
+ */
+typedef struct {
+    /** @var HogJob::pats
+     * The training patterns.
+     */
+    PatSet *pats;
+
+    /** @var HogJob::hog
+     * The clusters, updated by every threads at once.
+     */
+    HogStore *hog;
+
+    /** @var HogJob::clust
+     * The index in 'hog' of the cluster of each pattern.
+     */
+    ulong *clust;
+
+    /** @var HogJob::next
+     * The index of the next pattern to assign.
+     */
+    ulong next;
+
+    /** @var HogJob::nParts
+     * The number of threads assigning the patterns.
+     */
+    ulong nParts;
+
+    /** @var HogJob::seed
+     * The seed of the random generators breaking ties during the pass.
+     */
+    unsigned int seed;
+
+    /** @var HogJob::scratch
+     * The constrained search of each thread.
+     */
+    CandSearch *scratch;
+
+    /** @var HogJob::stale
+     * The number of patterns assigned by each thread while another thread
+     * modified the clusters they were matched against.
+     */
+    ulong *stale;
+} HogJob;
+
+/** The structure holds what the classification of testing patterns needs.
+ *
+ * Every arrays with one element per part are written by a single thread.
+ */
+typedef struct {
+    /** @var TestJob::par
+     * The network parameters.
+     */
+    const InParam *par;
+
+    /** @var TestJob::clusts
+     * The network clusters.
+     */
+    ClustStore *clusts;
+
+    /** @var TestJob::pats
+     * The testing patterns.
+     */
+    PatSet *pats;
+
+    /** @var TestJob::clustsClasses
+     * The class of each cluster.
+     */
+    Vector *clustsClasses;      // Vector of strings
+
+    /** @var TestJob::classes
+     * The class of each testing pattern.
+     */
+    Vector *classes;            // Vector of strings
+
+    /** @var TestJob::nParts
+     * The number of parts the testing patterns are split in.
+     */
+    ulong nParts;
+
+    /** @var TestJob::seed
+     * The seed of the random generators breaking ties.
+     */
+    unsigned int seed;
+
+    /** @var TestJob::scratch
+     * The search of each part.
+     */
+    CandSearch *scratch;
+
+    /** @var TestJob::patClust
+     * The index of the best matching cluster of each testing pattern.
+     */
+    ulong *patClust;
+
+    /** @var TestJob::success
+     * The number of well classified patterns of each part.
+     */
+    ulong *success;
+
+    /** @var TestJob::fail
+     * The number of wrongly classified patterns of each part.
+     */
+    ulong *fail;
+} TestJob;
+
 /*=====| FUNCTIONS |==========================================================*/
+/** Add (or remove) the 1 of a pattern to the members counters of a cluster.
+ *
+ * Only the words of the pattern which have 1 are looked at, bit by bit (a
+ * sparse pattern gives the indexes of its 1 directly).
+ *
+ * @param[in,out] clusts The network clusters.
+ * @param[in]     iClust The index of the cluster whose counters are updated.
+ * @param[in]     pats   The patterns set.
+ * @param[in]     iPat   The index of the pattern joining or leaving the
+ *  cluster.
+ * @param[in]     inc    1 if the pattern joins the cluster, -1 if it leaves.
+ */
+static void clust_count_pat(ClustStore *clusts, ulong iClust, PatSet *pats,
+                            ulong iPat, int inc){
+    ulong w, i;
+    BitWord word;
+    const BitWord *pat;
+    const uint32_t *idx;
+    uint32_t *bitCount = clust_bit_count(clusts, iClust);
+
+    if(pats->idx != NULL){
+        idx = pat_idx(pats, iPat);
+        for(i = 0; i < pats->nOnes[iPat]; i++){
+            bitCount[idx[i]] += inc;
+        }
+        return;
+    }
+    pat = pat_get(pats, iPat);
+    for(w = 0; w < clusts->nWords; w++){
+        word = pat[w];
+        while(word){
+            bitCount[w * WORD_BITS + __builtin_ctzll(word)] += inc;
+            word &= word - 1;
+        }
+    }
+}
+
+/** Rebuild a cluster prototype from its members counters.
+ *
+ * A prototype bit is 1 if and only if every member pattern has a 1 at this
+ * index, i.e. if its counter equals the number of members.
+ *
+ * @param[in,out] clusts   The network clusters.
+ * @param[in]     iClust   The index of the cluster whose prototype is
+ *  rebuilt. Its number of 1 is updated.
+ * @param[in]     nMembers Number of patterns in the cluster.
+ */
+static void prot_from_counts(ClustStore *clusts, ulong iClust, ulong nMembers){
+    ulong i;
+    BitWord *prot = clust_prot(clusts, iClust);
+    uint32_t *bitCount = clust_bit_count(clusts, iClust);
+
+    memset(prot, 0, clusts->nWords * sizeof(BitWord));
+    clusts->nOnes[iClust] = 0;
+    for(i = 0; i < clusts->len; i++){
+        if(bitCount[i] == nMembers){
+            bit_set(prot, i);
+            clusts->nOnes[iClust]++;
+        }
+    }
+    clusts_sync_prot(clusts, iClust);
+}
+
 /** Add a given pattern to a cluster prototype.
  *
- * Add pattern 'pat' to a cluster prototype 'prot'. The prototype 'prot' will be
- * more similar to this pattern because if it has a 1 where pattern have a 0
- * then the 1 become a 0.
+ * Add pattern 'pat' to a cluster prototype 'prot'. The prototype 'prot' will be
+ * more similar to this pattern because if it has a 1 where pattern have a 0
+ * then the 1 become a 0.
+ *
+ * @note A prototype have a 1 only where every member patterns have a 1.
+ *
+ * @param[in, out]  clusts The network clusters.
+ * @param[in]       iClust The index of the cluster whose prototype will be
+ *  modified to ressembles the pattern. Its number of 1 is updated.
+ * @param[in]       pats   The patterns set.
+ * @param[in]       iPat   The index of the pattern to add to the prototype.
+ */
+static void prot_add_pat(ClustStore *clusts, ulong iClust, PatSet *pats,
+                         ulong iPat){
+    BitWord *prot = clust_prot(clusts, iClust);
+
+    if(pats->idx != NULL){
+        clusts->nOnes[iClust] = bits_and_idx(prot, pat_idx(pats, iPat),
+                                             pats->nOnes[iPat],
+                                             clusts->nWords);
+    }
+    else{
+        clusts->nOnes[iClust] = bits_and_ones(prot, pat_get(pats, iPat),
+                                              clusts->nWords);
+    }
+    clust_count_pat(clusts, iClust, pats, iPat, 1);
+    clusts_sync_prot(clusts, iClust);
+}
+
+/** Push a pattern ID at the end of a cluster patterns set.
+ *
+ * The patterns set capacity is doubled when it is full (ccl only grows it by a
+ * quarter) so the number of reallocations stays logarithmic in the size of the
+ * cluster.
+ *
+ * @param[in,out] patSet The patterns set.
+ * @param[in]     iPat   The ID of the pattern to push.
+ */
+static void pat_set_push(Vector *patSet, ulong iPat){
+    size_t capacity = iVector.GetCapacity(patSet);
+
+    // ccl grows the vector when it's one element away from its capacity
+    if(vec_size(patSet) + 1 >= capacity){
+        iVector.Reserve(patSet, 2 * capacity);
+    }
+    vec_pushback(patSet, &iPat);
+}
+
+/** Erase an empty cluster from the network clusters.
+ *
+ * The last cluster of 'clusts' is moved at index 'iClust' (so nothing has to
+ * be shifted) and the assignment of its patterns is updated accordingly.
+ *
+ * @param[in,out] clusts The network clusters.
+ * @param[in,out] asg    The assignment of the training patterns.
+ * @param[in]     iClust The index of the cluster to erase.
+ */
+static void clust_erase(ClustStore *clusts, Assignment *asg, ulong iClust){
+    ulong i;
+    Vector *patSet;     // Vector of ulongs
+
+    clusts_swap_remove(clusts, iClust);
+    if(iClust < clusts->size){
+        patSet = clust_pat_set(clusts, iClust);
+        for(i = 0; i < vec_size(patSet); i++){
+            asg->clust[vec_get_as_ulong(patSet, i)] = iClust;
+        }
+    }
+}
+
+/** Remove a pattern ID from the patterns set of its cluster.
+ *
+ * The last pattern of the set takes its place so it's done in constant time.
+ *
+ * @param[in,out] patSet The patterns set of the cluster of the pattern.
+ * @param[in,out] asg    The assignment of the training patterns.
+ * @param[in]     iPat   The index of the pattern to remove.
+ */
+static void pat_set_remove(Vector *patSet, Assignment *asg, ulong iPat){
+    ulong last;
+
+    iVector.PopBack(patSet, &last);
+    if(last != iPat){
+        vec_replace_at(patSet, asg->pos[iPat], &last);
+        asg->pos[last] = asg->pos[iPat];
+    }
+    asg->clust[iPat] = NOT_FOUND;
+}
+
+/** Remove the given pattern from the given cluster.
+ *
+ * Remove the pattern at index 'iPat' of 'pats' from cluster prototype at 
+ * index 'iClust' of 'clusts'. Also remove the pattern ID from the prototype
+ * patterns set (see pat_set_remove()).
+ *
+ * The prototype is then rebuilt from the members counters, without looking at
+ * the remaining member patterns. If there's no remaining pattern then the
+ * cluster is erased (see clust_erase()).
+ *
+ * @param[in]     pats   The network training patterns set.
+ * @param[in]     iPat   The index of the pattern to remove.
+ * @param[in,out] clusts The network clusters.
+ * @param[in,out] asg    The assignment of the training patterns.
+ * @param[in]     iClust The index of the cluster from which the pattern will be
+ *  removed.
+ *
+ * @return true if the cluster has been erased.
+ */
+static bool clust_rm_pat(ClustStore *clusts, Assignment *asg, ulong iClust,
+                         PatSet *pats, ulong iPat){
+    Vector *patSet = clust_pat_set(clusts, iClust);     // Vector of ulongs
+
+    pat_set_remove(patSet, asg, iPat);
+	if(vec_size(patSet) == 0){
+        clust_erase(clusts, asg, iClust);
+        return true;
+	}
+	else{
+        clust_count_pat(clusts, iClust, pats, iPat, -1);
+        prot_from_counts(clusts, iClust, vec_size(patSet));
+        return false;
+	}
+}
+
+/** Remove the given pattern from its cluster without ever erasing it.
+ *
+ * Unlike clust_rm_pat() the indexes of the clusters don't change. A cluster
+ * left without pattern gets a prototype full of 1 (every counter is 0), so
+ * the next pattern added to it becomes its prototype, and it has to be erased
+ * by the caller if it stays empty.
+ *
+ * @param[in,out] clusts The network clusters.
+ * @param[in,out] asg    The assignment of the training patterns.
+ * @param[in]     pats   The network training patterns set.
+ * @param[in]     iPat   The index of the pattern to remove.
+ */
+static void clust_detach_pat(ClustStore *clusts, Assignment *asg,
+                             PatSet *pats, ulong iPat){
+    ulong iClust = asg->clust[iPat];
+    Vector *patSet = clust_pat_set(clusts, iClust);     // Vector of ulongs
+
+    pat_set_remove(patSet, asg, iPat);
+    clust_count_pat(clusts, iClust, pats, iPat, -1);
+    prot_from_counts(clusts, iClust, vec_size(patSet));
+}
+
+/** Returns the number of 1 that the two given patterns have in common.
+ *
+ * Count and return the number of 1 which are present in 'pat1' and 'pat2', at
+ * same indexes.
+ *
+ * @note 'pat1' and 'pat2' must have the same length. It is admit and it's
+ *  obvious because the program check it at the begining so no test are carried
+ *  out here in order to save time.
+ *
+ * @param[in] pat1   The first pattern, will be compared to 'pat2'.
+ * @param[in] pat2   The second pattern, will be compared to 'pat1'.
+ * @param[in] nWords Number of words of the packed patterns.
+ *
+ * @return The number of 1 that the two given patterns have in common.
+ */
+static long comOnes(const BitWord *pat1, const BitWord *pat2, ulong nWords){
+	return bits_com_ones(pat1, pat2, nWords);
+}
+
+/** Add a new cluster to the network clusters.
+ *
+ * Ceate a new cluster and initialize it by setting pattern at index 'iPat' in
+ * 'pats' as its prototype and adding pattern ID 'iPat' in its patterns set.
+ * Finaly, add the new cluster to 'clusts'.
+ *
+ * @param[in, out] clusts The network clusters vector where the new cluster will
+ *  be added.
+ * @param[in, out] asg    The assignment of the training patterns.
+ * @param[in]      pats   The network training patterns.
+ * @param[in]      iPat   The index of the current training pattern.
+ */
+static void clust_add_new(ClustStore *clusts, Assignment *asg, PatSet *pats,
+                          ulong iPat){
+    ulong iClust = asg->clust[iPat];
+    ulong iNew;
+
+	if(iClust != NOT_FOUND){
+        clust_rm_pat(clusts, asg, iClust, pats, iPat);
+    }
+    iNew = clusts_push(clusts);
+    pat_set_push(clust_pat_set(clusts, iNew), iPat);
+    if(pats->idx != NULL){
+        bits_from_idx(clust_prot(clusts, iNew), pat_idx(pats, iPat),
+                      pats->nOnes[iPat], pats->nWords);
+    }
+    else{
+        bits_copy(clust_prot(clusts, iNew), pat_get(pats, iPat),
+                  pats->nWords);
+    }
+    clusts->nOnes[iNew] = pats->nOnes[iPat];
+    clusts_sync_prot(clusts, iNew);
+    clust_count_pat(clusts, iNew, pats, iPat, 1);
+    asg->clust[iPat] = iNew;
+    asg->pos[iPat] = 0;
+}
+
+/** Add a pattern to a cluster.
+ *
+ * To add a pattern to a candidate cluster we must:
+ *  - Add the pattern ID to the cluster patterns set
+ *  - Reshape the cluster prototype.
+ *
+ * If the pattern already belongs to another cluster then it is removed from
+ * this cluster and added to the candidate cluster (reassignement) and true is 
+ * returned. If the pattern already belongs to the candidate cluster then false
+ * is returned and the algorithm should go with the next pattern to train. 
+ * Else, if the pattern dosen't already belongs to any cluster then it is simply
+ * added to the candidate cluster and true is returned.
+ *
+ * @note If the pattern was the last member of its previous cluster then this
+ *  cluster is erased and the last cluster takes its index. This is why the
+ *  candidate index may have to be updated.
+ *
+ * @param[in] pats       The network training patterns set.
+ * @param[in,out] clusts The network clusters.
+ * @param[in,out] asg    The assignment of the training patterns.
+ * @param[in] iPat       The index of the pattern to add in 'pats'.
+ * @param[in] iCandidate The index of the cluter in which the pattern will be 
+ *  added.
+ *
+ * @return true if the pattern has been added to the cluster ; false if the 
+ *  pattern already belongs to the cluster. 
+ */
+static bool clust_add_pat(PatSet *pats, ClustStore *clusts, Assignment *asg,
+                          ulong iPat, ulong iCandidat){
+    ulong iClust = asg->clust[iPat];
+    Vector *patSet;     // Vector of ulongs
+
+    if(iClust != NOT_FOUND){
+        if(iClust == iCandidat){
+            return false;
+        }
+        else if(clust_rm_pat(clusts, asg, iClust, pats, iPat) &&
+                iCandidat == clusts->size){
+            iCandidat = iClust;
+        }
+    }
+    prot_add_pat(clusts, iCandidat, pats, iPat);
+    patSet = clust_pat_set(clusts, iCandidat);
+    asg->clust[iPat] = iCandidat;
+    asg->pos[iPat] = vec_size(patSet);
+    pat_set_push(patSet, iPat);
+    return true;
+}
+
+/** Initialize a candidates search.
+ *
+ * @param[out] search      The candidates search.
+ * @param[in]  pool        The workers matching the clusters, NULL to match
+ *  them in the calling thread only.
+ * @param[in]  rng         The random generator breaking ties (can be NULL
+ *  if the caller breaks them).
+ * @param[in]  par         The network parameters.
+ * @param[in]  len         The length of the patterns.
+ * @param[in]  constrained Whether the clusters must pass the choice and
+ *  vigilance tests.
+ */
+static void search_init(CandSearch *search, ThreadPool *pool, Rng *rng,
+                        InParam par, ulong len, bool constrained){
+    memset(search, 0, sizeof(*search));
+    search->pool = pool;
+    search->rng = rng;
+    search->beta = ratio_from_float(par.beta);
+    search->vigilance = ratio_from_float(par.vigilance);
+    search->constrained = constrained;
+    search->choice = search->beta.num + (uwide)len * search->beta.den;
+    search->nParts = pool != NULL ? pool->nThreads : 1;
+    search->partBest = malloc(search->nParts * sizeof(Score));
+    search->partTies = malloc(search->nParts * sizeof(ulong));
+    search->patRest = malloc((nb_words(len) / COM_ONES_CHUNK + 1) *
+                             sizeof(ulong));
+    search->patBits = malloc(len * sizeof(uint32_t));
+    if(search->partBest == NULL || search->partTies == NULL ||
+       search->patRest == NULL || search->patBits == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the candidates search\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+}
+
+/** Grow the ties array of a candidates search so it can hold 'capacity'
+ * clusters.
+ *
+ * @param[in,out] search   The candidates search.
+ * @param[in]     capacity The number of clusters to hold.
+ */
+static void search_reserve(CandSearch *search, ulong capacity){
+    if(capacity <= search->capacity){
+        return;
+    }
+    capacity = capacity > 2 * search->capacity ? capacity :
+                                                 2 * search->capacity;
+    search->ties = realloc(search->ties, capacity * sizeof(ulong));
+    if(search->ties == NULL){
+        fprintf(stderr, "ERROR: Can't allocate %lu candidates\nExiting...\n",
+                capacity);
+        exit(12);
+    }
+    search->capacity = capacity;
+}
+
+/** Free the arrays of a candidates search.
+ *
+ * @param[in,out] search The candidates search.
+ */
+static void search_finalize(CandSearch *search){
+    free(search->ties);
+    free(search->partBest);
+    free(search->partTies);
+    free(search->patRest);
+    free(search->patBits);
+}
+
+/** Set the pattern the clusters will be matched against.
+ *
+ * The floor is cleared, the caller can set it afterwards.
+ *
+ * @param[in,out] search The candidates search.
+ * @param[in]     pats   The patterns set.
+ * @param[in]     iPat   The index of the pattern.
+ */
+static void search_set_pat(CandSearch *search, PatSet *pats, ulong iPat){
+    const ulong nWords = pats->nWords;
+    const ulong patOnes = pats->nOnes[iPat];
+    const BitWord *pat;
+    ulong w, iChunk, i;
+    ulong rest = patOnes;
+    BitWord word;
+    uwide vigMin, coef;
+    ulong choiceMin;
+
+    search->patOnes = patOnes;
+    search->hasFloor = false;
+    if(pats->idx != NULL){
+        search->pat = NULL;
+        memcpy(search->patBits, pat_idx(pats, iPat),
+               patOnes * sizeof(uint32_t));
+        search->patKey = bits_idx_fingerprint(search->patBits, patOnes);
+    }
+    else{
+        pat = pat_get(pats, iPat);
+        search->pat = pat;
+        for(w = 0, i = 0; w < nWords; w++){
+            for(word = pat[w]; word != 0; word &= word - 1){
+                search->patBits[i++] = w * WORD_BITS + __builtin_ctzll(word);
+            }
+        }
+        for(w = 0, iChunk = 0; w + COM_ONES_CHUNK < nWords;
+            w += COM_ONES_CHUNK, iChunk++){
+            rest -= bits_ones(pat + w, COM_ONES_CHUNK);
+            search->patRest[iChunk] = rest;
+        }
+        search->patKey = bits_fingerprint(pat, nWords);
+    }
+    // Smallest com such as com / patOnes >= vigilance
+    vigMin = ((uwide)search->vigilance.num * patOnes +
+              search->vigilance.den - 1) / search->vigilance.den;
+    search->vigMin = vigMin > ULONG_MAX ? ULONG_MAX : (ulong)vigMin;
+    search->minOnes = 0;
+    if(search->constrained){
+        // A prototype has at most min(ones, patOnes) 1 in common with the
+        // pattern, so it passes the vigilance test only if ones >= vigMin
+        // and the choice test only if ones * coef >= patOnes * beta
+        coef = search->choice - (uwide)patOnes * search->beta.den;
+        choiceMin = coef == 0 ? 0 : (ulong)(((uwide)patOnes * search->beta.num +
+                                             coef - 1) / coef);
+        search->minOnes = search->vigMin > patOnes ? ULONG_MAX :
+                          search->vigMin > choiceMin ? search->vigMin :
+                                                       choiceMin;
+    }
+}
+
+/** Compare the scores com1 / (beta + ones1) and com2 / (beta + ones2).
+ *
+ * As beta is an exact fraction the scores are compared with integer
+ * cross-multiplications: equal scores are always found equal.
+ *
+ * @param[in] beta  The network beta parameter.
+ * @param[in] com1  The number of common 1 of the first score.
+ * @param[in] ones1 The number of prototype 1 of the first score.
+ * @param[in] com2  The number of common 1 of the second score.
+ * @param[in] ones2 The number of prototype 1 of the second score.
+ *
+ * @return A positive value if the first score is the highest, a negative
+ *  value if it is the lowest, 0 if they are equal.
+ */
+static int score_cmp(Ratio beta, ulong com1, ulong ones1, ulong com2,
+                     ulong ones2){
+    uwide a = com1 * (beta.num + (uwide)ones2 * beta.den);
+    uwide b = com2 * (beta.num + (uwide)ones1 * beta.den);
+
+    return (a > b) - (a < b);
+}
+
+/** Tell if a cluster can still be the best match of the search pattern.
+ *
+ * A cluster whose prototype has 'ones' 1 and at most 'com' 1 in common with
+ * the pattern can't be the best match if:
+ *  - It fails the vigilance test: com / patOnes < vigilance.
+ *  - It fails the choice test: com / (beta + ones) < patOnes / (beta + len).
+ *  - Its score is lower than the best one: com / (beta + ones) < best.
+ * The tests are only checked by a constrained search.
+ *
+ * @param[in] search The candidates search.
+ * @param[in] com    An upper bound of the number of common 1.
+ * @param[in] ones   The number of 1 of the prototype.
+ * @param[in] best   The best score so far, NULL if there's none.
+ *
+ * @return false if the cluster can't be the best match.
+ */
+static bool can_match(const CandSearch *search, ulong com, ulong ones,
+                      const Score *best){
+    if(search->constrained){
+        if(com < search->vigMin ||
+           com * search->choice < search->patOnes *
+           (search->beta.num + (uwide)ones * search->beta.den)){
+            return false;
+        }
+    }
+    return best == NULL ||
+           score_cmp(search->beta, com, ones, best->com, best->ones) >= 0;
+}
+
+/** Compute the range of number of 1 of the prototypes which can still be the
+ * best match of the search pattern.
+ *
+ * A prototype with 'ones' 1 has at most min(ones, patOnes) 1 in common with
+ * the pattern, so its score is at most ones / (beta + ones) if ones <=
+ * patOnes (which grows with ones) and patOnes / (beta + ones) otherwise
+ * (which decreases with ones): the prototypes whose score can reach 'best'
+ * have a number of 1 in a range. It is checked before reading the prototype.
+ *
+ * @param[in]  search The candidates search.
+ * @param[in]  best   The best score so far, NULL if there's none.
+ * @param[out] lo     The lowest number of 1.
+ * @param[out] hi     The highest number of 1.
+ */
+static void ones_range(const CandSearch *search, const Score *best, ulong *lo,
+                       ulong *hi){
+    const Ratio beta = search->beta;
+    uwide num, den, bound;
+
+    *lo = search->minOnes;
+    *hi = ULONG_MAX;
+    if(best == NULL){
+        return;
+    }
+    // ones / (beta + ones) >= best.com / (beta + best.ones)
+    den = beta.num + (uwide)(best->ones - best->com) * beta.den;
+    if(den > 0){
+        bound = ((uwide)best->com * beta.num + den - 1) / den;
+        if(bound > *lo){
+            *lo = bound > ULONG_MAX ? ULONG_MAX : (ulong)bound;
+        }
+    }
+    // patOnes / (beta + ones) >= best.com / (beta + best.ones)
+    if(best->com > 0){
+        num = (uwide)search->patOnes *
+              (beta.num + (uwide)best->ones * beta.den);
+        bound = (uwide)best->com * beta.num;
+        bound = num < bound ? 0 : (num - bound) / ((uwide)best->com * beta.den);
+        *hi = bound > ULONG_MAX ? ULONG_MAX : (ulong)bound;
+    }
+}
+
+/** Count the 1 a prototype and the search pattern have in common, giving up
+ * as soon as the cluster can't be the best match.
+ *
+ * The words are counted by chunks of COM_ONES_CHUNK words. After each chunk,
+ * the words left can add at most the 1 left in the pattern and in the
+ * prototype: if even this can't make a best match the cluster is given up.
+ * A sparse pattern probes the prototype by chunks of COM_PROBE_CHUNK 1
+ * instead.
+ *
+ * @param[in]  search The candidates search.
+ * @param[in]  prot   The prototype.
+ * @param[in]  ones   The number of 1 of the prototype.
+ * @param[in]  nWords The number of words of the prototype.
+ * @param[in]  best   The best score so far, NULL if there's none.
+ * @param[out] com    The number of common 1.
+ *
+ * @return false if the cluster has been given up.
+ */
+static bool com_ones_bounded(const CandSearch *search, const BitWord *prot,
+                             ulong ones, ulong nWords, const Score *best,
+                             ulong *com){
+    ulong w, iChunk, rest, i;
+
+    *com = 0;
+    if(search->pat == NULL){
+        for(i = 0; i + COM_PROBE_CHUNK < search->patOnes;
+            i += COM_PROBE_CHUNK){
+            *com += bits_probe_ones(prot, search->patBits + i,
+                                    COM_PROBE_CHUNK);
+            rest = search->patOnes - i - COM_PROBE_CHUNK;
+            if(ones - *com < rest){
+                rest = ones - *com;
+            }
+            if(!can_match(search, *com + rest, ones, best)){
+                return false;
+            }
+        }
+        *com += bits_probe_ones(prot, search->patBits + i,
+                                search->patOnes - i);
+        return true;
+    }
+    for(w = 0, iChunk = 0; w + COM_ONES_CHUNK < nWords;
+        w += COM_ONES_CHUNK, iChunk++){
+        *com += comOnes(prot + w, search->pat + w, COM_ONES_CHUNK);
+        rest = search->patRest[iChunk];
+        if(ones - *com < rest){
+            rest = ones - *com;
+        }
+        if(!can_match(search, *com + rest, ones, best)){
+            return false;
+        }
+    }
+    *com += comOnes(prot + w, search->pat + w, nWords - w);
+    return true;
+}
+
+/** Add a cluster to the best matching ones of a part.
+ *
+ * @param[in,out] search The candidates search.
+ * @param[in]     from   The index of the first cluster of the part.
+ * @param[in]     iClust The index of the cluster.
+ * @param[in]     com    The number of 1 its prototype has in common with the
+ *  pattern.
+ * @param[in]     ones   The number of 1 of its prototype.
+ * @param[in,out] best   The best score of the part.
+ * @param[in,out] pBest  'best' if it is set, NULL otherwise.
+ * @param[in,out] nTies  The number of clusters of the part having it.
+ *
+ * @return true if the cluster has a new best score.
+ */
+static bool part_add(CandSearch *search, ulong from, ulong iClust, ulong com,
+                     ulong ones, Score *best, Score **pBest, ulong *nTies){
+    bool res = false;
+
+    if(!can_match(search, com, ones, *pBest)){
+        return false;
+    }
+    if(*pBest == NULL ||
+       score_cmp(search->beta, com, ones, best->com, best->ones) > 0){
+        *nTies = 0;
+        best->com = com;
+        best->ones = ones;
+        *pBest = best;
+        res = true;
+    }
+    search->ties[from + (*nTies)++] = iClust;
+    return res;
+}
+
+/** Match the clusters 'from' to 'to' - 1 reading their prototypes.
+ *
+ * The prototypes are read one after the other from the prototypes matrix.
+ *
+ * @param[in,out] search The candidates search.
+ * @param[in]     clusts The network clusters.
+ * @param[in]     from   The index of the first cluster.
+ * @param[in]     to     The index after the last cluster.
+ * @param[in,out] best   The best score of the part.
+ * @param[in,out] pBest  'best' if it is set, NULL otherwise.
+ *
+ * @return The number of clusters having the best score.
+ */
+static ulong score_rows(CandSearch *search, ClustStore *clusts, ulong from,
+                        ulong to, Score *best, Score **pBest){
+    const ulong nWords = clusts->nWords;
+    const BitWord *prot = clust_prot(clusts, from);
+    ulong iClust, ones, com, lo, hi;
+    ulong nTies = 0;
+
+    ones_range(search, *pBest, &lo, &hi);
+    for(iClust = from; iClust < to; iClust++, prot += nWords){
+        ones = clusts->nOnes[iClust];
+        if(ones < lo || ones > hi ||
+           !com_ones_bounded(search, prot, ones, nWords, *pBest, &com)){
+            continue;
+        }
+        if(part_add(search, from, iClust, com, ones, best, pBest, &nTies)){
+            ones_range(search, *pBest, &lo, &hi);
+        }
+    }
+    return nTies;
+}
+
+/** Returns the number of common 1 every cluster needs to be the best match.
+ *
+ * A cluster needs vigMin common 1 to pass the vigilance test (constrained
+ * search) and, as its prototype has at least 'lo' 1, at least
+ * best.com * (beta + lo) / (beta + best.ones) to reach the best score.
+ *
+ * @param[in] search The candidates search.
+ * @param[in] best   The best score so far, NULL if there's none.
+ * @param[in] lo     The lowest number of 1 of the prototypes (see
+ *  ones_range()).
+ *
+ * @return The number of common 1.
+ */
+static ulong com_min(const CandSearch *search, const Score *best, ulong lo){
+    const Ratio beta = search->beta;
+    ulong res = search->constrained ? search->vigMin : 0;
+    uwide den, bound;
+
+    if(best != NULL){
+        den = beta.num + (uwide)best->ones * beta.den;
+        if(den > 0){
+            bound = ((uwide)best->com * (beta.num + (uwide)lo * beta.den) +
+                     den - 1) / den;
+            if(bound > res){
+                res = bound > ULONG_MAX ? ULONG_MAX : (ulong)bound;
+            }
+        }
+    }
+    return res;
+}
+
+/** Returns the mask of the bit-sliced counters which are at least 'min'.
+ *
+ * The counters are compared from their most significant bit on: a counter is
+ * greater than 'min' from the first bit where it has a 1 and 'min' a 0, as
+ * long as the previous bits were equal.
+ *
+ * @param[in] planes  The counters, planes[j] holds the bit j of every
+ *  counters.
+ * @param[in] nPlanes The number of bits of the counters.
+ * @param[in] min     The minimum.
+ *
+ * @return The mask of the counters which are at least 'min'.
+ */
+static BitWord planes_at_least(const BitWord *planes, ulong nPlanes,
+                               ulong min){
+    BitWord gt = 0;
+    BitWord eq = ~(BitWord)0;
+    ulong j;
+
+    if(nPlanes < WORD_BITS && (min >> nPlanes) != 0){
+        return 0;
+    }
+    for(j = nPlanes; j-- > 0;){
+        if((min >> j) & 1){
+            eq &= planes[j];
+        }
+        else{
+            gt |= eq & planes[j];
+            eq &= ~planes[j];
+        }
+    }
+    return gt | eq;
+}
+
+/** Match the clusters 'from' to 'to' - 1 with the bit-sliced index.
+ *
+ * The clusters are matched by blocks of WORD_BITS clusters, one word of the
+ * index columns. The common 1 of the clusters of a block are counted by
+ * adding the columns of the 1 of the pattern to bit-sliced counters:
+ * planes[j] holds the bit j of the counter of every clusters of the block.
+ * This takes about patOnes word operations per block instead of nWords per
+ * cluster. The blocks without a cluster in the range of ones_range() are
+ * skipped, and the counters are compared to com_min() all at once before
+ * any of them is read.
+ *
+ * @param[in,out] search The candidates search.
+ * @param[in]     clusts The network clusters (with an index).
+ * @param[in]     from   The index of the first cluster.
+ * @param[in]     to     The index after the last cluster.
+ * @param[in,out] best   The best score of the part.
+ * @param[in,out] pBest  'best' if it is set, NULL otherwise.
+ *
+ * @return The number of clusters having the best score.
+ */
+static ulong score_cols(CandSearch *search, ClustStore *clusts, ulong from,
+                        ulong to, Score *best, Score **pBest){
+    ulong iBlock, iClust, last, ones, com, lo, hi, i, j;
+    ulong nPlanes, minCom;
+    ulong nTies = 0;
+    BitWord planes[WORD_BITS];
+    BitWord mask, carry, col;
+
+    ones_range(search, *pBest, &lo, &hi);
+    minCom = com_min(search, *pBest, lo);
+    for(iBlock = from / WORD_BITS; iBlock * WORD_BITS < to; iBlock++){
+        // the clusters of the block which can be the best match
+        iClust = iBlock * WORD_BITS > from ? iBlock * WORD_BITS : from;
+        last = (iBlock + 1) * WORD_BITS < to ? (iBlock + 1) * WORD_BITS : to;
+        mask = 0;
+        for(; iClust < last; iClust++){
+            ones = clusts->nOnes[iClust];
+            if(ones >= lo && ones <= hi){
+                mask |= bit_mask(iClust);
+            }
+        }
+        if(mask == 0){
+            continue;
+        }
+        // add the columns of the 1 of the pattern to the counters
+        nPlanes = 0;
+        for(i = 0; i < search->patOnes; i++){
+            carry = clust_col(clusts, search->patBits[i])[iBlock];
+            for(j = 0; carry != 0; j++){
+                if(j == nPlanes){
+                    planes[nPlanes++] = 0;
+                }
+                col = planes[j] & carry;
+                planes[j] ^= carry;
+                carry = col;
+            }
+        }
+        mask &= planes_at_least(planes, nPlanes, minCom);
+        for(; mask != 0; mask &= mask - 1){
+            iClust = iBlock * WORD_BITS + __builtin_ctzll(mask);
+            com = 0;
+            for(j = 0; j < nPlanes; j++){
+                com |= ((planes[j] >> (iClust % WORD_BITS)) & 1) << j;
+            }
+            if(part_add(search, from, iClust, com, clusts->nOnes[iClust], best,
+                        pBest, &nTies)){
+                ones_range(search, *pBest, &lo, &hi);
+                minCom = com_min(search, *pBest, lo);
+            }
+        }
+    }
+    return nTies;
+}
+
+/** Match a part of the network prototypes and find the best ones of the part.
+ *
+ * The clusters are split in job->nParts contiguous parts. The best score of
+ * the part 'iPart' is written in partBest[iPart] and the IDs of the clusters
+ * having it in the ties array, from the first index of the part on (a part
+ * can't have more ties than clusters). A constrained search leaves out the
+ * clusters failing the choice or the vigilance test.
+ *
+ * A cluster is skipped without reading its prototype when its number of 1 is
+ * out of the range of the ones which can beat the best score of the part (or
+ * the floor, see ones_range()). The prototypes are read from the bit-sliced
+ * index if the clusters have one (see score_cols()), from the prototypes
+ * matrix otherwise (see score_rows()).
+ *
+ * @param[in,out] arg   The matching job (a ScoreJob).
+ * @param[in]     iPart The index of the part to match.
+ */
+static void score_part(void *arg, ulong iPart){
+    ScoreJob *job = arg;
+    CandSearch *search = job->search;
+    ClustStore *clusts = job->clusts;
+    const ulong from = iPart * clusts->size / job->nParts;
+    const ulong to = (iPart + 1) * clusts->size / job->nParts;
+    Score best = search->floor;
+    Score *pBest = search->hasFloor ? &best : NULL;
+
+    if(clusts->cols != NULL){
+        search->partTies[iPart] = score_cols(search, clusts, from, to, &best,
+                                             &pBest);
+    }
+    else{
+        search->partTies[iPart] = score_rows(search, clusts, from, to, &best,
+                                             &pBest);
+    }
+    search->partBest[iPart] = best;
+}
+
+/** Returns the number of 1 a prototype and the search pattern have in common.
+ *
+ * @param[in] search The candidates search.
+ * @param[in] clusts The network clusters.
+ * @param[in] iClust The index of the cluster.
+ *
+ * @return The number of common 1.
+ */
+static ulong prot_com(const CandSearch *search, ClustStore *clusts,
+                      ulong iClust){
+    if(search->pat == NULL){
+        return bits_probe_ones(clust_prot(clusts, iClust), search->patBits,
+                               search->patOnes);
+    }
+    return comOnes(clust_prot(clusts, iClust), search->pat, clusts->nWords);
+}
+
+/** Find the clusters whose prototype is equal to the search pattern.
+ *
+ * As beta > 0, such a prototype has the highest possible score
+ * patOnes / (beta + patOnes): any other prototype either has less 1 in
+ * common with the pattern or more 1, or less 1 and a score of at most
+ * ones / (beta + ones) which grows with ones. It passes the choice test and
+ * the vigilance test (unless the vigilance is above 1). The prototypes equal
+ * to the pattern are then exactly the best matches, and they are found from
+ * the fingerprint of the pattern without scoring every clusters.
+ *
+ * @param[in,out] search The candidates search (ties and nTies are set if
+ *  there are such prototypes).
+ * @param[in]     clusts The network clusters.
+ *
+ * @return true if there is at least one prototype equal to the pattern.
+ */
+static bool exact_matches(CandSearch *search, ClustStore *clusts){
+    const ulong patOnes = search->patOnes;
+    ulong iClust, com, i;
+
+    if(!EXACT_MATCHES || search->beta.num == 0 || patOnes == 0 ||
+       !can_match(search, patOnes, patOnes, NULL)){
+        return false;
+    }
+    search->nTies = 0;
+    for(iClust = clusts_key_first(clusts, search->patKey);
+        iClust != NOT_FOUND; iClust = clusts_key_next(clusts, iClust)){
+        if(clusts->nOnes[iClust] != patOnes){
+            continue;
+        }
+        com = prot_com(search, clusts, iClust);
+        if(com != patOnes){
+            continue;
+        }
+        // the ties are sorted by increasing ID, as score_clusters() does
+        for(i = search->nTies; i > 0 && search->ties[i - 1] > iClust; i--){
+            search->ties[i] = search->ties[i - 1];
+        }
+        search->ties[i] = iClust;
+        search->nTies++;
+    }
+    return search->nTies > 0;
+}
+
+/** Match every clusters against the search pattern and find the best ones.
+ *
+ * The 'ties' array is filled with the best score prototype(s) ID(s) (there can
+ * be multiple prototypes with the same best score), by increasing ID.
+ *
+ * If some prototypes are equal to the pattern they are the best ones and no
+ * cluster is scored (see exact_matches()).
+ *
+ * Above PAR_SCORES_MIN_CLUSTS clusters, the parts of the prototypes matrix are
+ * matched by the pool workers. The best scores of the parts are then merged in
+ * part order so the ties are the same whatever the number of threads.
+ *
+ * @param[in,out] search The candidates search (ties and nTies are set).
+ * @param[in]     clusts The network clusters.
+ */
+static void score_clusters(CandSearch *search, ClustStore *clusts){
+    ulong iPart, from;
+    Score *best = NULL;
+    ScoreJob job = {search, clusts, 1};
+
+    search_reserve(search, clusts->size);
+    if(exact_matches(search, clusts)){
+        return;
+    }
+    if(search->nParts > 1 && clusts->size >= PAR_SCORES_MIN_CLUSTS){
+        job.nParts = search->nParts;
+        pool_run(search->pool, score_part, &job, job.nParts);
+    }
+    else{
+        score_part(&job, 0);
+    }
+    for(iPart = 0; iPart < job.nParts; iPart++){
+        if(search->partTies[iPart] > 0 &&
+           (best == NULL ||
+            score_cmp(search->beta, search->partBest[iPart].com,
+                      search->partBest[iPart].ones, best->com,
+                      best->ones) > 0)){
+            best = &search->partBest[iPart];
+        }
+    }
+    search->nTies = 0;
+    for(iPart = 0; iPart < job.nParts && best != NULL; iPart++){
+        if(search->partTies[iPart] > 0 &&
+           score_cmp(search->beta, search->partBest[iPart].com,
+                     search->partBest[iPart].ones, best->com,
+                     best->ones) == 0){
+            from = iPart * clusts->size / job.nParts;
+            memmove(search->ties + search->nTies, search->ties + from,
+                    search->partTies[iPart] * sizeof(ulong));
+            search->nTies += search->partTies[iPart];
+        }
+    }
+}
+
+/** Set the floor of a constrained search to the current cluster of its
+ * pattern.
+ *
+ * The prototype of the current cluster of a pattern is included in the
+ * pattern, so its score is known without reading it and it passes both tests
+ * unless the prototype lost too many 1.
+ *
+ * @param[in,out] search The constrained candidates search, its pattern set.
+ * @param[in]     clusts The network clusters.
+ * @param[in]     iClust The cluster of the pattern, NOT_FOUND if it has none.
+ */
+static void search_set_floor(CandSearch *search, ClustStore *clusts,
+                             ulong iClust){
+    ulong ones;
+
+    if(iClust == NOT_FOUND){
+        return;
+    }
+    ones = clusts->nOnes[iClust];
+    if(can_match(search, ones, ones, NULL)){
+        search->floor.com = ones;
+        search->floor.ones = ones;
+        search->hasFloor = true;
+    }
+}
+
+/** Match the clusters 'from' to 'to' - 1 against the search pattern.
+ *
+ * Unlike score_clusters() the clusters are matched in the calling thread and
+ * without looking for prototypes equal to the pattern.
+ *
+ * @param[in,out] search The candidates search (ties and nTies are set).
+ * @param[in]     clusts The network clusters.
+ * @param[in]     from   The index of the first cluster.
+ * @param[in]     to     The index after the last cluster.
+ */
+static void score_range(CandSearch *search, ClustStore *clusts, ulong from,
+                        ulong to){
+    Score best = search->floor;
+    Score *pBest = search->hasFloor ? &best : NULL;
+
+    search->nTies = 0;
+    if(from == to){
+        return;
+    }
+    search_reserve(search, to);
+    if(clusts->cols != NULL){
+        search->nTies = score_cols(search, clusts, from, to, &best, &pBest);
+    }
+    else{
+        search->nTies = score_rows(search, clusts, from, to, &best, &pBest);
+    }
+    memmove(search->ties, search->ties + from, search->nTies * sizeof(ulong));
+}
+
+/**Compute and returns the prototype closest to a given pattern.
+ *
+ * The prototype with the highest score is returned, if more than one
+ * prototype have the highest score then the returned one is randomly chosen.
+ * If there's no cluster then the function return false.
+ *
+ * @param[out]    iCandidat The index of the prototype closest to the given
+ *  pattern.
+ * @param[in]     pats      The patterns set.
+ * @param[in]     iPat      The index of the reference pattern.
+ * @param[in]     clusts    The network clusters.
+ * @param[in,out] search    An unconstrained candidates search.
+ * @param[in,out] seed      The state of the random generator breaking ties.
+ *
+ * @return true or false weither a candidate has been found.
+ */
+static bool nearest_prot(ulong *iCandidat, PatSet *pats, ulong iPat,
+                         ClustStore *clusts, CandSearch *search,
+                         unsigned int *seed){
+    search_set_pat(search, pats, iPat);
+    score_clusters(search, clusts);
+    if(search->nTies == 0){         // No cluster
+        return false;
+    }
+    if(search->nTies == 1){         // Don't have to chose
+        *iCandidat = search->ties[0];
+    }
+    else{                           // Randomly chose.
+        *iCandidat = search->ties[rand_r(seed) % search->nTies];
+    }
+    return true;
+}
+
+/** Compute the statistics of the last training pass.
+ *
+ * Sets the 'noReassigned' parameter (number of patterns reassigned to another
+ * cluster during the pass) and the 'fluc' parameter (fluctuation percentage for
+ * the pass).
+ *
+ * @param[out] noReassigned Number of patterns which have been assigned to 
+ *  another cluster during the pass.
+ * @param[out] fluc         Fluctuation percentage of the pass.
+ * @param[in] reassigned    Array of values indicating the ID of the patterns
+ *  which have been reassigned to another cluster (ID is the index in the 
+ *  array).
+ * @param[in] uniq          The unique training patterns if the patterns have
+ *  been collapsed (every copies of a reassigned pattern count), NULL
+ *  otherwise.
+ * @param[in] nPats         The number of training patterns, copies included.
+ */
+static void compute_pass_stats(ulong *noReassigned, float *fluc,
+                               Vector *reassigned, const UniqPats *uniq,
+                               ulong nPats){
+    ulong c;
+
+    *noReassigned = 0;
+    for(c = 0; c < vec_size(reassigned); c++){
+        if(vec_get_as_char(reassigned, c) != false){
+            *noReassigned += uniq != NULL ? uniq->copyStart[c + 1] -
+                                            uniq->copyStart[c] : 1;
+        }
+    }
+    *fluc = ((float)*noReassigned / nPats) * 100;
+}
+
+/** Initialize the matches cache of the training patterns.
+ *
+ * @param[out] cache The cache, none of the patterns has been matched yet.
+ * @param[in]  nPats The number of training patterns.
+ */
+static void cache_init(MatchCache *cache, ulong nPats){
+    ulong iPat;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->matches = malloc((nPats > 0 ? nPats : 1) * sizeof(PatMatch));
+    cache->stamps = malloc((nPats > 0 ? nPats : 1) * sizeof(ulong));
+    if(cache->matches == NULL || cache->stamps == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the matches cache\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    for(iPat = 0; iPat < nPats; iPat++){
+        cache->stamps[iPat] = NOT_FOUND;
+    }
+}
+
+/** Free the arrays of the matches cache of the training patterns.
+ *
+ * @param[in,out] cache The cache.
+ */
+static void cache_finalize(MatchCache *cache){
+    free(cache->matches);
+    free(cache->stamps);
+    free(cache->log);
+    free(cache->lastEntry);
+}
+
+/** Log that a cluster index has been modified.
+ *
+ * @param[in,out] cache  The cache.
+ * @param[in]     iClust The index of the modified cluster.
+ */
+static void cache_touch(MatchCache *cache, ulong iClust){
+    ulong n;
+
+    if(iClust >= cache->nLastEntries){
+        n = 2 * iClust + 1;
+        cache->lastEntry = realloc(cache->lastEntry, n * sizeof(ulong));
+        if(cache->lastEntry == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the matches cache\n"\
+                    "Exiting...\n");
+            exit(12);
+        }
+        cache->nLastEntries = n;
+    }
+    if(cache->logEnd - cache->logStart == cache->logCapacity){
+        cache->logCapacity = 2 * cache->logCapacity + 1;
+        cache->log = realloc(cache->log, cache->logCapacity * sizeof(ulong));
+        if(cache->log == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the matches cache\n"\
+                    "Exiting...\n");
+            exit(12);
+        }
+    }
+    cache->log[cache->logEnd - cache->logStart] = iClust;
+    cache->lastEntry[iClust] = cache->logEnd++;
+}
+
+/** Log the cluster indexes modified by the assignment of a pattern.
+ *
+ * @param[in,out] cache  The cache.
+ * @param[in]     iClust The cluster of the pattern before it was assigned,
+ *  NOT_FOUND if it had none.
+ * @param[in]     size   The number of clusters before it was assigned.
+ * @param[in]     iNew   The cluster of the pattern.
+ */
+static void cache_log_assign(MatchCache *cache, ulong iClust, ulong size,
+                             ulong iNew){
+    if(iNew == iClust){
+        return;
+    }
+    // its previous cluster and the last one, which took its place if it has
+    // been erased
+    if(iClust != NOT_FOUND){
+        cache_touch(cache, iClust);
+        cache_touch(cache, size - 1);
+    }
+    cache_touch(cache, iNew);
+}
+
+/** Drop the log entries which are older than every stamp.
+ *
+ * @param[in,out] cache The cache.
+ * @param[in]     nPats The number of training patterns.
+ */
+static void cache_trim(MatchCache *cache, ulong nPats){
+    ulong iPat;
+    ulong first = cache->logEnd;
+
+    for(iPat = 0; iPat < nPats; iPat++){
+        if(cache->stamps[iPat] != NOT_FOUND && cache->stamps[iPat] < first){
+            first = cache->stamps[iPat];
+        }
+    }
+    if(first > cache->logStart){
+        memmove(cache->log, cache->log + (first - cache->logStart),
+                (cache->logEnd - first) * sizeof(ulong));
+        cache->logStart = first;
+    }
+}
+
+/** Tell if the best matching clusters of the search pattern may have changed
+ * since a given log entry.
+ *
+ * Only the clusters modified since then can have a different score. The best
+ * matching clusters are the same if none of them has been modified and none
+ * of the modified clusters now passes both tests with a score at least as
+ * high as the best one. A cluster modified several times is checked once, at
+ * its last entry.
+ *
+ * @param[in]     cache  The cache.
+ * @param[in,out] search The constrained candidates search, its pattern set.
+ * @param[in]     clusts The network clusters.
+ * @param[in]     match  The best matching clusters of the pattern.
+ * @param[in]     stamp  The number of the first log entry to check.
+ *
+ * @return false if the best matching clusters are still 'match'.
+ */
+static bool cache_changed(const MatchCache *cache, CandSearch *search,
+                          ClustStore *clusts, const PatMatch *match,
+                          ulong stamp){
+    ulong e, i, iClust;
+
+    if(match->nTies > MATCH_MAX_TIES){
+        return true;
+    }
+    for(e = stamp; e < cache->logEnd; e++){
+        iClust = cache->log[e - cache->logStart];
+        if(cache->lastEntry[iClust] != e){
+            continue;
+        }
+        for(i = 0; i < match->nTies; i++){
+            if(match->ties[i] == iClust){
+                return true;
+            }
+        }
+        if(iClust < clusts->size &&
+           can_match(search, prot_com(search, clusts, iClust),
+                     clusts->nOnes[iClust],
+                     match->nTies > 0 ? &match->best : NULL)){
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Tell if the last best matching clusters of a pattern are still right.
+ *
+ * A modified cluster is checked alone while the other clusters are matched
+ * together through the bit-sliced index: if there are more than
+ * 1 / CACHE_CHECK_COST modifications per cluster checking them would cost
+ * more than matching the clusters again, so the pattern is matched again.
+ *
+ * @param[in]     cache  The cache.
+ * @param[in,out] search The constrained candidates search, its pattern set.
+ * @param[in]     clusts The network clusters.
+ * @param[in]     iPat   The index of the pattern.
+ *
+ * @return true if cache->matches[iPat] holds the best matching clusters.
+ */
+static bool cache_valid(const MatchCache *cache, CandSearch *search,
+                        ClustStore *clusts, ulong iPat){
+    const ulong stamp = cache->stamps[iPat];
+
+    return MATCH_CACHE && stamp != NOT_FOUND &&
+           cache->logEnd - stamp <= clusts->size / CACHE_CHECK_COST &&
+           !cache_changed(cache, search, clusts, &cache->matches[iPat], stamp);
+}
+
+/** Save the best matching clusters found by a search.
+ *
+ * @param[out] match  The best matching clusters.
+ * @param[in]  search The candidates search, its ties set.
+ * @param[in]  clusts The network clusters.
+ */
+static void match_set(PatMatch *match, const CandSearch *search,
+                      ClustStore *clusts){
+    match->nTies = search->nTies;
+    if(search->nTies > 0 && search->nTies <= MATCH_MAX_TIES){
+        memcpy(match->ties, search->ties, search->nTies * sizeof(ulong));
+        match->best.ones = clusts->nOnes[match->ties[0]];
+        match->best.com = prot_com(search, clusts, match->ties[0]);
+    }
+}
+
+/** Set the ties of a search to saved best matching clusters.
+ *
+ * @param[in,out] search The candidates search.
+ * @param[in]     match  The best matching clusters (at most MATCH_MAX_TIES).
+ */
+static void search_set_ties(CandSearch *search, const PatMatch *match){
+    if(match->nTies > 0){
+        search_reserve(search, match->nTies);
+        memcpy(search->ties, match->ties, match->nTies * sizeof(ulong));
+    }
+    search->nTies = match->nTies;
+}
+
+/** Assign a training pattern to one of the best matching clusters of a
+ * search.
+ *
+ * The pattern goes to the cluster in search->ties (randomly chosen if more
+ * than one cluster have the best score), or to a new cluster if there's none.
+ *
+ * @param[in]     pats       The training patterns set.
+ * @param[in,out] clusts     The network clusters.
+ * @param[in,out] search     The constrained candidates search, its ties set.
+ * @param[in,out] asg        The assignment of the training patterns.
+ * @param[in,out] reassigned The reassigned pattern flags.
+ * @param[in]     iPat       The index of the pattern.
+ */
+static void assign_ties(PatSet *pats, ClustStore *clusts, CandSearch *search,
+                        Assignment *asg, Vector *reassigned, ulong iPat){
+    bool trueValue = true;
+    // Index of the best matching cluster in 'clusts'
+    ulong iCandidat;
+
+    // No cluster passes both tests: create a new cluster
+    if(search->nTies == 0){
+        clust_add_new(clusts, asg, pats, iPat);
+        vec_replace_at(reassigned, iPat, &trueValue);
+        return;
+    }
+    if(search->nTies == 1){         // Don't have to chose
+        iCandidat = search->ties[0];
+    }
+    else{                           // Randomly chose.
+        iCandidat = search->ties[rng_next(search->rng) % search->nTies];
+    }
+    if(clust_add_pat(pats, clusts, asg, iPat, iCandidat)){
+        vec_replace_at(reassigned, iPat, &trueValue);
+    }
+}
+
+/** Assign a training pattern to its best matching cluster.
+ *
+ * The clusters are tried by decreasing score until one passes the vigilance
+ * test, and the first one failing the choice test ends the search with a new
+ * cluster. The score of a cluster is the left side of the choice test, so
+ * every cluster after the first one failing it fails it too: the pattern goes
+ * to the cluster with the highest score among the ones passing both tests
+ * (randomly chosen if more than one cluster have this score), or to a new
+ * cluster if there's none.
+ *
+ * The prototype of the current cluster of the pattern is included in the
+ * pattern, so its score is known without reading it and it passes both tests
+ * unless the prototype lost too many 1: it is the floor of the search.
+ *
+ * The clusters aren't matched at all if the best matching clusters found for
+ * the pattern at the previous pass are still right (see cache_valid()): once
+ * the training converges most of the clusters are left untouched by a pass.
+ *
+ * @param[in]     pats       The training patterns set.
+ * @param[in,out] clusts     The network clusters.
+ * @param[in,out] search     The constrained candidates search.
+ * @param[in,out] asg        The assignment of the training patterns.
+ * @param[in,out] cache      The last best matching clusters of the patterns.
+ * @param[in,out] reassigned The reassigned pattern flags.
+ * @param[in]     iPat       The index of the current training pattern to 
+ *  assigned to a cluster.
+ */
+static void assign_pat(PatSet *pats, ClustStore *clusts, CandSearch *search,
+                       Assignment *asg, MatchCache *cache, Vector *reassigned,
+                       ulong iPat){
+    const ulong iClust = asg->clust[iPat];
+    const ulong size = clusts->size;
+
+    search_set_pat(search, pats, iPat);
+    if(cache_valid(cache, search, clusts, iPat)){
+        search_set_ties(search, &cache->matches[iPat]);
+    }
+    else{
+        search_set_floor(search, clusts, iClust);
+        score_clusters(search, clusts);
+        match_set(&cache->matches[iPat], search, clusts);
+    }
+    cache->stamps[iPat] = cache->logEnd;
+    assign_ties(pats, clusts, search, asg, reassigned, iPat);
+    cache_log_assign(cache, iClust, size, asg->clust[iPat]);
+}
+
+/** Find the best matching cluster of a part of a batch of training patterns.
+ *
+ * The patterns of the batch are split in job->nParts contiguous parts. The
+ * clusters aren't modified while the batch is assigned: the patterns are
+ * matched against the prototypes of the start of the batch, as assign_pat()
+ * would do, and their choice is written in job->choice.
+ *
+ * The ties are broken with a random generator seeded from job->seed and the
+ * pattern index, so the choice of a pattern dosen't depend on the part it
+ * belongs to.
+ *
+ * @param[in,out] arg   The batch (a BatchJob).
+ * @param[in]     iPart The index of the part to assign.
+ */
+static void batch_part(void *arg, ulong iPart){
+    BatchJob *job = arg;
+    CandSearch *search = &job->scratch[iPart];
+    const ulong nPats = job->to - job->from;
+    const ulong from = job->from + iPart * nPats / job->nParts;
+    const ulong to = job->from + (iPart + 1) * nPats / job->nParts;
+    ulong iPat;
+    ulong *choice;
+    unsigned int seed;
+
+    for(iPat = from; iPat < to; iPat++){
+        choice = &job->choice[iPat - job->from];
+        search_set_pat(search, job->pats, iPat);
+        search_set_floor(search, job->clusts, job->asg->clust[iPat]);
+        score_clusters(search, job->clusts);
+        seed = job->seed ^ (unsigned int)(iPat * 2654435761UL);
+        if(search->nTies == 0){         // New cluster
+            *choice = NOT_FOUND;
+        }
+        else if(search->nTies == 1){    // Don't have to chose
+            *choice = search->ties[0];
+        }
+        else{                           // Randomly chose.
+            *choice = search->ties[rand_r(&seed) % search->nTies];
+        }
+    }
+}
+
+/** Apply the choices of a batch of training patterns to the clusters.
+ *
+ * The patterns leaving their cluster are first removed from it, without
+ * erasing the clusters left empty so the chosen clusters keep their index.
+ * The patterns are then added to their chosen cluster in pattern order. A
+ * pattern needing a new cluster is first matched against the clusters
+ * created by the previous patterns of the batch, so similar patterns of a
+ * batch don't each create their own cluster. The clusters which are still
+ * empty are finally erased.
+ *
+ * Everything is done in the calling thread in a fixed order, so the clusters
+ * only depend on the choices.
+ *
+ * @param[in,out] job        The batch, its choices set by batch_part().
+ * @param[in,out] reassigned The reassigned pattern flags.
+ */
+static void batch_merge(BatchJob *job, Vector *reassigned){
+    PatSet *pats = job->pats;
+    ClustStore *clusts = job->clusts;
+    Assignment *asg = job->asg;
+    CandSearch *search = &job->scratch[0];
+    const ulong firstNew = clusts->size;
+    ulong iPat, iClust;
+    unsigned int seed;
+    bool trueValue = true;
+
+    for(iPat = job->from; iPat < job->to; iPat++){
+        iClust = asg->clust[iPat];
+        if(iClust != NOT_FOUND && iClust != job->choice[iPat - job->from]){
+            clust_detach_pat(clusts, asg, pats, iPat);
+        }
+    }
+    for(iPat = job->from; iPat < job->to; iPat++){
+        // the pattern stays in its cluster
+        if(asg->clust[iPat] != NOT_FOUND){
+            continue;
+        }
+        iClust = job->choice[iPat - job->from];
+        if(iClust == NOT_FOUND){
+            search_set_pat(search, pats, iPat);
+            score_range(search, clusts, firstNew, clusts->size);
+            seed = job->seed ^ (unsigned int)(iPat * 2654435761UL);
+            if(search->nTies == 1){
+                iClust = search->ties[0];
+            }
+            else if(search->nTies > 1){
+                iClust = search->ties[rand_r(&seed) % search->nTies];
+            }
+        }
+        if(iClust == NOT_FOUND){
+            clust_add_new(clusts, asg, pats, iPat);
+        }
+        else{
+            clust_add_pat(pats, clusts, asg, iPat, iClust);
+        }
+        vec_replace_at(reassigned, iPat, &trueValue);
+    }
+    // from the last one: the cluster taking the place of an erased one is kept
+    for(iClust = firstNew; iClust-- > 0;){
+        if(vec_size(clust_pat_set(clusts, iClust)) == 0){
+            clust_erase(clusts, asg, iClust);
+        }
+    }
+}
+
+/** Assign every training patterns batch after batch (mini-batch engine).
+ *
+ * The patterns of a batch are matched in parallel against the same
+ * prototypes (see batch_part()), then the clusters are updated by
+ * batch_merge(). Unlike assign_pat() a pattern dosen't see the changes made
+ * by the previous patterns of its batch, but the clusters are the same
+ * whatever the number of threads.
+ *
+ * @param[in,out] job        The batch, its seed set for the pass.
+ * @param[in]     pool       The workers assigning the patterns (NULL if
+ *  there's only one thread).
+ * @param[in,out] reassigned The reassigned pattern flags.
+ * @param[in]     batchSize  The number of patterns of a batch.
+ */
+static void assign_batches(BatchJob *job, ThreadPool *pool,
+                           Vector *reassigned, ulong batchSize){
+    const ulong nPats = job->pats->nPats;
+
+    for(job->from = 0; job->from < nPats; job->from = job->to){
+        job->to = nPats - job->from > batchSize ? job->from + batchSize :
+                                                  nPats;
+        if(pool != NULL){
+            pool_run(pool, batch_part, job, job->nParts);
+        }
+        else{
+            batch_part(job, 0);
+        }
+        batch_merge(job, reassigned);
+        // enough clusters to match them through the bit-sliced index
+        if(job->clusts->cols == NULL &&
+           job->clusts->size >= SLICED_MIN_CLUSTS){
+            clusts_index(job->clusts);
+        }
+    }
+}
+
+/** Initialize the batch of the mini-batch engine.
+ *
+ * @param[out] job    The batch.
+ * @param[in]  pats   The training patterns.
+ * @param[in]  clusts The network clusters.
+ * @param[in]  asg    The assignment of the training patterns.
+ * @param[in]  pool   The workers assigning the patterns (NULL if there's
+ *  only one thread).
+ * @param[in]  par    The network parameters.
+ */
+static void batch_init(BatchJob *job, PatSet *pats, ClustStore *clusts,
+                       Assignment *asg, ThreadPool *pool, InParam par){
+    ulong iPart;
+    ulong batchSize = par.batchSize < pats->nPats ? par.batchSize :
+                                                    pats->nPats;
+
+    job->pats = pats;
+    job->clusts = clusts;
+    job->asg = asg;
+    job->nParts = pool != NULL ? pool->nThreads : 1;
+    job->scratch = malloc(job->nParts * sizeof(CandSearch));
+    job->choice = malloc((batchSize > 0 ? batchSize : 1) * sizeof(ulong));
+    if(job->scratch == NULL || job->choice == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the training batch\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        search_init(&job->scratch[iPart], NULL, NULL, par, pats->len, true);
+    }
+}
+
+/** Free the arrays of the batch of the mini-batch engine.
+ *
+ * @param[in,out] job The batch.
+ */
+static void batch_finalize(BatchJob *job){
+    ulong iPart;
+
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        search_finalize(&job->scratch[iPart]);
+    }
+    free(job->scratch);
+    free(job->choice);
+}
+
+/** Initialize the speculative assignment of the training patterns.
  *
- * @note A prototype have a 1 only where every member patterns have a 1.
+ * @param[out] job    The speculation.
+ * @param[in]  pats   The training patterns.
+ * @param[in]  clusts The network clusters.
+ * @param[in]  asg    The assignment of the training patterns.
+ * @param[in]  cache  The last best matching clusters of the patterns.
+ * @param[in]  pool   The workers speculating the patterns.
+ * @param[in]  par    The network parameters.
+ */
+static void spec_init(SpecJob *job, PatSet *pats, ClustStore *clusts,
+                      Assignment *asg, MatchCache *cache, ThreadPool *pool,
+                      InParam par){
+    ulong iPart;
+
+    memset(job, 0, sizeof(*job));
+    job->pats = pats;
+    job->clusts = clusts;
+    job->asg = asg;
+    job->cache = cache;
+    job->nParts = pool->nThreads;
+    job->scratch = malloc(job->nParts * sizeof(CandSearch));
+    job->res = malloc(job->nParts * SPEC_PATS_PER_THREAD * sizeof(PatMatch));
+    if(job->scratch == NULL || job->res == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the speculative assignment\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        search_init(&job->scratch[iPart], NULL, NULL, par, pats->len, true);
+    }
+}
+
+/** Free the arrays of the speculative assignment of the training patterns.
  *
- * @param[in, out]  prot The prototype that will be modified to ressembles the
- *  pattern.
- * @param[in]       pat  The pattern to add to the prototype.
+ * @param[in,out] job The speculation.
  */
-static void prot_add_pat(Vector *prot, Vector *pat){
-    ulong i;
-    char c = 0;
+static void spec_finalize(SpecJob *job){
+    ulong iPart;
 
-	for(i = 0; i < vec_size(pat); i++){
-		if(vec_get_as_char(pat, i) == 0 && vec_get_as_char(prot, i) == 1){
-            vec_replace_at(prot, i, &c);
-        }
-	}
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        search_finalize(&job->scratch[iPart]);
+    }
+    free(job->scratch);
+    free(job->res);
 }
 
-/** Remove the given pattern from the given cluster.
+/** Speculatively match the patterns of the window against the clusters.
  *
- * Remove the pattern at index 'iPat' of 'pats' from cluster prototype at 
- * index 'iClust' of 'clusts'. Also remove the pattern ID from the prototype
- * patterns set.
+ * Every thread takes the next pattern of the window until there's none left
+ * and writes the best matching clusters of the pattern in job->res, as
+ * assign_pat() would find them if the clusters stayed as they are.
  *
- * @param[in]     pats   The network training patterns set.
- * @param[in]     iPat   The index of the pattern to remove.
- * @param[in,out] clusts The network clusters.
- * @param[in]     iClust The index of the cluster from which the pattern will be
- *  removed.
+ * @param[in,out] arg   The speculation (a SpecJob).
+ * @param[in]     iPart The index of the thread search.
  */
-static void clust_rm_pat(Vector *clusts, ulong iClust, Vector *pats,
-                         ulong iPat){
-    ulong i;
-    Cluster *clust = &vec_get_as_clust(clusts, iClust);
-    Vector *patSet = clust->patSet; // Vector of ulongs
-    Vector *prot = clust->prot;     // Vector of chars
+static void spec_part(void *arg, ulong iPart){
+    SpecJob *job = arg;
+    CandSearch *search = &job->scratch[iPart];
+    ulong iPat;
+    PatMatch *res;
 
-	for(i = 0; i < vec_size(patSet); i++){
-        if(vec_get_as_ulong(patSet, i) == iPat){
-            vec_erase(patSet, vec_get(patSet, i));
-            break;
+    while((iPat = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+          job->to){
+        res = &job->res[iPat - job->from];
+        search_set_pat(search, job->pats, iPat);
+        if(cache_valid(job->cache, search, job->clusts, iPat)){
+            *res = job->cache->matches[iPat];
+            continue;
         }
+        search_set_floor(search, job->clusts, job->asg->clust[iPat]);
+        score_clusters(search, job->clusts);
+        match_set(res, search, job->clusts);
     }
-	if(vec_size(patSet) == 0){
-        iVector.EraseAt(clusts, iClust); 
-	}
-	else{
-        prot = vec_get_as_vec(pats, vec_get_as_size_t(patSet, 0));
-		for(i = 1; i < vec_size(patSet); i++){
-            prot_add_pat(prot, vec_get(pats, vec_get_as_size_t(patSet, i)));
-        }
-	}
 }
 
-/** Returns the number of 1 that the two given patterns have in common.
- *
- * Count and return the number of 1 which are present in 'pat1' and 'pat2', at
- * same indexes.
+/** Assign a pattern of the window from its speculative assignment.
  *
- * @note 'pat1' and 'pat2' must have the same length. It is admit and it's
- *  obvious because the program check it at the begining so no test are carried
- *  out here in order to save time.
- *
- * @param[in] pat1 The first pattern, will be compared to 'pat2'.
- * @param[in] pat2 The second pattern, will be compared to 'pat1'.
+ * The pattern is matched again if its speculative best matching clusters
+ * changed because of the previous patterns of the window (see
+ * cache_changed()). Then it is assigned exactly like assign_pat() does,
+ * drawing the ties from the same random generator, and the cluster indexes
+ * it modified are logged.
  *
- * @return The number of 1 that the two given patterns have in common.
+ * @param[in,out] job        The speculation.
+ * @param[in,out] search     The constrained candidates search of the
+ *  training.
+ * @param[in,out] reassigned The reassigned pattern flags.
+ * @param[in]     iPat       The index of the pattern.
  */
-static long comOnes(Vector *pat1, Vector *pat2){
-    unsigned int i;
-    ulong count = 0;
+static void spec_commit(SpecJob *job, CandSearch *search, Vector *reassigned,
+                        ulong iPat){
+    PatMatch *res = &job->res[iPat - job->from];
+    PatSet *pats = job->pats;
+    ClustStore *clusts = job->clusts;
+    Assignment *asg = job->asg;
+    MatchCache *cache = job->cache;
+    const ulong iClust = asg->clust[iPat];
+    const ulong size = clusts->size;
 
-	for(i = 0; i < vec_size(pat1); i++){
-        if(vec_get_as_char(pat1, i) == 1 && vec_get_as_char(pat2, i) == 1){
-            count++;
-        }
+    search_set_pat(search, pats, iPat);
+    if(cache_changed(cache, search, clusts, res, job->stamp)){
+        search_set_floor(search, clusts, iClust);
+        score_clusters(search, clusts);
+        match_set(res, search, clusts);
+    }
+    else{
+        search_set_ties(search, res);
     }
-	return count;
+    cache->matches[iPat] = *res;
+    cache->stamps[iPat] = cache->logEnd;
+    assign_ties(pats, clusts, search, asg, reassigned, iPat);
+    cache_log_assign(cache, iClust, size, asg->clust[iPat]);
 }
 
-/** Returns number of 1 in a given pattern (or a prototype).
+/** Assign every training patterns window after window (speculative
+ * assignment).
  *
- * @param[in] pat The pattern.
+ * The patterns of a window are matched in parallel against the clusters of
+ * the start of the window (see spec_part()), then committed in order by
+ * spec_commit(). Only the patterns whose best matching clusters changed
+ * because of the previous patterns of the window are matched again, so the
+ * clusters are exactly the ones of the sequential assignment.
  *
- * @return The number of 1 in the given pattern.
+ * @param[in,out] job        The speculation.
+ * @param[in,out] search     The constrained candidates search of the
+ *  training.
+ * @param[in]     pool       The workers speculating the patterns.
+ * @param[in,out] reassigned The reassigned pattern flags.
  */
-static long ones(Vector *pat){
-    unsigned int i;
-    ulong count = 0;
+static void assign_speculative(SpecJob *job, CandSearch *search,
+                               ThreadPool *pool, Vector *reassigned){
+    const ulong nPats = job->pats->nPats;
+    const ulong span = job->nParts * SPEC_PATS_PER_THREAD;
+    ulong iPat;
 
-    for(i = 0; i < vec_size(pat); i++){
-        if(vec_get_as_char(pat, i) == 1){
-            count++;
+    for(job->from = 0; job->from < nPats; job->from = job->to){
+        job->to = nPats - job->from > span ? job->from + span : nPats;
+        job->next = job->from;
+        job->stamp = job->cache->logEnd;
+        pool_run(pool, spec_part, job, job->nParts);
+        for(iPat = job->from; iPat < job->to; iPat++){
+            spec_commit(job, search, reassigned, iPat);
+            // enough clusters to match them through the bit-sliced index
+            if(job->clusts->cols == NULL &&
+               job->clusts->size >= SLICED_MIN_CLUSTS){
+                clusts_index(job->clusts);
+            }
         }
     }
-	return count;
 }
 
-/** Add a new cluster to the network clusters vector.
+/** Set every elements of the vector to false.
  *
- * Ceate a new cluster and initialize it by setting pattern at index 'iPat' in
- * 'pats' as its prototype and adding pattern ID 'iPat' in its patterns set.
- * Finaly, add the new cluster to 'clusts'.
+ * The reassigned vector contains one flag for each pattern of the training
+ * patterns set which indicate if the pattern has been reassigned or not.
+ * At the begining of every passes these flags must be set back to false.
  *
- * @param[in, out] clusts The network clusters vector where the new cluster will
- *  be added.
- * @param[in]      pats   The network training patterns.
- * @param[in]      iPat   The index of the current training pattern.
+ * @param[in,out] reassigned The vector containing the flags to reset.
  */
-static void clust_add_new(Vector *clusts, Vector *pats, ulong iPat){
-    ulong iClust = pat_in_clust_set(clusts, iPat);
-    Cluster newClust;
-    Vector *newProtSet;    // Vector of ulongs
+static void reset_reassigned(Vector *reassigned){
+    ulong i;
+    bool falseValue = false;
 
-	if(iClust != NOT_FOUND){
-        clust_rm_pat(clusts, iClust, pats, iPat);
+    for(i = 0; i < vec_size(reassigned); i++){
+        vec_replace_at(reassigned, i, &falseValue);
     }
-    newProtSet = iVector.Create(sizeof(ulong), 1);
-    vec_pushback(newProtSet, &iPat);
-    newClust.prot = vec_copy(vec_get_as_vec(pats, iPat));
-    newClust.patSet = newProtSet;
-    newClust.inhib = false;
-    vec_pushback(clusts, &newClust);
 }
 
-/** Add a pattern to a cluster.
+/** Save the assignment of every pattern as the best pass snapshot.
  *
- * To add a pattern to a candidate cluster we must:
- *  - Add the pattern ID to the cluster patterns set
- *  - Reshape the cluster prototype.
+ * The prototypes aren't saved: a prototype is the AND of its member patterns,
+ * so the clusters can be rebuilt from the assignment alone by
+ * clusts_restore(). A snapshot costs two arrays of nPats integers whatever
+ * the size of the network.
  *
- * If the pattern already belongs to another cluster then it is removed from
- * this cluster and added to the candidate cluster (reassignement) and true is 
- * returned. If the pattern already belongs to the candidate cluster then false
- * is returned and the algorithm should go with the next pattern to train. 
- * Else, if the pattern dosen't already belongs to any cluster then it is simply
- * added to the candidate cluster and true is returned.
+ * @param[out] snap  The snapshot, its arrays hold nPats elements.
+ * @param[in]  asg   The current assignment of the patterns.
+ * @param[in]  nPats The number of patterns.
+ */
+static void asg_save(Assignment *snap, const Assignment *asg, ulong nPats){
+    memcpy(snap->clust, asg->clust, nPats * sizeof(ulong));
+    memcpy(snap->pos, asg->pos, nPats * sizeof(ulong));
+}
+
+/** Rebuild the clusters saved in an assignment snapshot.
  *
- * @param[in] pat        The pattern to add to the cluster.
- * @param[in] pats       The network training patterns set.
- * @param[in,out] clusts The network clusters.
- * @param[in] iPat       The index of 'pat' in 'pats'.
- * @param[in] iCandidate The index of the cluter in which the pattern will be 
- *  added.
+ * Every pattern is put back at its saved position in its cluster patterns
+ * set, so the restored clusters are the same as the saved ones, then the
+ * prototypes are rebuilt from the members counters.
  *
- * @return true if the pattern has been added to the cluster ; false if the 
- *  pattern already belongs to the cluster. 
+ * @param[in] snap    The snapshot saved by asg_save().
+ * @param[in] nClusts The number of clusters when the snapshot was saved.
+ * @param[in] pats    The training patterns.
+ *
+ * @return The restored clusters.
  */
-static bool clust_add_pat(Vector *pat, Vector *pats, Vector *clusts, ulong iPat,
-                          ulong iCandidat){
-    ulong iClust = pat_in_clust_set(clusts, iPat);
+static ClustStore *clusts_restore(const Assignment *snap, ulong nClusts,
+                                  PatSet *pats){
+    ulong i;
+    ulong iPat;
+    ClustStore *clusts = clusts_create(pats->len);
 
-    if(iClust != NOT_FOUND){
-        if(iClust == iCandidat){
-            return false;
-        }
-        else{
-            clust_rm_pat(clusts, iClust, pats, iPat);
-        }
+    for(i = 0; i < nClusts; i++){
+        clusts_push(clusts);
     }
-    prot_add_pat(get_prot(vec_get_as_clust(clusts, iCandidat)), pat);
-    vec_pushback(get_pat_set(vec_get_as_clust(clusts, iCandidat)), &iPat);
-    return true;
+    // first size every patterns set and count the members bits
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        pat_set_push(clust_pat_set(clusts, snap->clust[iPat]), iPat);
+        clust_count_pat(clusts, snap->clust[iPat], pats, iPat, 1);
+    }
+    // then put every pattern at its saved position
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        vec_replace_at(clust_pat_set(clusts, snap->clust[iPat]),
+                       snap->pos[iPat], &iPat);
+    }
+    for(i = 0; i < nClusts; i++){
+        prot_from_counts(clusts, i, vec_size(clust_pat_set(clusts, i)));
+    }
+    return clusts;
 }
 
-/** Fill the score array with the computed scores of the network prototypes.
+/** Initialize the lock-free assignment of the training patterns.
  *
- * Fill the 'score' array with a score value for each cluster prototype in
- * 'clusts'. The score value represents the similarity level between the actual
- * pattern and a cluster prototype. If a prototype is inhibited then its score
- * is NONE.
+ * @param[out] job  The assignment.
+ * @param[in]  pats The training patterns.
+ * @param[in]  pool The workers assigning the patterns (NULL if there's only
+ *  one thread).
+ * @param[in]  par  The network parameters.
+ */
+static void hog_init(HogJob *job, PatSet *pats, ThreadPool *pool,
+                     InParam par){
+    ulong iPart;
+
+    memset(job, 0, sizeof(*job));
+    job->pats = pats;
+    job->nParts = pool != NULL ? pool->nThreads : 1;
+    job->scratch = malloc(job->nParts * sizeof(CandSearch));
+    job->stale = malloc(job->nParts * sizeof(ulong));
+    job->clust = malloc((pats->nPats > 0 ? pats->nPats : 1) * sizeof(ulong));
+    if(job->scratch == NULL || job->stale == NULL || job->clust == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the lock-free assignment\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        search_init(&job->scratch[iPart], NULL, NULL, par, pats->len, true);
+    }
+}
+
+/** Free the arrays of the lock-free assignment of the training patterns.
  *
- * @note The calculation is based on the 'beta' parameter, the pattern 'pat'
- *  and the cluster prototypes.
+ * @param[in,out] job The assignment.
+ */
+static void hog_job_finalize(HogJob *job){
+    ulong iPart;
+
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        search_finalize(&job->scratch[iPart]);
+    }
+    free(job->scratch);
+    free(job->stale);
+    free(job->clust);
+}
+
+/** Returns the number of 1 a prototype of a concurrent clusters table and
+ * the search pattern have in common.
  *
- * @note The 'clusts' vector size, is passed as parameter 'psize' in 
- * order to avoid a second vec_size() call.
+ * @param[in] search The candidates search.
+ * @param[in] hog    The clusters table.
+ * @param[in] iClust The index of the cluster.
  *
- * @param [out] scores The scores array to fill.
- * @param [in]  psize  Number of clusters of the network.
- * @param [in]  pat    The current training pattern.
- * @param [in]  clusts The network cllusters.
- * @param [in]  beta   The network beta parameter.
+ * @return The number of common 1.
  */
-static void fill_scores(double *scores, const ulong psize, Vector *pat,
-                        Vector *clusts, float beta){
-    ulong iClust;
-    Vector *prot;   // Vector of chars
-
-    for(iClust = 0; iClust < psize; iClust++){
-	    if(get_inhib(vec_get_as_clust(clusts, iClust))){
-            scores[iClust] = NONE;
-        }
-	    else{
-            prot = get_prot(vec_get_as_clust(clusts, iClust));
-            scores[iClust] = (double)(comOnes(prot, pat)) / (beta + ones(prot));
-        }
+static ulong hog_com(const CandSearch *search, HogStore *hog, ulong iClust){
+    if(search->pat == NULL){
+        return bits_probe_ones(hog_prot(hog, iClust), search->patBits,
+                               search->patOnes);
     }
+    return comOnes(hog_prot(hog, iClust), search->pat, hog->nWords);
 }
 
-/** Compute the highest score in the 'scores' array.
+/** Find the best matching cluster of the search pattern among the clusters
+ * 'from' to 'to' - 1 of a concurrent clusters table.
  *
- * The 'eqScores' array is modified to contain the highest score prototype(s)
- * ID(s) (there can be multiple prototypes with the same highest score that's
- * why 'eqScores' is a vector).
+ * The clusters are tested as assign_pat() does. The prototypes can lose 1
+ * while they are read, and the clusters which aren't ready yet are skipped.
+ * The ties are broken on the fly: the i-th cluster having the best score
+ * replaces the chosen one with a probability of 1 / i.
  *
- * @param [out] eqScores The scores array to fill with every highest scores.
- * @param [in]  scores   The array containing the prototypes's scores.
- * @param [in]  psize    Number of clusters of the network.
- * @param [in]  clusts   The network cllusters.
+ * @param[in]     search The constrained candidates search.
+ * @param[in]     hog    The clusters table.
+ * @param[in]     from   The index of the first cluster.
+ * @param[in]     to     The index after the last cluster.
+ * @param[in,out] seed   The state of the random generator breaking ties.
+ * @param[out]    ones   The number of 1 of the chosen prototype when it was
+ *  matched.
+ *
+ * @return The index of the chosen cluster, NOT_FOUND if no cluster passes
+ *  both tests.
  */
-static void highest_score(Vector **eqScores, double *scores, ulong psize,
-                          Vector *clusts){
-    ulong i;
-    double highest = NONE;
+static ulong hog_match(const CandSearch *search, HogStore *hog, ulong from,
+                       ulong to, unsigned int *seed, ulong *ones){
+    ulong iClust, clustOnes, com;
+    ulong nTies = 0;
+    ulong res = NOT_FOUND;
+    Score best;
+    Score *pBest = NULL;
 
-    for(i = 0; i < psize; i++){
-        if(scores[i] == highest){
-            vec_pushback(*eqScores, &i);
+    for(iClust = from; iClust < to; iClust++){
+        if(!hog_is_ready(hog, iClust)){
+            continue;
+        }
+        clustOnes = __atomic_load_n(hog_ones(hog, iClust), __ATOMIC_RELAXED);
+        com = clustOnes < search->patOnes ? clustOnes : search->patOnes;
+        if(!can_match(search, com, clustOnes, pBest)){
+            continue;
+        }
+        com = hog_com(search, hog, iClust);
+        if(!can_match(search, com, clustOnes, pBest)){
+            continue;
         }
-        else if(scores[i] > highest){
-            vec_clear(*eqScores);
-            vec_pushback(*eqScores, &i);
-            highest = scores[i];
+        if(pBest == NULL ||
+           score_cmp(search->beta, com, clustOnes, best.com, best.ones) > 0){
+            best.com = com;
+            best.ones = clustOnes;
+            pBest = &best;
+            nTies = 0;
+        }
+        if(rand_r(seed) % ++nTies == 0){
+            res = iClust;
+            *ones = clustOnes;
         }
     }
+    return res;
 }
 
-/** Returns the number of inhibited clusters.
+/** Add a pattern to a prototype of a concurrent clusters table.
  *
- * @param[in] clusts The network clusters.
+ * The words of the prototype which have 1 where the pattern has 0 are
+ * updated with an atomic AND, so the 1 cleared by other threads at the same
+ * time are never set back.
  *
- * @return The number of inhibited clusters.
+ * @param[in,out] hog    The clusters table.
+ * @param[in]     iClust The index of the cluster.
+ * @param[in]     pats   The patterns set.
+ * @param[in]     iPat   The index of the pattern.
+ *
+ * @return The number of 1 of the prototype before the pattern was added.
  */
-static ulong count_inhib_clusts(Vector *clusts){
-    ulong i;
-    ulong count = 0;
+static ulong hog_add_pat(HogStore *hog, ulong iClust, PatSet *pats,
+                         ulong iPat){
+    BitWord *prot = hog_prot(hog, iClust);
+    const BitWord *pat = pats->idx == NULL ? pat_get(pats, iPat) : NULL;
+    const uint32_t *idx = pats->idx != NULL ? pat_idx(pats, iPat) : NULL;
+    ulong w;
+    ulong i = 0;
+    ulong before = 0;
+    ulong cleared = 0;
+    BitWord mask, word;
 
-    for(i = 0; i < vec_size(clusts); i++){
-        if(get_inhib(vec_get_as_clust(clusts, i))){
-            count++;
+    for(w = 0; w < hog->nWords; w++){
+        if(pat != NULL){
+            mask = pat[w];
+        }
+        else{
+            for(mask = 0; i < pats->nOnes[iPat] && idx[i] / WORD_BITS == w;
+                i++){
+                mask |= bit_mask(idx[i]);
+            }
         }
+        word = __atomic_load_n(&prot[w], __ATOMIC_RELAXED);
+        if((word & ~mask) != 0){
+            word = __atomic_fetch_and(&prot[w], mask, __ATOMIC_RELAXED);
+            cleared += __builtin_popcountll(word & ~mask);
+        }
+        before += __builtin_popcountll(word);
+    }
+    if(cleared > 0){
+        __atomic_fetch_sub(hog_ones(hog, iClust), cleared, __ATOMIC_RELAXED);
     }
-    return count;
+    return before;
 }
 
-/**Compute and returns the uninhibited prototype closest to a given pattern.
- *
- * To achieve this, the function first compute the "similarity score" of every
- * uninhibited prototypes (inhibited prototypes have a score of -1) then it
- * computes the prototype with the highest score (if more than one prototype
- * with equal highest score then the returned one is randomly chosen).
- * If all clusters are inhibited then the function return false.
- *
- * @note It would be more C-style to return a bool indicating if a candidate
- *  has been found or not and set it via a passed argument. But this way it is
- *  easier for freeing.
+/** Add a cluster whose prototype is a given pattern to a concurrent
+ * clusters table.
  *
- * @param[out] candidat  The uninhibited prototype closest to a given pattern 
- *  (the candidate).
- * @param[out] iCandidat The index of the computed candidate.
- * @param[in]  pat       The reference pattern.
- * @param[in]  clusts    The network clusters.
- * @param[in]  beta      The network beta parameter.
+ * @param[in,out] hog  The clusters table.
+ * @param[in]     pats The patterns set.
+ * @param[in]     iPat The index of the pattern.
  *
- * @return true or false weither a candidate has been found.
+ * @return The index of the new cluster.
  */
-static Cluster *nearest_prot(ulong *iCandidat, Vector *pat, Vector *clusts,
-                             float beta){
-	Vector *eqScores;  // Vector of ulongs
-    Cluster *empty = malloc(sizeof(*empty));
-	const ulong psize = vec_size(clusts);
-    double scores[psize];
-
-    eqScores = iVector.Create(sizeof(ulong), 1);
-    empty->prot = iVector.Create(sizeof(Vector), 0);
-	if(count_inhib_clusts(clusts) == vec_size(clusts)){
-        iVector.Finalize(eqScores);
-        return empty;
-    }
-    fill_scores((double *)scores, psize, pat, clusts, beta);
-    highest_score(&eqScores, (double *)scores, psize, clusts);
-    if(vec_size(eqScores) == 0){    // Should never happen
-        iVector.Finalize(eqScores);
-        return empty;
-    }
-    iVector.Finalize(empty->prot);
-    free(empty);
-    if(vec_size(eqScores) == 1){    // Don't have to chose
-        *iCandidat = vec_get_as_ulong(eqScores, 0);
+static ulong hog_add_new(HogStore *hog, PatSet *pats, ulong iPat){
+    const ulong iClust = hog_reserve(hog);
+
+    if(pats->idx != NULL){
+        bits_from_idx(hog_prot(hog, iClust), pat_idx(pats, iPat),
+                      pats->nOnes[iPat], hog->nWords);
     }
-    else{                           // Randomly chose.
-        *iCandidat = vec_get_as_ulong(eqScores, (rand() % vec_size(eqScores)));
+    else{
+        bits_copy(hog_prot(hog, iClust), pat_get(pats, iPat), hog->nWords);
     }
-    iVector.Finalize(eqScores);
-    return &vec_get_as_clust(clusts, *iCandidat);
+    hog_publish(hog, iClust, pats->nOnes[iPat]);
+    return iClust;
 }
 
-/** Compute the statistics of the last training pass.
+/** Assign the training patterns taken by a thread, without lock.
  *
- * Sets the 'noReassigned' parameter (number of patterns reassigned to another
- * cluster during the pass) and the 'fluc' parameter (fluctuation percentage for
- * the pass).
+ * Every thread takes the next pattern until there's none left, matches it
+ * against the clusters as they are at that time, then adds it to the chosen
+ * cluster or to a new one. A pattern is counted as stale if the chosen
+ * prototype lost 1 in the meantime, or if it needed a new cluster while
+ * another thread added a cluster it would have chosen.
  *
- * @param[out] noReassigned Number of patterns which have been assigned to 
- *  another cluster during the pass.
- * @param[out] fluc         Fluctuation percentage of the pass.
- * @param[in] reassigned    Array of values indicating the ID of the patterns
- *  which have been reassigned to another cluster (ID is the index in the 
- *  array).
- * @param[in] pats          The network training patterns set.
+ * The ties are broken with a random generator seeded from job->seed and the
+ * pattern index.
+ *
+ * @param[in,out] arg   The assignment (a HogJob).
+ * @param[in]     iPart The index of the thread search.
  */
-static void compute_pass_stats(ulong *noReassigned, float *fluc,
-                               Vector *reassigned, Vector *pats){
-    ulong c;
+static void hog_part(void *arg, ulong iPart){
+    HogJob *job = arg;
+    CandSearch *search = &job->scratch[iPart];
+    HogStore *hog = job->hog;
+    ulong iPat, iClust, size, ones;
+    unsigned int seed;
 
-    *noReassigned = 0;
-    for(c = 0; c < vec_size(reassigned); c++){
-        if(vec_get_as_char(reassigned, c) != false){
-            *noReassigned = *noReassigned + 1;
+    job->stale[iPart] = 0;
+    while((iPat = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+          job->pats->nPats){
+        search_set_pat(search, job->pats, iPat);
+        seed = job->seed ^ (unsigned int)(iPat * 2654435761UL);
+        size = __atomic_load_n(&hog->size, __ATOMIC_ACQUIRE);
+        iClust = hog_match(search, hog, 0, size, &seed, &ones);
+        if(iClust != NOT_FOUND){
+            if(hog_add_pat(hog, iClust, job->pats, iPat) != ones){
+                job->stale[iPart]++;
+            }
+        }
+        else{
+            iClust = hog_add_new(hog, job->pats, iPat);
+            if(hog_match(search, hog, size, iClust, &seed, &ones) !=
+               NOT_FOUND){
+                job->stale[iPart]++;
+            }
         }
+        job->clust[iPat] = iClust;
     }
-    *fluc = ((float)*noReassigned / vec_size(pats)) * 100;
 }
 
-/** Select a cluster candidate and try to add the pattern to this candidate.
+/** Rebuild the clusters from the lock-free assignment of a pass.
  *
- * Select the nearest prototype of the pattern at index 'iPat' in 'pats' (the 
- * candidate) and check if the pattern can fits in the candidate's cluster 
- * depending on beta and vigilance parameters. If the pattern fits in the 
- * cluster, then it is added to it, else, a new cluster is  create and the 
- * pattern became its prototype.
+ * The prototypes of the clusters table still hold the 1 cleared by the
+ * patterns which left them, so the clusters are rebuilt from the assignment
+ * (see clusts_restore()). The clusters left without pattern are dropped, the
+ * others keep their order.
  *
- * @param[in]     param      The network parameters. 
- * @param[in]     pats       The training patterns set.
- * @param[in,out] clusts     The network clusters.
+ * @param[in]     job        The assignment, done.
+ * @param[in,out] asg        The assignment of the training patterns, set to
+ *  the rebuilt clusters.
  * @param[in,out] reassigned The reassigned pattern flags.
- * @param[in]     iPat       The index of the current training pattern to 
- *  assigned to a cluster.
  *
- * @return true or false weither The pattern has been added to a cluster or not.
+ * @return The rebuilt clusters.
  */
-static bool try_next_candidate(InParam param, Vector *pats, Vector *clusts,
-                               Vector *reassigned, ulong iPat){
+static ClustStore *hog_merge(const HogJob *job, Assignment *asg,
+                             Vector *reassigned){
+    const ulong nPats = job->pats->nPats;
+    const ulong size = job->hog->size;
+    ulong iPat, iClust;
+    ulong nClusts = 0;
     bool trueValue = true;
-    Vector *candProt;                   // Vector of chars
-    // Current pattern in 'pats'
-    Vector *pat = vec_get(pats, iPat);  // Vector of chars
-    // Index of the cluster with highest prototype score in 'clusts'
-    ulong iCandidat = NOT_FOUND;
-    // Cluster prototype with highest score
-    Cluster *candidat = nearest_prot(&iCandidat, pat, clusts, param.beta);
-    // Used to compute pattern / prototype similarity level (using param.beta)
-    double ppSimA, ppSimB, similarity;
-
-    // No cluster or they're all inhibited: create a new cluster
-    if(vec_size(candidat->prot) == 0){
-        clust_add_new(clusts, pats, iPat);
-        vec_replace_at(reassigned, iPat, &trueValue);
-        iVector.Finalize(candidat->prot);
-        free(candidat);
-        return true;
+    // Number of patterns, then new index, of each cluster of the table
+    ulong *newIds = calloc(size > 0 ? size : 1, sizeof(ulong));
+    // Number of patterns already put in each rebuilt cluster
+    ulong *nMembers = calloc(size > 0 ? size : 1, sizeof(ulong));
+
+    if(newIds == NULL || nMembers == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the clusters indexes\n"\
+                "Exiting...\n");
+        exit(12);
     }
-    // Inhibit the current candidate
-    candidat->inhib = true;
-    // Use beta to determine if candidate prototype and pat are similar enough
-    candProt = vec_copy(candidat->prot);
-    ppSimA = (double)comOnes(candProt, pat) / (param.beta + ones(candProt));
-    ppSimB = (double)ones(pat) / (param.beta + vec_size(pat));
-    // If they are: determine if pat fits in the candidate cluster
-    if(ppSimA >= ppSimB){
-        similarity = (double)comOnes(candProt, pat) / ones(pat);
-        iVector.Finalize(candProt);
-        // If vigilance is reached: add pattern to candidate cluster
-        if(similarity >= param.vigilance){
-            if(clust_add_pat(pat, pats, clusts, iPat, iCandidat)){
-                vec_replace_at(reassigned, iPat, &trueValue);
-            }
-            return true;
-        }
-        // Else: choose a new candidate prototype
-        else{
-            return false;
-        }
+    for(iPat = 0; iPat < nPats; iPat++){
+        newIds[job->clust[iPat]]++;
     }
-    // Else: create a new cluster
-    else{
-        clust_add_new(clusts, pats, iPat);
-        vec_replace_at(reassigned, iPat, &trueValue);
-        iVector.Finalize(candProt);
-        return true;
+    for(iClust = 0; iClust < size; iClust++){
+        newIds[iClust] = newIds[iClust] > 0 ? nClusts++ : NOT_FOUND;
+    }
+    for(iPat = 0; iPat < nPats; iPat++){
+        // the clusters copied in the table kept their index
+        if(job->clust[iPat] != asg->clust[iPat]){
+            vec_replace_at(reassigned, iPat, &trueValue);
+        }
+        asg->clust[iPat] = newIds[job->clust[iPat]];
+        asg->pos[iPat] = nMembers[asg->clust[iPat]]++;
     }
+    free(newIds);
+    free(nMembers);
+    return clusts_restore(asg, nClusts, job->pats);
 }
 
-/** Set every elements of the vector to false.
+/** Assign every training patterns on every threads at once, without lock
+ * (lock-free engine).
  *
- * The reassigned vector contains one flag for each pattern of the training
- * patterns set which indicate if the pattern has been reassigned or not.
- * At the begining of every passes these flags must be set back to false.
+ * The clusters are copied in a concurrent clusters table (see HogStore) in
+ * which the threads assign the patterns (see hog_part()), then they are
+ * rebuilt from the assignment (see hog_merge()). Unlike assign_pat() a
+ * pattern leaving a cluster dosen't give back the 1 it cleared until the end
+ * of the pass, and the clusters depend on the timing of the threads.
  *
- * @param[in,out] reassigned The vector containing the flags to reset.
+ * @param[in,out] job        The assignment, its seed set for the pass.
+ * @param[in,out] clusts     The network clusters, replaced by the rebuilt
+ *  ones.
+ * @param[in,out] asg        The assignment of the training patterns.
+ * @param[in]     pool       The workers assigning the patterns (NULL if
+ *  there's only one thread).
+ * @param[in,out] reassigned The reassigned pattern flags.
+ *
+ * @return The number of stale patterns of the pass.
  */
-static void reset_reassigned(Vector *reassigned){
-    ulong i;
-    bool falseValue = false;
+static ulong assign_hogwild(HogJob *job, ClustStore **clusts,
+                            Assignment *asg, ThreadPool *pool,
+                            Vector *reassigned){
+    ulong iPart;
+    ulong stale = 0;
 
-    for(i = 0; i < vec_size(reassigned); i++){
-        vec_replace_at(reassigned, i, &falseValue);
+    job->hog = hog_create(*clusts, (*clusts)->size + job->pats->nPats);
+    job->next = 0;
+    if(pool != NULL){
+        pool_run(pool, hog_part, job, job->nParts);
+    }
+    else{
+        hog_part(job, 0);
+    }
+    for(iPart = 0; iPart < job->nParts; iPart++){
+        stale += job->stale[iPart];
     }
+    clusts_finalize(*clusts);
+    *clusts = hog_merge(job, asg, reassigned);
+    hog_finalize(job->hog);
+    return stale;
 }
 
-/** Set the inhib flag of every elements of the vector to false.
+/** Replace the unique patterns of every clusters by all their copies.
  *
- * The clusts vector containg the clusters of the network. Each cluster has an
- * "inhib" flag which indicate if it has been inhibited or not.
- * Before trying to add a pattern in a cluster, every clusters inhib flag must
- * be set back to false.
+ * The copies of a unique pattern take its place in the patterns set, by
+ * increasing ID, and count in the members counters.
  *
- * @param[in,out] clusts The vector containing the clusters.
+ * @param[in,out] clusts The clusters trained on the unique patterns.
+ * @param[in]     uniq   The unique patterns.
  */
-static void reset_clusts_inhib_flags(Vector *clusts){
-    ulong i;
+static void clusts_expand(ClustStore *clusts, const UniqPats *uniq){
+    ulong iClust, i, j, u, nUniq;
+    ulong *members = NULL;
+    Vector *patSet;     // Vector of ulongs
 
-    for(i = 0; i < vec_size(clusts); i++){
-        get_inhib(vec_get_as_clust(clusts, i)) = false;
+    for(iClust = 0; iClust < clusts->size; iClust++){
+        patSet = clust_pat_set(clusts, iClust);
+        nUniq = vec_size(patSet);
+        members = realloc(members, nUniq * sizeof(ulong));
+        if(members == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the clusters members\n"\
+                    "Exiting...\n");
+            exit(12);
+        }
+        for(i = 0; i < nUniq; i++){
+            members[i] = vec_get_as_ulong(patSet, i);
+        }
+        vec_clear(patSet);
+        for(i = 0; i < nUniq; i++){
+            u = members[i];
+            for(j = uniq->copyStart[u]; j < uniq->copyStart[u + 1]; j++){
+                pat_set_push(patSet, uniq->copies[j]);
+            }
+            if(uniq->copyStart[u + 1] - uniq->copyStart[u] > 1){
+                clust_count_pat(clusts, iClust, uniq->pats, u,
+                                uniq->copyStart[u + 1] - uniq->copyStart[u] -
+                                1);
+            }
+        }
     }
+    free(members);
 }
 
 /** Train the network using the training patterns set and the parameters.
@@ -490,27 +2665,59 @@ static void reset_clusts_inhib_flags(Vector *clusts){
  *    fluctuation percentage (par->minFluc).
  *
  * Inside this while loop there's a for loop which loops for each training 
- * patterns.
- * And inside this for loop there's a second while loop which loops until the 
- * pattern is successfuly added to an existing or a new cluster.
+ * patterns, and adds each pattern to its best matching cluster or to a new
+ * cluster (see assign_pat()).
  *
  * The function looks like::
  *
  * LOOP WHILE ( pass < maxPasses ) AND ( fluc > minFluc ):
  *     LOOP FOR pat IN pats:
- *         DO:
- *             candidat = pick_a_candidat(clusters, pat)
- *         WHILE NOT fits_in_candidat(candidat, pat)
+ *         candidat = best_fitting_cluster(clusters, pat)
+ *         IF candidat: add pat to candidat
+ *         ELSE: add pat to a new cluster
+ *
+ * The assignment of the best pass is saved with asg_save() and its clusters
+ * are rebuilt at the end if a later pass was worse.
+ *
+ * With several threads the patterns are assigned speculatively (see
+ * assign_speculative()): the clusters are the same as with a single thread.
+ * Both remember the best matching clusters of every pattern and the cluster
+ * modifications since, so the patterns whose clusters are untouched aren't
+ * matched again by the next pass (see cache_valid()).
+ *
+ * If par.hogwild is set the patterns are assigned by the lock-free engine
+ * (see assign_hogwild()): every thread updates the clusters at once, so the
+ * clusters depend on the timing of the threads. The number of patterns
+ * assigned while another thread modified their clusters is printed with
+ * each pass.
+ *
+ * If par.batchSize isn't 0 the patterns are assigned by the mini-batch
+ * engine instead (see assign_batches()): the patterns of a batch are matched
+ * in parallel against the same prototypes, which scales with the number of
+ * threads but gives different clusters than the sequential engine.
  *
- * @param[out] bestClusts 
- * @param[out] bestFluc
+ * If COLLAPSE_COPIES is set the copies of a pattern are collapsed into a
+ * single unique pattern which is assigned once per pass, at the place of its
+ * first copy (see pats_unique()). Every copy then ends in the cluster of the
+ * first one, whereas without collapsing a later copy is matched against the
+ * prototypes modified by the patterns in between and can end elsewhere: the
+ * clusters can differ from the ones of a run without collapsing. The copies
+ * still count in the fluctuation, and the clusters hold every copy once
+ * trained (see clusts_expand()).
+ *
+ * @param[out] bestClusts The clusters of the pass with the lowest fluctuation.
+ * @param[out] bestFluc   The fluctuation of this pass.
  * @param[in]  pats 
  * @param[in]  par 
  */
-void network_train(Vector **bestClusts, float *bestFluc, InParam par,
-                   Vector *pats){
+void network_train(ClustStore **bestClusts, float *bestFluc, InParam par,
+                   PatSet *pats){
     ulong i;
-    // Index of current pattern 'pat' in 'pats'
+    // Unique training patterns (NULL if there's no copy or no collapsing)
+    UniqPats *uniq = COLLAPSE_COPIES ? pats_unique(pats) : NULL;
+    // Patterns actually trained: the unique ones if there are copies
+    PatSet *trainPats = uniq != NULL ? uniq->pats : pats;
+    // Index of current pattern 'pat' in 'trainPats'
     ulong iPat;
     // Number of reassigned patterns
     ulong noReassigned;
@@ -518,103 +2725,333 @@ void network_train(Vector **bestClusts, float *bestFluc, InParam par,
     ulong pass = 0;
     // Have to pass reference to vec_add and vec_pushback
     bool trueValue = true;
-    /* Every clusters (prototypes, patterns sets and inhib flag)
-     * modified in: - try_next_candidat->clust_rm_pat
-     *              - try_next_candidat->clust_rm_pat->prot_add_pat
-     *              - try_next_candidat->clust_add_new
-     *              - try_next_candidat->clust_add_new->clust_rm_pat
-     *              - try_next_candidat->clust_add_pat
-     *              - try_next_candidat->clust_add_pat->clust_rm_pat
-     *              - try_next_candidat->clust_add_pat->prot_add_pat
-     */
-    Vector *clusts;         // Vector of Cluster
+    /* Every clusters (prototypes and patterns sets)
+     * modified in: - assign_pat->clust_add_new
+     *              - assign_pat->clust_add_new->clust_rm_pat
+     *              - assign_pat->clust_add_pat
+     *              - assign_pat->clust_add_pat->clust_rm_pat
+     *              - assign_pat->clust_add_pat->prot_add_pat
+     */
+    ClustStore *clusts;
+    /* Cluster of every patterns and their position in its patterns set
+     * modified in: - assign_pat->clust_rm_pat
+     *              - assign_pat->clust_add_new
+     *              - assign_pat->clust_add_pat
+     */
+    Assignment asg;
+    // Assignment of the best pass so far, see asg_save()
+    Assignment best;
+    // Number of clusters and number of the best pass so far
+    ulong bestSize = 0;
+    ulong bestPass = 0;
+    // Search of the best matching cluster of the current pattern
+    CandSearch search;
+    // Workers scoring the clusters (NULL if there's only one thread)
+    ThreadPool *pool = par.nThreads > 1 ? pool_create(par.nThreads) : NULL;
     /* Tell if a pattern were reassigned to another cluster
      * modified in: - here
-     *              - try_next_candidat
+     *              - assign_pat
      */
     Vector *reassigned;     // Vector of bool
     // percentage of reassigned patterns (starting at 100%)
     float fluc = 100;
+    // Random generator breaking the ties between candidates
+    Rng rng;
+    // Batch of patterns assigned at once (mini-batch engine only)
+    BatchJob job;
+    // Window of speculatively assigned patterns (several threads only)
+    SpecJob spec;
+    // Last best matching clusters of the patterns (sequential engine only)
+    MatchCache cache;
+    // Lock-free assignment of the patterns (lock-free engine only)
+    HogJob hog;
+    // Number of stale patterns of the pass (lock-free engine only)
+    ulong stale = 0;
+#ifdef COUNT_ALLOCS
+    ulong allocs;
+#endif
 
-    printf("Pass n° | No. reassigned | Fluctuation | No. clusters\n");
-    printf("--------+----------------+-------------+-------------\n");
+    if(!par.quiet && uniq != NULL){
+        printf("%lu patterns are copies of others: training %lu unique "\
+               "patterns\n\n", pats->nPats - trainPats->nPats,
+               trainPats->nPats);
+    }
+    if(!par.quiet){
+        printf("Pass n° | No. reassigned | Fluctuation | No. clusters%s\n",
+               par.hogwild ? " | No. stale" : "");
+        printf("--------+----------------+-------------+-------------%s\n",
+               par.hogwild ? "+----------" : "");
+    }
     *bestFluc = fluc + 1;    // starting at an impossible value
-    clusts = iVector.Create(sizeof(Cluster), 1);
-    reassigned = iVector.Create(sizeof(bool), vec_size(pats));
-    for(i = 0; i < vec_size(pats); i++){
+    clusts = clusts_create(trainPats->len);
+    reassigned = iVector.Create(sizeof(bool), trainPats->nPats);
+    for(i = 0; i < trainPats->nPats; i++){
         iVector.Add(reassigned, &trueValue);
     }
-    srand((unsigned int)time(0)); 
+    asg.clust = malloc(trainPats->nPats * sizeof(ulong));
+    asg.pos = malloc(trainPats->nPats * sizeof(ulong));
+    best.clust = malloc(trainPats->nPats * sizeof(ulong));
+    best.pos = malloc(trainPats->nPats * sizeof(ulong));
+    for(i = 0; i < trainPats->nPats; i++){
+        asg.clust[i] = NOT_FOUND;
+    }
+    rng_seed(&rng, par.seed);
+    search_init(&search, pool, &rng, par, trainPats->len, true);
+    if(par.hogwild){
+        hog_init(&hog, trainPats, pool, par);
+    }
+    else if(par.batchSize > 0){
+        batch_init(&job, trainPats, clusts, &asg, pool, par);
+    }
+    else{
+        cache_init(&cache, trainPats->nPats);
+        if(pool != NULL){
+            spec_init(&spec, trainPats, clusts, &asg, &cache, pool, par);
+        }
+    }
 
     // loop while pass < maxPasses and fluc > minFluc
     while((pass < par.maxPasses) && (fluc > par.minFluc)){
         // start of pass: no pattern have been reassigned yet
         reset_reassigned(reassigned);
-        // for each training pattern
-        for(iPat = 0; iPat < vec_size(pats); iPat++){
-            // next iteration pattern: no prototype have been inhibited yet
-            reset_clusts_inhib_flags(clusts);
-            do{
-                if(try_next_candidate(par, pats, clusts, reassigned, iPat)){
-                    break;
+#ifdef COUNT_ALLOCS
+        allocs = alloc_count();
+#endif
+        if(par.hogwild){
+            hog.seed = par.seed ^ (unsigned int)(pass * 2246822519UL);
+            stale = assign_hogwild(&hog, &clusts, &asg, pool, reassigned);
+        }
+        else if(par.batchSize > 0){
+            job.seed = par.seed ^ (unsigned int)(pass * 2246822519UL);
+            assign_batches(&job, pool, reassigned, par.batchSize);
+        }
+        else if(pool != NULL){
+            cache_trim(&cache, trainPats->nPats);
+            assign_speculative(&spec, &search, pool, reassigned);
+        }
+        else{
+            cache_trim(&cache, trainPats->nPats);
+            // for each training pattern
+            for(iPat = 0; iPat < trainPats->nPats; iPat++){
+                assign_pat(trainPats, clusts, &search, &asg, &cache,
+                           reassigned, iPat);
+                // enough clusters to match them through the bit-sliced index
+                if(clusts->cols == NULL && clusts->size >= SLICED_MIN_CLUSTS){
+                    clusts_index(clusts);
                 }
             }
-            while(vec_size(clusts) != vec_size(pats));
         }
+#ifdef COUNT_ALLOCS
+        if(!par.quiet){
+            printf("DEBUG: %lu heap allocations during the pass\n",
+                   alloc_count() - allocs);
+        }
+#endif
         // compute pass statistics
-        compute_pass_stats(&noReassigned, &fluc, reassigned, pats);
+        compute_pass_stats(&noReassigned, &fluc, reassigned, uniq,
+                           pats->nPats);
         pass++;
-        printf("%7lu | %14lu | %10g%% | %12lu\n", pass, noReassigned, fluc, 
-               vec_size(clusts));
+        if(!par.quiet){
+            printf("%7lu | %14lu | %10g%% | %12lu", pass, noReassigned,
+                   fluc, clusts->size);
+            if(par.hogwild){
+                printf(" | %9lu", stale);
+            }
+            printf("\n");
+        }
         // if new best pass: set the best statistics with its statistics
         if(fluc < *bestFluc){
-            *bestClusts = clusts;
+            asg_save(&best, &asg, trainPats->nPats);
+            bestSize = clusts->size;
+            bestPass = pass;
             *bestFluc = fluc;
         }
     }
+    // the last pass isn't the best one: go back to the best one
+    if(bestPass == pass){
+        *bestClusts = clusts;
+    }
+    else{
+        *bestClusts = clusts_restore(&best, bestSize, trainPats);
+        clusts_finalize(clusts);
+    }
+    if(uniq != NULL){
+        clusts_expand(*bestClusts, uniq);
+    }
     // free
     iVector.Finalize(reassigned);
+    free(asg.clust);
+    free(asg.pos);
+    free(best.clust);
+    free(best.pos);
+    search_finalize(&search);
+    if(par.hogwild){
+        hog_job_finalize(&hog);
+    }
+    else if(par.batchSize > 0){
+        batch_finalize(&job);
+    }
+    else{
+        if(pool != NULL){
+            spec_finalize(&spec);
+        }
+        cache_finalize(&cache);
+    }
+    pool_finalize(pool);
+    uniq_finalize(uniq);
 }
 
-static ulong test_next_candidate(InParam par, Vector *clusts,
-                                 Vector *pats, ulong iPat){
+static ulong test_next_candidate(InParam par, ClustStore *clusts,
+                                 PatSet *pats, CandSearch *scratch,
+                                 unsigned int *seed, ulong iPat){
     ulong iCandidat = NOT_FOUND;
 
-    nearest_prot(&iCandidat, vec_get(pats, iPat), clusts, par.beta);
+    nearest_prot(&iCandidat, pats, iPat, clusts, scratch, seed);
     return iCandidat;
 }
 
-void network_test(Vector **testResClasses, Vector *clusts, InParam par,
-                  Vector *pats, Vector *clustsClasses, Vector *classes){
+/** Classify a part of the testing patterns.
+ *
+ * The patterns are split in job->nParts contiguous parts. The best matching
+ * cluster of each pattern of the part 'iPart' is written in job->patClust and
+ * the number of patterns whose class matches the cluster class is counted in
+ * job->success[iPart] (job->fail[iPart] otherwise).
+ *
+ * The ties are broken with a random generator seeded from job->seed and the
+ * pattern index, so the result of a pattern dosen't depend on the part it
+ * belongs to.
+ *
+ * @param[in,out] arg   The testing job (a TestJob).
+ * @param[in]     iPart The index of the part to classify.
+ */
+static void test_part(void *arg, ulong iPart){
+    TestJob *job = arg;
+    const ulong nPats = job->pats->nPats;
+    const ulong from = iPart * nPats / job->nParts;
+    const ulong to = (iPart + 1) * nPats / job->nParts;
     ulong iPat;
-    ulong clustID;
+    unsigned int seed;
     char *clustClass;
     char *patClass;
-    ulong success = 0;
-    ulong fail = 0;
 
-    // For each test pattern
-    for(iPat = 0; iPat < vec_size(pats); iPat++){
+    job->success[iPart] = 0;
+    job->fail[iPart] = 0;
+    for(iPat = from; iPat < to; iPat++){
+        seed = job->seed ^ (unsigned int)(iPat * 2654435761UL);
         // Index of cluster prototype with highest score in clusts
-        clustID = test_next_candidate(par, clusts, pats, iPat);
+        job->patClust[iPat] = test_next_candidate(*job->par, job->clusts,
+                                                  job->pats,
+                                                  &job->scratch[iPart], &seed,
+                                                  iPat);
         // Class of the best matching cluster
-        clustClass = vec_get_as_str(clustsClasses, clustID);
+        clustClass = vec_get_as_str(job->clustsClasses, job->patClust[iPat]);
         // Class of the testing pattern
-        patClass = vec_get_as_str(classes, iPat);
-        // Save the cluster class in the vector
-        vec_pushback(*testResClasses, &clustClass);
+        patClass = vec_get_as_str(job->classes, iPat);
         // Increment success or fail wether the cluster and the testing pattern 
         // classes match
         if(strcmp(clustClass, patClass) == 0){
-            success++;
+            job->success[iPart]++;
         }
         else{
-            fail++;
+            job->fail[iPart]++;
         }
     }
-    printf("SUCCESS: %lu (%g%%)\n",
-           success, success * 100 / (float)(success + fail));
-    printf("FAIL: %lu (%g%%)\n",
-            fail, fail * 100 / (float)(success + fail));
-    printf("RATIO: %g\n", success / (float)fail);
+}
+
+/** Classify every testing patterns with the trained network.
+ *
+ * Each pattern is classified on its own, so the patterns are split between
+ * par.nThreads threads. Every thread has its own scores buffers and counters,
+ * which are merged once all the patterns are classified.
+ *
+ * @param[out] testResClasses The class of the best matching cluster of each
+ *  testing pattern.
+ * @param[in]  clusts         The network clusters.
+ * @param[in]  par            The network parameters.
+ * @param[in]  pats           The testing patterns.
+ * @param[in]  clustsClasses  The class of each cluster.
+ * @param[in]  classes        The class of each testing pattern.
+ *
+ * @return The number of testing patterns whose class is the class of their
+ *  best matching cluster.
+ */
+ulong network_test(Vector **testResClasses, ClustStore *clusts, InParam par,
+                  PatSet *pats, Vector *clustsClasses, Vector *classes){
+    ulong iPat, iPart;
+    char *clustClass;
+    ulong success = 0;
+    ulong fail = 0;
+    TestJob job;
+    // Workers classifying the patterns (NULL if there's only one thread)
+    ThreadPool *pool = par.nThreads > 1 ? pool_create(par.nThreads) : NULL;
+#ifdef COUNT_ALLOCS
+    ulong allocs;
+#endif
+
+    if(clusts->size >= SLICED_MIN_CLUSTS){
+        clusts_index(clusts);
+    }
+    job.par = &par;
+    job.clusts = clusts;
+    job.pats = pats;
+    job.clustsClasses = clustsClasses;
+    job.classes = classes;
+    job.nParts = par.nThreads > 1 ? par.nThreads : 1;
+    job.seed = par.seed;
+    job.scratch = malloc(job.nParts * sizeof(CandSearch));
+    job.success = malloc(job.nParts * sizeof(ulong));
+    job.fail = malloc(job.nParts * sizeof(ulong));
+    job.patClust = malloc(pats->nPats * sizeof(ulong));
+    if(job.scratch == NULL || job.success == NULL || job.fail == NULL ||
+       job.patClust == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the testing buffers\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    // Scores and ties buffers, sized once for every test patterns
+    for(iPart = 0; iPart < job.nParts; iPart++){
+        search_init(&job.scratch[iPart], NULL, NULL, par, pats->len, false);
+        search_reserve(&job.scratch[iPart], clusts->size);
+    }
+    iVector.Reserve(*testResClasses, pats->nPats + 1);
+#ifdef COUNT_ALLOCS
+    allocs = alloc_count();
+#endif
+    if(pool != NULL){
+        pool_run(pool, test_part, &job, job.nParts);
+    }
+    else{
+        test_part(&job, 0);
+    }
+    // Save the clusters classes in the vector, in patterns order
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        clustClass = vec_get_as_str(clustsClasses, job.patClust[iPat]);
+        vec_pushback(*testResClasses, &clustClass);
+    }
+    for(iPart = 0; iPart < job.nParts; iPart++){
+        success += job.success[iPart];
+        fail += job.fail[iPart];
+    }
+#ifdef COUNT_ALLOCS
+    if(!par.quiet){
+        printf("DEBUG: %lu heap allocations while testing\n",
+               alloc_count() - allocs);
+    }
+#endif
+    for(iPart = 0; iPart < job.nParts; iPart++){
+        search_finalize(&job.scratch[iPart]);
+    }
+    free(job.scratch);
+    free(job.success);
+    free(job.fail);
+    free(job.patClust);
+    pool_finalize(pool);
+    if(!par.quiet){
+        printf("SUCCESS: %lu (%g%%)\n",
+               success, success * 100 / (float)(success + fail));
+        printf("FAIL: %lu (%g%%)\n",
+                fail, fail * 100 / (float)(success + fail));
+        printf("RATIO: %g\n", success / (float)fail);
+    }
+    return success;
 }
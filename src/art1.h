@@ -6,11 +6,39 @@
 
 /*=====| DEFINES |============================================================*/
 #define NONE -1
+// Number of clusters from which their scores are computed by several threads
+#define PAR_SCORES_MIN_CLUSTS 4096
+// Number of words between two checks of the common 1 count of a prototype
+#define COM_ONES_CHUNK 8
+// Number of 1 of a sparse pattern between two checks of the same count
+#define COM_PROBE_CHUNK 32
+// Number of clusters from which they are matched through the bit-sliced index
+#define SLICED_MIN_CLUSTS 128
+// Number of training patterns speculated per thread before they're committed
+#define SPEC_PATS_PER_THREAD 64
+// Number of clusters matched for the cost of checking one modified cluster
+#define CACHE_CHECK_COST 4
+// Skip the patterns whose best matching clusters are unchanged (0 to match
+// them again at every pass, see cache_valid())
+#ifndef MATCH_CACHE
+#define MATCH_CACHE 1
+#endif
+// Look up the prototypes equal to a pattern before scoring the clusters (0 to
+// always score them, see exact_matches())
+#ifndef EXACT_MATCHES
+#define EXACT_MATCHES 1
+#endif
+// Train the copies of a pattern once per pass as a single unique pattern (1
+// to collapse them, see pats_unique()): faster on sets with many copies but
+// the clusters can differ from the ones of a run without collapsing
+#ifndef COLLAPSE_COPIES
+#define COLLAPSE_COPIES 0
+#endif
 
 /*=====| PROTOTYPES |=========================================================*/
-void network_train(Vector **bestClusts, float *bestFluc, InParam par,
-                   Vector *pats);
-void network_test(Vector **testClasses, Vector *bestClusts, InParam par,
-                  Vector *pats, Vector *clustsClasses, Vector *classes);
+void network_train(ClustStore **bestClusts, float *bestFluc, InParam par,
+                   PatSet *pats);
+ulong network_test(Vector **testClasses, ClustStore *bestClusts, InParam par,
+                  PatSet *pats, Vector *clustsClasses, Vector *classes);
 
 #endif
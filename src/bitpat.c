@@ -0,0 +1,506 @@
+/*############################################################################*\
+#         _   ___ _____ _   ___ ___ __  __ _   _ _      _ _____ ___  ___       #
+#        /_\ | _ \_   _/ | / __|_ _|  \/  | | | | |    /_\_   _/ _ \| _ \      #
+#       / _ \|   / | | | | \__ \| || |\/| | |_| | |__ / _ \| || (_) |   /      #
+#      /_/ \_\_|_\ |_| |_| |___/___|_|  |_|\___/|____/_/ \_\_| \___/|_|_\      #
+#                                                                              #
+#                                                          by Mathieu FOURCROY #
+#                                                                         2015 #
+\*############################################################################*/
+/**
+ * @file bitpat.c
+ * @author Mathieu Fourcroy
+ * @date June 2015
+ * @version 0.0.1
+ *
+ * This file contains the functions working on packed binary patterns.
+ *
+ * PACKED PATTERNS
+ * ---------------
+ * A pattern (or a prototype) is stored as an array of BitWord, WORD_BITS bits
+ * per word. Bit 'i' of the pattern is bit 'i % WORD_BITS' of word
+ * 'i / WORD_BITS'. The padding bits of the last word are always 0 so they can
+ * be counted along with the others without any masking.
+ *
+ * Counting the 1 of a pattern or the 1 two patterns have in common is then a
+ * popcount per word instead of a function call per bit.
+ *
+ * POPCOUNT KERNELS
+ * ----------------
+ * bits_ones() and bits_com_ones() are function pointers set by bits_init() to
+ * the fastest kernel the CPU supports:
+ *  - avx512: VPOPCNTDQ, 8 words per instruction (Ice Lake and later).
+ *  - avx2: nibble lookup table with PSHUFB, 4 words per iteration.
+ *  - popcnt: the POPCNT instruction, one word at a time (SSE4.2 CPUs).
+ *  - scalar: portable bit twiddling, used when nothing else is available.
+ *
+ * Before being selected every kernel is checked against the scalar one on
+ * random patterns of various lengths, so a broken kernel is never used.
+ *
+ * SPARSE PATTERNS
+ * ---------------
+ * A sparse pattern is the sorted list of the indexes of its 1. It is matched
+ * against a packed prototype by probing the prototype bit of each index
+ * (bits_probe_ones()), which takes as many reads as the pattern has 1 whatever
+ * the length of the patterns.
+ *
+ * FINGERPRINTS
+ * ------------
+ * The fingerprint of a pattern is the sum of a hash of each of its non-null
+ * words and of their index, so it is the same whether it is computed from the
+ * packed pattern (bits_fingerprint()) or from the indexes of its 1
+ * (bits_idx_fingerprint()). Two equal patterns have the same fingerprint, two
+ * patterns with the same fingerprint must still be compared.
+ */
+
+/*=====| INCLUDES |===========================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bitpat.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BITS_X86_64
+#include <immintrin.h>
+#endif
+
+/*=====| DEFINES |============================================================*/
+#define SELF_TEST_WORDS 67
+
+/*=====| TYPEDEFS & STRUCTURES |==============================================*/
+typedef unsigned long (*OnesFun)(const BitWord *, unsigned long);
+typedef unsigned long (*ComOnesFun)(const BitWord *, const BitWord *,
+                                    unsigned long);
+
+/** The structure describes a popcount kernel.
+ */
+typedef struct {
+    const char *name;
+    OnesFun ones;
+    ComOnesFun comOnes;
+} Kernel;
+
+/*=====| FUNCTIONS |==========================================================*/
+/** Returns the number of 1 in a word, without any special instruction.
+ *
+ * @param[in] x The word.
+ *
+ * @return The number of 1 in the word.
+ */
+static inline unsigned long popcount_swar(BitWord x){
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+static unsigned long com_ones_scalar(const BitWord *bits1,
+                                     const BitWord *bits2,
+                                     unsigned long nWords){
+    unsigned long i;
+    unsigned long count = 0;
+
+    for(i = 0; i < nWords; i++){
+        count += popcount_swar(bits1[i] & bits2[i]);
+    }
+    return count;
+}
+
+static unsigned long ones_scalar(const BitWord *bits, unsigned long nWords){
+    unsigned long i;
+    unsigned long count = 0;
+
+    for(i = 0; i < nWords; i++){
+        count += popcount_swar(bits[i]);
+    }
+    return count;
+}
+
+#ifdef BITS_X86_64
+__attribute__((target("popcnt")))
+static unsigned long com_ones_popcnt(const BitWord *bits1,
+                                     const BitWord *bits2,
+                                     unsigned long nWords){
+    unsigned long i = 0;
+    unsigned long c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+    for(; i + 4 <= nWords; i += 4){
+        c0 += _mm_popcnt_u64(bits1[i] & bits2[i]);
+        c1 += _mm_popcnt_u64(bits1[i + 1] & bits2[i + 1]);
+        c2 += _mm_popcnt_u64(bits1[i + 2] & bits2[i + 2]);
+        c3 += _mm_popcnt_u64(bits1[i + 3] & bits2[i + 3]);
+    }
+    for(; i < nWords; i++){
+        c0 += _mm_popcnt_u64(bits1[i] & bits2[i]);
+    }
+    return c0 + c1 + c2 + c3;
+}
+
+__attribute__((target("popcnt")))
+static unsigned long ones_popcnt(const BitWord *bits, unsigned long nWords){
+    unsigned long i;
+    unsigned long count = 0;
+
+    for(i = 0; i < nWords; i++){
+        count += _mm_popcnt_u64(bits[i]);
+    }
+    return count;
+}
+
+/** AND-popcount using a nibble lookup table (see W. Mula, "Faster population
+ * counts using AVX2 instructions").
+ *
+ * Each byte is split in two nibbles whose number of 1 is looked up with
+ * PSHUFB, then the bytes are summed in 64 bits lanes with PSADBW.
+ */
+__attribute__((target("avx2,popcnt")))
+static unsigned long com_ones_avx2(const BitWord *bits1, const BitWord *bits2,
+                                   unsigned long nWords){
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    __m256i v, lo, hi, cnt;
+    unsigned long i = 0;
+    unsigned long count;
+
+    for(; i + 4 <= nWords; i += 4){
+        v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(bits1 + i)),
+                             _mm256_loadu_si256((const __m256i *)(bits2 + i)));
+        lo = _mm256_and_si256(v, lowMask);
+        hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+        cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                              _mm256_shuffle_epi8(lut, hi));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt,
+                                                    _mm256_setzero_si256()));
+    }
+    count = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+            _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+    for(; i < nWords; i++){
+        count += _mm_popcnt_u64(bits1[i] & bits2[i]);
+    }
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static unsigned long ones_avx2(const BitWord *bits, unsigned long nWords){
+    return com_ones_avx2(bits, bits, nWords);
+}
+
+/** AND-popcount using the AVX-512 VPOPCNTDQ instruction.
+ *
+ * The last words are loaded with a mask so there's no scalar tail.
+ */
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static unsigned long com_ones_avx512(const BitWord *bits1,
+                                     const BitWord *bits2,
+                                     unsigned long nWords){
+    __m512i acc = _mm512_setzero_si512();
+    __m512i v;
+    __mmask8 mask;
+    unsigned long i = 0;
+
+    for(; i + 8 <= nWords; i += 8){
+        v = _mm512_and_si512(_mm512_loadu_si512(bits1 + i),
+                             _mm512_loadu_si512(bits2 + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+    }
+    if(i < nWords){
+        mask = (__mmask8)((1U << (nWords - i)) - 1);
+        v = _mm512_and_si512(_mm512_maskz_loadu_epi64(mask, bits1 + i),
+                             _mm512_maskz_loadu_epi64(mask, bits2 + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+    }
+    return _mm512_reduce_add_epi64(acc);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static unsigned long ones_avx512(const BitWord *bits, unsigned long nWords){
+    return com_ones_avx512(bits, bits, nWords);
+}
+#endif
+
+/** Check a kernel against the scalar one.
+ *
+ * Both kernels count random patterns of every length from 0 to
+ * SELF_TEST_WORDS words, starting at an unaligned address.
+ *
+ * @param[in] kernel The kernel to check.
+ *
+ * @return true if the kernel always agrees with the scalar kernel.
+ */
+static bool kernel_self_test(const Kernel *kernel){
+    BitWord bits1[SELF_TEST_WORDS + 1];
+    BitWord bits2[SELF_TEST_WORDS + 1];
+    BitWord seed = 0x9e3779b97f4a7c15ULL;
+    unsigned long i, n;
+
+    for(i = 0; i <= SELF_TEST_WORDS; i++){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        bits1[i] = seed;
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        bits2[i] = seed ^ (seed << 17);
+    }
+    for(n = 0; n <= SELF_TEST_WORDS; n++){
+        if(kernel->ones(bits1 + 1, n) != ones_scalar(bits1 + 1, n) ||
+           kernel->comOnes(bits1 + 1, bits2 + 1, n) !=
+           com_ones_scalar(bits1 + 1, bits2 + 1, n)){
+            return false;
+        }
+    }
+    return true;
+}
+
+OnesFun bits_ones = ones_scalar;
+ComOnesFun bits_com_ones = com_ones_scalar;
+static const char *kernelName = "scalar";
+
+/** Select the fastest popcount kernel supported by the CPU.
+ *
+ * Every kernel supported by the CPU is checked by kernel_self_test(), the
+ * fastest one which passes is used by bits_ones() and bits_com_ones(). A
+ * warning is printed for every kernel which fails.
+ */
+void bits_init(void){
+    Kernel kernels[] = {
+#ifdef BITS_X86_64
+        {"avx512", ones_avx512, com_ones_avx512},
+        {"avx2", ones_avx2, com_ones_avx2},
+        {"popcnt", ones_popcnt, com_ones_popcnt},
+#endif
+        {"scalar", ones_scalar, com_ones_scalar}
+    };
+    const unsigned long nKernels = sizeof(kernels) / sizeof(kernels[0]);
+    bool selected = false;
+    bool supported;
+    unsigned long i;
+
+#ifdef BITS_X86_64
+    __builtin_cpu_init();
+#endif
+    for(i = 0; i < nKernels; i++){
+        supported = true;
+#ifdef BITS_X86_64
+        if(strcmp(kernels[i].name, "avx512") == 0){
+            supported = __builtin_cpu_supports("avx512f") &&
+                        __builtin_cpu_supports("avx512vpopcntdq");
+        }
+        else if(strcmp(kernels[i].name, "avx2") == 0){
+            supported = __builtin_cpu_supports("avx2") &&
+                        __builtin_cpu_supports("popcnt");
+        }
+        else if(strcmp(kernels[i].name, "popcnt") == 0){
+            supported = __builtin_cpu_supports("popcnt");
+        }
+#endif
+        if(!supported){
+            continue;
+        }
+        if(!kernel_self_test(&kernels[i])){
+            fprintf(stderr, "WARNING: %s popcount kernel disagrees with the "\
+                    "scalar kernel - not used\n", kernels[i].name);
+            continue;
+        }
+        if(!selected){
+            bits_ones = kernels[i].ones;
+            bits_com_ones = kernels[i].comOnes;
+            kernelName = kernels[i].name;
+            selected = true;
+        }
+    }
+}
+
+/** Returns the name of the popcount kernel selected by bits_init().
+ *
+ * @return The name of the kernel ("avx512", "avx2", "popcnt" or "scalar").
+ */
+const char *bits_kernel_name(void){
+    return kernelName;
+}
+
+/** AND a packed pattern into another one.
+ *
+ * @param[in,out] dst    The pattern which will only keep the 1 of 'src'.
+ * @param[in]     src    The pattern to AND into 'dst'.
+ * @param[in]     nWords Number of words of the patterns.
+ */
+void bits_and(BitWord *dst, const BitWord *src, unsigned long nWords){
+    unsigned long i;
+
+    for(i = 0; i < nWords; i++){
+        dst[i] &= src[i];
+    }
+}
+
+/** AND a packed pattern into another one and count the remaining 1.
+ *
+ * The 1 are counted by the kernel selected by bits_init(), the words of 'dst'
+ * being still in the cache after the AND.
+ *
+ * @param[in,out] dst    The pattern which will only keep the 1 of 'src'.
+ * @param[in]     src    The pattern to AND into 'dst'.
+ * @param[in]     nWords Number of words of the patterns.
+ *
+ * @return The number of 1 in 'dst' after the AND.
+ */
+unsigned long bits_and_ones(BitWord *dst, const BitWord *src,
+                            unsigned long nWords){
+    bits_and(dst, src, nWords);
+    return bits_ones(dst, nWords);
+}
+
+/** Copy a packed pattern.
+ *
+ * @param[out] dst    The destination pattern.
+ * @param[in]  src    The pattern to copy.
+ * @param[in]  nWords Number of words of the patterns.
+ */
+void bits_copy(BitWord *dst, const BitWord *src, unsigned long nWords){
+    memcpy(dst, src, nWords * sizeof(BitWord));
+}
+
+/** Count the 1 a packed pattern and a sparse pattern have in common.
+ *
+ * @param[in] bits  The packed pattern.
+ * @param[in] idx   The sorted indexes of the 1 of the sparse pattern.
+ * @param[in] nOnes Number of 1 of the sparse pattern.
+ *
+ * @return The number of indexes of 'idx' where 'bits' has a 1.
+ */
+unsigned long bits_probe_ones(const BitWord *bits, const uint32_t *idx,
+                              unsigned long nOnes){
+    unsigned long i;
+    unsigned long count = 0;
+
+    for(i = 0; i < nOnes; i++){
+        count += bit_get(bits, idx[i]);
+    }
+    return count;
+}
+
+/** AND a sparse pattern into a packed one and count the remaining 1.
+ *
+ * The sparse pattern is turned into one mask per word on the fly: the words
+ * without any index are cleared. The remaining 1 are then counted by the
+ * kernel selected by bits_init().
+ *
+ * @param[in,out] dst    The packed pattern which will only keep the 1 of the
+ *  sparse pattern.
+ * @param[in]     idx    The sorted indexes of the 1 of the sparse pattern.
+ * @param[in]     nOnes  Number of 1 of the sparse pattern.
+ * @param[in]     nWords Number of words of 'dst'.
+ *
+ * @return The number of 1 in 'dst' after the AND.
+ */
+unsigned long bits_and_idx(BitWord *dst, const uint32_t *idx,
+                           unsigned long nOnes, unsigned long nWords){
+    unsigned long w;
+    unsigned long i = 0;
+    BitWord mask;
+
+    for(w = 0; w < nWords; w++){
+        for(mask = 0; i < nOnes && idx[i] / WORD_BITS == w; i++){
+            mask |= bit_mask(idx[i]);
+        }
+        dst[w] &= mask;
+    }
+    return bits_ones(dst, nWords);
+}
+
+/** Pack a sparse pattern.
+ *
+ * @param[out] dst    The packed pattern.
+ * @param[in]  idx    The sorted indexes of the 1 of the sparse pattern.
+ * @param[in]  nOnes  Number of 1 of the sparse pattern.
+ * @param[in]  nWords Number of words of 'dst'.
+ */
+void bits_from_idx(BitWord *dst, const uint32_t *idx, unsigned long nOnes,
+                   unsigned long nWords){
+    unsigned long i;
+
+    memset(dst, 0, nWords * sizeof(BitWord));
+    for(i = 0; i < nOnes; i++){
+        bit_set(dst, idx[i]);
+    }
+}
+
+/** Unpack a packed pattern into the sorted indexes of its 1.
+ *
+ * @param[out] dst    The indexes, as much as the pattern has 1.
+ * @param[in]  bits   The packed pattern.
+ * @param[in]  nWords Number of words of the pattern.
+ *
+ * @return The number of indexes written in 'dst'.
+ */
+unsigned long bits_to_idx(uint32_t *dst, const BitWord *bits,
+                          unsigned long nWords){
+    unsigned long w;
+    unsigned long n = 0;
+    BitWord word;
+
+    for(w = 0; w < nWords; w++){
+        for(word = bits[w]; word != 0; word &= word - 1){
+            dst[n++] = (uint32_t)(w * WORD_BITS + __builtin_ctzll(word));
+        }
+    }
+    return n;
+}
+
+/** Hash a non-null word of a pattern along with its index.
+ *
+ * @param[in] w    The index of the word.
+ * @param[in] word The word.
+ *
+ * @return The hash (the splitmix64 finalizer).
+ */
+static inline BitWord word_hash(unsigned long w, BitWord word){
+    BitWord x = word ^ ((BitWord)(w + 1) * 0x9E3779B97F4A7C15ULL);
+
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/** Compute the fingerprint of a packed pattern.
+ *
+ * @param[in] bits   The packed pattern.
+ * @param[in] nWords Number of words of the pattern.
+ *
+ * @return The fingerprint.
+ */
+BitWord bits_fingerprint(const BitWord *bits, unsigned long nWords){
+    unsigned long w;
+    BitWord res = 0;
+
+    for(w = 0; w < nWords; w++){
+        if(bits[w] != 0){
+            res += word_hash(w, bits[w]);
+        }
+    }
+    return res;
+}
+
+/** Compute the fingerprint of a sparse pattern.
+ *
+ * The words of the pattern are rebuilt on the fly from its sorted indexes.
+ *
+ * @param[in] idx   The sorted indexes of the 1 of the pattern.
+ * @param[in] nOnes Number of 1 of the pattern.
+ *
+ * @return The same fingerprint as bits_fingerprint() on the packed pattern.
+ */
+BitWord bits_idx_fingerprint(const uint32_t *idx, unsigned long nOnes){
+    unsigned long i, w;
+    BitWord word;
+    BitWord res = 0;
+
+    for(i = 0; i < nOnes;){
+        w = idx[i] / WORD_BITS;
+        for(word = 0; i < nOnes && idx[i] / WORD_BITS == w; i++){
+            word |= bit_mask(idx[i]);
+        }
+        res += word_hash(w, word);
+    }
+    return res;
+}
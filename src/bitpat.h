@@ -0,0 +1,41 @@
+#ifndef _BITPAT_H_
+#define _BITPAT_H_
+
+/*=====| INCLUDES |===========================================================*/
+#include <stdint.h>
+
+/*=====| DEFINES |============================================================*/
+#define WORD_BITS 64
+#define nb_words(len) (((len) + WORD_BITS - 1) / WORD_BITS)
+#define bit_mask(idx) ((BitWord)1 << ((idx) % WORD_BITS))
+#define bit_get(bits, idx) (((bits)[(idx) / WORD_BITS] & bit_mask(idx)) != 0)
+#define bit_set(bits, idx) ((bits)[(idx) / WORD_BITS] |= bit_mask(idx))
+#define bit_clear(bits, idx) ((bits)[(idx) / WORD_BITS] &= ~bit_mask(idx))
+#define bit_flip(bits, idx) ((bits)[(idx) / WORD_BITS] ^= bit_mask(idx))
+
+/*=====| TYPEDEFS & STRUCTURES |==============================================*/
+typedef uint64_t BitWord;   // One word of a packed pattern
+
+/*=====| PROTOTYPES |=========================================================*/
+extern unsigned long (*bits_ones)(const BitWord *bits, unsigned long nWords);
+extern unsigned long (*bits_com_ones)(const BitWord *bits1,
+                                      const BitWord *bits2,
+                                      unsigned long nWords);
+void bits_init(void);
+const char *bits_kernel_name(void);
+void bits_and(BitWord *dst, const BitWord *src, unsigned long nWords);
+unsigned long bits_and_ones(BitWord *dst, const BitWord *src,
+                            unsigned long nWords);
+void bits_copy(BitWord *dst, const BitWord *src, unsigned long nWords);
+unsigned long bits_probe_ones(const BitWord *bits, const uint32_t *idx,
+                              unsigned long nOnes);
+unsigned long bits_and_idx(BitWord *dst, const uint32_t *idx,
+                           unsigned long nOnes, unsigned long nWords);
+void bits_from_idx(BitWord *dst, const uint32_t *idx, unsigned long nOnes,
+                   unsigned long nWords);
+unsigned long bits_to_idx(uint32_t *dst, const BitWord *bits,
+                          unsigned long nWords);
+BitWord bits_fingerprint(const BitWord *bits, unsigned long nWords);
+BitWord bits_idx_fingerprint(const uint32_t *idx, unsigned long nOnes);
+
+#endif
@@ -21,11 +21,11 @@
  * PATTERNS TYPE
  * -------------
  * The patterns are effectivly interned in line_to_pat(). As it is for an ART1
- * network they are binary patterns. Thus, they are interned as vectors of 1 and
- * 0. The patterns are read in line_to_pat() and their "bits" are pushed in the
- * vectors in the form of integers codes but the vectors type is char to save
- * some memory. i.e.: the vectors contains char codes x0 and x1 only (not x30
- * and x31), that means that they need to be treated and printed as integers.
+ * network they are binary patterns: any value other than 0 or 1 is an error.
+ * The file is mapped in memory and parsed in a single pass: each line is
+ * checked, its 1 are counted and the patterns made of 0 only are dropped on
+ * the fly. The patterns are then stored straight into the final PatSet,
+ * packed or sparse if they are sparse enough (see readCsv() and bitpat.c).
  *
  * INPUT FILES
  * -----------
@@ -40,6 +40,14 @@
  *  poisonous,0,1,0,0,0,0,1,0,0,1,1,...
  * @endocde
  * Empty lines are allowed, they will be ignored by the parser.
+ *
+ * BINARY DATASETS
+ * ---------------
+ * A csv file can be converted once into a binary dataset (see writeBin()):
+ * the patterns are stored as they are in memory, with their number of 1 and
+ * the index of their class, so the dataset is mapped in memory and used as it
+ * is, without any parsing (see readBin()). The binary datasets are told apart
+ * from the csv files by their first bytes (BIN_MAGIC).
  */
 
 /*=====| INCLUDES |===========================================================*/
@@ -47,18 +55,204 @@
 #include <string.h>
 #include <stdint.h>
 #include <limits.h>
+#include <errno.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "io.h"
 #include "dbg.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CSV_SSE2
+#include <emmintrin.h>
+#endif
+
+/*=====| TYPEDEFS & STRUCTURES |==============================================*/
+/** The structure holds a chunk of lines of a csv file parsed by a thread (see
+ * readCsv()).
+ */
+typedef struct {
+   /** @var CsvChunk::from
+    * The first byte of the chunk, the start of a line.
+    */
+    const char *from;
+
+   /** @var CsvChunk::to
+    * The byte after the chunk, the start of a line or the end of the file.
+    */
+    const char *to;
+
+   /** @var CsvChunk::idx
+    * The indexes of the 1 of the patterns of the chunk, one pattern after the
+    * other, while the chunk is sparse. NULL once it is packed.
+    */
+    uint32_t *idx;
+
+   /** @var CsvChunk::idxCapacity
+    * The number of indexes 'idx' can hold before growing.
+    */
+    ulong idxCapacity;
+
+   /** @var CsvChunk::row
+    * The packed pattern of the line being parsed while the chunk is sparse.
+    */
+    BitWord *row;
+
+   /** @var CsvChunk::bits
+    * The packed patterns of the chunk, one after the other, once the chunk
+    * isn't sparse enough to store the indexes of their 1 (see chunk_pack()).
+    * NULL while it is sparse.
+    */
+    BitWord *bits;
+
+   /** @var CsvChunk::nOnes
+    * The number of 1 of each pattern of the chunk.
+    */
+    ulong *nOnes;
+
+   /** @var CsvChunk::classes
+    * The class of each pattern of the chunk, an index in 'names'.
+    */
+    ulong *classes;
+
+   /** @var CsvChunk::nPats
+    * The number of patterns of the chunk.
+    */
+    ulong nPats;
+
+   /** @var CsvChunk::capacity
+    * The number of patterns the arrays can hold before growing.
+    */
+    ulong capacity;
+
+   /** @var CsvChunk::nZeros
+    * The number of patterns of the chunk made of 0 only, which are dropped.
+    */
+    ulong nZeros;
+
+   /** @var CsvChunk::totOnes
+    * The number of 1 of every patterns of the chunk.
+    */
+    ulong totOnes;
+
+   /** @var CsvChunk::first
+    * The index of the first pattern of the chunk in the patterns set.
+    */
+    ulong first;
+
+   /** @var CsvChunk::firstOne
+    * The index of the first 1 of the chunk in the indexes of a sparse
+    * patterns set.
+    */
+    ulong firstOne;
+
+   /** @var CsvChunk::names
+    * The distinct classes of the chunk, pointing in the file.
+    */
+    const char **names;
+
+   /** @var CsvChunk::nameLens
+    * The length of each distinct class of the chunk.
+    */
+    ulong *nameLens;
+
+   /** @var CsvChunk::nNames
+    * The number of distinct classes of the chunk.
+    */
+    ulong nNames;
+
+   /** @var CsvChunk::emptyLines
+    * The lines of the chunk skipped as empty (vector of ulong).
+    */
+    Vector *emptyLines;
+
+   /** @var CsvChunk::nLines
+    * The number of lines of the chunk, up to its first error if any. The lines
+    * of the chunk are numbered from 1 to nLines.
+    */
+    ulong nLines;
+
+   /** @var CsvChunk::error
+    * The first error of the chunk (CSV_OK if none), on its last line.
+    */
+    int error;
+
+   /** @var CsvChunk::errValues
+    * The number of values read on the line of the error.
+    */
+    ulong errValues;
+
+   /** @var CsvChunk::errChar
+    * The invalid character of a CSV_BAD_VALUE error.
+    */
+    char errChar;
+} CsvChunk;
+
+/** The structure holds the chunks of a csv file parsed in parallel.
+ */
+typedef struct {
+   /** @var CsvJob::chunks
+    * The chunks, in the file order.
+    */
+    CsvChunk *chunks;
+
+   /** @var CsvJob::nChunks
+    * The number of chunks.
+    */
+    ulong nChunks;
+
+   /** @var CsvJob::len
+    * The length of the patterns: the number of values of the first one.
+    */
+    ulong len;
+
+   /** @var CsvJob::skip
+    * Indicate weither the first value of the lines is their class.
+    */
+    bool skip;
+
+   /** @var CsvJob::pats
+    * The patterns set receiving the patterns of every chunks.
+    */
+    PatSet *pats;
+} CsvJob;
 
 /*=====| FUNCTIONS |==========================================================*/
+/** Returns the seed of the random generators.
+ *
+ * The seed is the current time unless the SEED_ENV environment variable
+ * gives one, so a run can be reproduced (the regression tests compare runs
+ * made with the same seed).
+ *
+ * @return The seed.
+ */
+static unsigned int default_seed(void){
+    const char *seed = getenv(SEED_ENV);
+
+    if(seed != NULL && seed[0] != '\0'){
+        return (unsigned int)strtoul(seed, NULL, 10);
+    }
+    return (unsigned int)time(NULL);
+}
+
 /** Fill the parameters structure.
 *
 * @warning The order of the arguments if fix!
 *
+* The 11th argument (number of threads) is optional, 0 or no value means one
+* thread per online processor. The 12th one (batch size of the mini-batch
+* training engine) is optional too, 0 or no value selects the sequential
+* engine. So is the 13th one, 1 selects the lock-free training engine (which
+* can't be used with the mini-batch one). The 14th one, when given and not
+* empty, tells the datasets are categorical csv files (see readCategorical())
+* and gives the column of their class: 1 for the first one, -1 for the last
+* one, 0 if they have none.
+*
 * @todo Replace this function with a true cmdl parser (setop) and remove the
 *   "trainart" script.
 *
@@ -81,6 +275,166 @@ void set_network_values(InParam *par, int argc, const char *argv[]){
     par->vigilance = atof(argv[8]);
     par->minFluc = atof(argv[9]);
     par->maxPasses = atol(argv[10]);
+    par->nThreads = argc > 11 ? atol(argv[11]) : 0;
+    par->batchSize = argc > 12 ? atol(argv[12]) : 0;
+    par->hogwild = argc > 13 ? atoi(argv[13]) : 0;
+    par->encode = argc > 14 && argv[14][0] != '\0';
+    par->classCol = par->encode ? atol(argv[14]) : 0;
+    par->seed = default_seed();
+    par->quiet = false;
+    if(par->hogwild && par->batchSize > 0){
+        fprintf(stderr, "ERROR: the lock-free and the mini-batch training "\
+                "engines can't be used together\nExiting...\n");
+        exit(2);
+    }
+    if(par->nThreads == 0){
+        par->nThreads = pool_default_threads();
+    }
+}
+
+/** Parse a comma separated list of numbers.
+ *
+ * The program exits if a value isn't a number.
+ *
+ * @param[out] values The parsed values (to free).
+ * @param[in]  str    The list, for instance "0.3,0.5,0.7".
+ * @param[in]  name   The name of the list, for the error messages.
+ *
+ * @return The number of values.
+ */
+static ulong parse_list(float **values, const char *str, const char *name){
+    ulong n = 1;
+    const char *c;
+    char *end;
+
+    for(c = str; *c != '\0'; c++){
+        if(*c == ','){
+            n++;
+        }
+    }
+    *values = malloc(n * sizeof(float));
+    for(n = 0; ; n++){
+        (*values)[n] = strtof(str, &end);
+        if(end == str || (*end != ',' && *end != '\0')){
+            fprintf(stderr, "ERROR: invalid %s list \"%s\"\nExiting...\n",
+                    name, str);
+            exit(2);
+        }
+        if(*end == '\0'){
+            return n + 1;
+        }
+        str = end + 1;
+    }
+}
+
+/** Parse a comma separated list of unsigned integers.
+ *
+ * The program exits if a value isn't an unsigned integer (for instance
+ * "12.5" or "-1") or doesn't fit in an ulong.
+ *
+ * @param[out] values The parsed values (to free).
+ * @param[in]  str    The list, for instance "0,64,256".
+ * @param[in]  name   The name of the list, for the error messages.
+ *
+ * @return The number of values.
+ */
+static ulong parse_ulong_list(ulong **values, const char *str,
+                              const char *name){
+    ulong n = 1;
+    const char *c;
+    const char *list = str;
+    char *end;
+
+    for(c = str; *c != '\0'; c++){
+        if(*c == ','){
+            n++;
+        }
+    }
+    *values = malloc(n * sizeof(ulong));
+    if(*values == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the %s list\nExiting...\n",
+                name);
+        exit(12);
+    }
+    for(n = 0; ; n++){
+        errno = 0;
+        end = (char *)str;
+        // strtoul() would accept a sign and leading spaces
+        if(*str >= '0' && *str <= '9'){
+            (*values)[n] = strtoul(str, &end, 10);
+        }
+        if(end == str || errno == ERANGE || (*end != ',' && *end != '\0')){
+            fprintf(stderr, "ERROR: invalid %s list \"%s\"\nExiting...\n",
+                    name, list);
+            exit(2);
+        }
+        if(*end == '\0'){
+            return n + 1;
+        }
+        str = end + 1;
+    }
+}
+
+/** Fill the parameters structures of a parameters sweep.
+ *
+ * @warning The order of the arguments if fix!
+ *
+ * The arguments are: --sweep, the training file, the testing file, skip, the
+ * vigilances list, the betas list, the training noises list, the testing
+ * noise, the minimum fluctuation, the maximum number of passes, the
+ * (optional) number of threads, the (optional) batch sizes list (0 for the
+ * sequential engine, which is the default) and the (optional) class column
+ * of categorical datasets (see set_network_values()). The lists are comma
+ * separated.
+ *
+ * @param[out] par   The parameters shared by every networks.
+ * @param[out] sweep The values tried by the sweep.
+ * @param[in]  argc  Number of arguments in argv.
+ * @param[in]  argv  The arguments.
+ */
+void set_sweep_values(InParam *par, SweepParam *sweep, int argc,
+                      const char *argv[]){
+    if((argc < 11)){
+        fprintf(stderr, "Invalid number of parameters!\nExiting...\n");
+        exit(2);
+    }
+    strcpy(par->trainFile, argv[2]);
+    strcpy(par->testFile, argv[3]);
+    strcpy(par->prefix, "sweep");
+    par->skip = atoi(argv[4]);
+    sweep->nVigilances = parse_list(&sweep->vigilances, argv[5], "vigilance");
+    sweep->nBetas = parse_list(&sweep->betas, argv[6], "beta");
+    sweep->nNoises = parse_list(&sweep->noises, argv[7], "noise");
+    par->trainNoise = 0;
+    par->testNoise = atol(argv[8]);
+    par->beta = sweep->betas[0];
+    par->vigilance = sweep->vigilances[0];
+    par->minFluc = atof(argv[9]);
+    par->maxPasses = atol(argv[10]);
+    par->nThreads = argc > 11 ? atol(argv[11]) : 0;
+    if(par->nThreads == 0){
+        par->nThreads = pool_default_threads();
+    }
+    sweep->nBatches = parse_ulong_list(&sweep->batches,
+                                       argc > 12 ? argv[12] : "0",
+                                       "batch size");
+    par->batchSize = sweep->batches[0];
+    par->hogwild = false;
+    par->encode = argc > 13 && argv[13][0] != '\0';
+    par->classCol = par->encode ? atol(argv[13]) : 0;
+    par->seed = default_seed();
+    par->quiet = true;
+}
+
+/** Free the lists of a parameters sweep filled by set_sweep_values().
+ *
+ * @param[in,out] sweep The values tried by the sweep.
+ */
+void free_sweep_values(SweepParam *sweep){
+    free(sweep->vigilances);
+    free(sweep->betas);
+    free(sweep->noises);
+    free(sweep->batches);
 }
 
 /** Print the network parameters.
@@ -99,7 +453,11 @@ void print_network_values(InParam par){
     puts("Runing ART1 algorithm using following parameters:");
     printf("\tTraining file: %s\n", par.trainFile);
     printf("\tTesting file: %s\n", par.trainFile);
-    if(par.skip){
+    if(par.encode){
+        printf("\tOne-hot encoding the categorical datasets (class column: "\
+               "%ld)\n", par.classCol);
+    }
+    else if(par.skip){
         printf("\tSkipping first attribute of every patterns\n");
     }
     printf("\tOutput file prefix: %s\n", par.prefix);
@@ -107,6 +465,18 @@ void print_network_values(InParam par){
     printf("\tMax number of iterations: %lu\n", par.maxPasses);
     printf("\tBeta parameter: %.0f\n", par.beta);
     printf("\tVigilance parmeter: %g\n", par.vigilance);
+    printf("\tPopcount kernel: %s\n", bits_kernel_name());
+    printf("\tThreads: %lu\n", par.nThreads);
+    if(par.hogwild){
+        printf("\tTraining engine: lock-free\n");
+    }
+    else if(par.batchSize > 0){
+        printf("\tTraining engine: mini-batch (%lu patterns per batch)\n",
+               par.batchSize);
+    }
+    else{
+        printf("\tTraining engine: sequential\n");
+    }
 }
 
 /** Open a file.
@@ -130,28 +500,6 @@ int openFile(FILE **file, const char *name, char const *mode){
     return *file == NULL;
 }
 
-/** Count the number of columns of a csv string.
- *
- * This function don't care about commas and effectively count the number of
- * columns (i.e.: attributes) in a csv string.
- *
- * @param[in] line A csv string.
- *
- * @return The number of columns in the csv string.
- */
-static ulong nb_cols(char *line){
-    ulong c = 0;
-    ulong count = 0;
-
-    while(line[c] != '\0'){
-        if(line[c] == ','){
-            count++;
-        }
-        c++;
-    }
-    return count;
-}
-
 /** Helper function printing a vector of characters as integers.
  *
  * @param[in] vec The vector to print.
@@ -206,131 +554,1448 @@ void vector_print_ulong(Vector *vec){
     printf("%lu\n", vec_get_as_ulong(vec, i));
 }
 
-/** Transform a csv string into a pattern (CSVLine strcture).
+/** Map a file in memory.
+ *
+ * The file is mapped copy-on-write: the content can be modified in memory,
+ * the file is left unchanged. A file which can't be mapped (e.g.: a pipe) is
+ * read in a buffer instead.
+ *
+ * @param[out] map    The content of the file, to release with unmap_file().
+ * @param[in]  name   Path of the file.
+ * @param[in]  advice How the file is read, for madvise() (e.g.:
+ *  MADV_SEQUENTIAL when it is read once from the start to the end).
+ */
+void map_file(FileMap *map, const char *name, int advice){
+    struct stat st;
+    ssize_t n;
+    size_t capacity = 0;
+    void *data;
+    int fd = open(name, O_RDONLY);
+
+    if(fd < 0){
+        fprintf(stderr, "\nFAIL\nERROR: Can't open file \"%s\"\nExiting...\n",
+                name);
+        exit(10);
+    }
+    map->data = NULL;
+    map->size = 0;
+    map->mapped = false;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+        if(data != MAP_FAILED){
+            madvise(data, st.st_size, advice);
+            map->data = data;
+            map->size = st.st_size;
+            map->mapped = true;
+            close(fd);
+            return;
+        }
+    }
+    do{
+        if(map->size == capacity){
+            capacity = 2 * capacity + FILE_READ_CHUNK;
+            map->data = realloc(map->data, capacity);
+            if(map->data == NULL){
+                fprintf(stderr, "\nFAIL\nERROR: Can't allocate the content "\
+                        "of file \"%s\"\nExiting...\n", name);
+                exit(12);
+            }
+        }
+        n = read(fd, map->data + map->size, capacity - map->size);
+        if(n < 0){
+            fprintf(stderr, "\nFAIL\nERROR: Can't read file \"%s\"\n"\
+                    "Exiting...\n", name);
+            exit(10);
+        }
+        map->size += n;
+    } while(n > 0);
+    close(fd);
+}
+
+/** Release the content of a file mapped with map_file().
+ *
+ * @param[in] map The content of the file.
+ */
+void unmap_file(FileMap *map){
+    if(map->mapped){
+        munmap(map->data, map->size);
+    }
+    else{
+        free(map->data);
+    }
+}
+
+/** Tell if a character is ignored around the values of a csv line.
+ *
+ * @param[in] c The character.
+ *
+ * @return true for spaces, tabs and the carriage return of DOS lines.
+ */
+static inline bool is_blank(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/** Returns the string of a class, allocated once for each distinct class.
+ *
+ * The classes are few compared to the patterns, so the distinct classes are
+ * simply searched one by one.
+ *
+ * @param[in,out] names The distinct classes (strings).
+ * @param[in]     str   The class in the csv line, blanks around it included.
+ * @param[in]     end   The end of the class in the csv line.
+ *
+ * @return The string of the class, one of 'names'.
+ */
+static char *class_intern(Vector *names, const char *str, const char *end){
+    ulong i;
+    size_t len;
+    char *name;
+
+    while(str < end && is_blank(*str)){
+        str++;
+    }
+    while(end > str && is_blank(end[-1])){
+        end--;
+    }
+    len = end - str;
+    for(i = 0; i < vec_size(names); i++){
+        name = vec_get_as_str(names, i);
+        if(strncmp(name, str, len) == 0 && name[len] == '\0'){
+            return name;
+        }
+    }
+    name = malloc(len + 1);
+    if(name == NULL){
+        fprintf(stderr, "ERROR: Can't allocate a class\nExiting...\n");
+        exit(12);
+    }
+    memcpy(name, str, len);
+    name[len] = '\0';
+    vec_pushback(names, &name);
+    return name;
+}
+
+/** Compute the masks of the 0, 1 and commas of a block of a csv line.
+ *
+ * Bit i of a mask is set if the byte i of the block is the character.
+ *
+ * @param[out] zeros  The mask of the '0'.
+ * @param[out] ones   The mask of the '1'.
+ * @param[out] commas The mask of the ','.
+ * @param[in]  str    The block, CSV_BLOCK bytes.
+ */
+static inline void block_masks(uint64_t *zeros, uint64_t *ones,
+                               uint64_t *commas, const char *str){
+#ifdef CSV_SSE2
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i one = _mm_set1_epi8('1');
+    const __m128i comma = _mm_set1_epi8(',');
+    __m128i bytes;
+    int k;
+
+    *zeros = *ones = *commas = 0;
+    for(k = 0; k < CSV_BLOCK; k += 16){
+        bytes = _mm_loadu_si128((const __m128i *)(str + k));
+        *zeros |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                      _mm_cmpeq_epi8(bytes, zero)) << k;
+        *ones |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                     _mm_cmpeq_epi8(bytes, one)) << k;
+        *commas |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                       _mm_cmpeq_epi8(bytes, comma)) << k;
+    }
+#else
+    int k;
+
+    *zeros = *ones = *commas = 0;
+    for(k = 0; k < CSV_BLOCK; k++){
+        *zeros |= (uint64_t)(str[k] == '0') << k;
+        *ones |= (uint64_t)(str[k] == '1') << k;
+        *commas |= (uint64_t)(str[k] == ',') << k;
+    }
+#endif
+}
+
+/** Gather the even bits of a mask.
+ *
+ * @param[in] x The mask.
+ *
+ * @return The bits 0, 2, 4, ... 62 of 'x' as the bits 0 to 31.
+ */
+static inline uint64_t even_bits(uint64_t x){
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    return (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+}
+
+/** Store the values of a csv line into a packed pattern.
  *
- * @note If the first attribute is skipped (see parameter skip) then it is added
- *  to the "class" member of the returned structure instead of being added to
- * its "val" member.
+ * The values are separated by commas, the blanks around them and the empty
+ * values are ignored. Only the first character of a value is read, it must
+ * be 0 or 1: it's impossible to build an ART1 network with non-binary
+ * patterns.
  *
- * @param[in] line The csv string to transform.
- * @param[in] skip Indicate weither the first attribute of the csv string must
- *  be skipped or not.
+ * The lines are usually made of single digits and commas, so the line is
+ * scanned CSV_BLOCK bytes at once (see block_masks()): a block made of
+ * CSV_BLOCK / 2 such values gives their bits directly. The values are read
+ * one by one from the first block which isn't.
  *
- * @return The pattern corresponding to the input csv string.
+ * @param[out] pat   The packed pattern receiving the 1 of the first 'len'
+ *  values, its bits must be 0. NULL to only count the values.
+ * @param[out] nOnes The number of 1 of the line.
+ * @param[out] bad   The first invalid value, NULL if there's none.
+ * @param[in]  str   The first value of the line.
+ * @param[in]  end   The end of the line.
+ * @param[in]  len   The length of the pattern.
+ *
+ * @return The number of values of the line, up to the first invalid one.
  */
-static CSVLine line_to_pat(char *line, const bool skip){
-    CSVLine res;
+static ulong line_to_pat(BitWord *pat, ulong *nOnes, const char **bad,
+                         const char *str, const char *end, ulong len){
+    const char *retry = str;
+    uint64_t zeros, ones, commas, bits;
     ulong i = 0;
-    char snumber;
-    char *buffer;
+    ulong shift;
 
-    res.val = iVector.Create(sizeof(char), 1);
-    buffer = strtok(line, ",");
-    while(buffer && *buffer != '\0' && *buffer != '\n'){
-        snumber = *buffer - '0';    // '0' == 0x30 == 48 == 060
-        if(i < skip){
-            res.class = malloc(sizeof(char) * strlen(buffer) + 1);
-            strcpy(res.class, buffer);
+    *nOnes = 0;
+    *bad = NULL;
+    while(str < end){
+        if(*str == ',' || is_blank(*str)){
+            str++;
+            continue;
         }
-        else{
-            vec_pushback(res.val, &snumber);
+        if(str >= retry && end - str >= CSV_BLOCK &&
+           (pat == NULL || i + CSV_BLOCK / 2 <= len)){
+            block_masks(&zeros, &ones, &commas, str);
+            if((zeros | ones) == 0x5555555555555555ULL &&
+               commas == 0xAAAAAAAAAAAAAAAAULL){
+                bits = even_bits(ones);
+                if(pat != NULL && bits != 0){
+                    shift = i % WORD_BITS;
+                    pat[i / WORD_BITS] |= bits << shift;
+                    if(shift > WORD_BITS - CSV_BLOCK / 2){
+                        pat[i / WORD_BITS + 1] |= bits >> (WORD_BITS - shift);
+                    }
+                }
+                *nOnes += __builtin_popcountll(bits);
+                i += CSV_BLOCK / 2;
+                str += CSV_BLOCK;
+                continue;
+            }
+            retry = str + CSV_BLOCK;
         }
-        buffer = strtok(NULL, ",");
-        while(buffer && *buffer == ' '){
-            buffer++;
+        if(*str == '1'){
+            if(pat != NULL && i < len){
+                bit_set(pat, i);
+            }
+            (*nOnes)++;
+        }
+        else if(*str != '0'){
+            *bad = str;
+            return i;
         }
         i++;
+        while(str < end && *str != ','){
+            str++;
+        }
     }
-    return res;
+    return i;
 }
 
-/** Read a csv file into a list.
- *
- * Transform each line of the file into a pattern and insert it in the patterns
- * list.
- *
- * @note Every lines of the csv file must contains the same number of columns.
- *  The file can contains basic comments: each comment lines MUST start with a
- *  "#". Moreover a line can be empty, it will be ignored.
- *
- * @param[out] plen  The length of the patterns (their number of attributes), 
- *  computed bi this function
- * @param[out] lines The list which will be filled with the patterns.
- * @param[in]  file  The csv data file containing the string representing the 
- *  future patterns.
- * @param[in]  skip  Indicate weither the first attribute of the csv string must
- *  be skipped or not.
- */
-void readCsv(ulong *plen, List *lines, FILE *file, bool skip){
-    char *readline = NULL;
-    CSVLine pat;
-    ulong patLen;
-    ulong lineLen = 0;
-    ulong nlines = 1;
-    ulong columns = 0;
-    bool firstLine = false;
-    bool firstPat = true;
-    int read;
-    size_t len;
+/** Returns the class of a line of a csv chunk, interned in the chunk.
+ *
+ * The classes of a chunk point in the file, they are interned once the
+ * chunks are parsed (see class_intern()).
+ *
+ * @param[in,out] chunk The chunk.
+ * @param[in]     str   The class in the csv line, blanks around it included.
+ * @param[in]     end   The end of the class in the csv line.
+ *
+ * @return The index of the class in the chunk names.
+ */
+static ulong chunk_class(CsvChunk *chunk, const char *str, const char *end){
+    ulong i;
+
+    while(str < end && is_blank(*str)){
+        str++;
+    }
+    while(end > str && is_blank(end[-1])){
+        end--;
+    }
+    for(i = 0; i < chunk->nNames; i++){
+        if(chunk->nameLens[i] == (ulong)(end - str) &&
+           memcmp(chunk->names[i], str, end - str) == 0){
+            return i;
+        }
+    }
+    // the arrays double when their size is a power of two
+    if((i & (i - 1)) == 0){
+        chunk->names = realloc(chunk->names, (2 * i + 1) * sizeof(char *));
+        chunk->nameLens = realloc(chunk->nameLens, (2 * i + 1) * sizeof(ulong));
+        if(chunk->names == NULL || chunk->nameLens == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the classes of a csv "\
+                    "chunk\nExiting...\n");
+            exit(12);
+        }
+    }
+    chunk->names[i] = str;
+    chunk->nameLens[i] = end - str;
+    return chunk->nNames++;
+}
+
+/** Pack the patterns of a sparse csv chunk.
+ *
+ * The indexes of the 1 of the patterns are replaced by the packed patterns,
+ * the chunk stays packed until it is stored.
+ *
+ * @param[in,out] chunk The chunk.
+ * @param[in]     len   The length of the patterns.
+ */
+static void chunk_pack(CsvChunk *chunk, ulong len){
+    const ulong nWords = nb_words(len);
+    ulong i;
+    ulong n = 0;
+
+    chunk->bits = malloc((chunk->capacity * nWords + 1) * sizeof(BitWord));
+    if(chunk->bits == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the patterns of a csv chunk\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    for(i = 0; i < chunk->nPats; i++){
+        bits_from_idx(chunk->bits + i * nWords, chunk->idx + n,
+                      chunk->nOnes[i], nWords);
+        n += chunk->nOnes[i];
+    }
+    free(chunk->idx);
+    free(chunk->row);
+    chunk->idx = NULL;
+    chunk->row = NULL;
+    chunk->idxCapacity = 0;
+}
+
+/** Make room for one more pattern in a csv chunk.
+ *
+ * A pattern takes at least 2 * len bytes of the file (its digits, commas and
+ * newline) so the chunk is allocated once for as much patterns as its bytes
+ * can hold, it only grows on invalid lines.
+ *
+ * A chunk starts sparse: it stores the indexes of the 1 of its patterns,
+ * which take a fraction of the packed patterns when the patterns are sparse.
+ * Each time the indexes are full, the chunk is packed if its patterns aren't
+ * sparse enough so far (see pats_sparse_pays()), otherwise the indexes
+ * double. The chunks never hold much more than the patterns set they are
+ * stored into (see chunk_store()).
+ *
+ * @param[in,out] chunk The chunk.
+ * @param[in]     len   The length of the patterns.
+ */
+static void chunk_reserve(CsvChunk *chunk, ulong len){
+    const ulong nWords = nb_words(len);
 
-    while((read = getline(&readline, &len, file)) != -1){
-        if((strlen(readline) < 1) || strcmp(readline, "\n") == 0 ||
-           (readline[0] == '#')){
-            nlines++;
+    if(chunk->bits == NULL && (chunk->idx == NULL ||
+                               chunk->totOnes + len > chunk->idxCapacity)){
+        if(!pats_sparse_pays(chunk->nPats, len, chunk->totOnes)){
+            chunk_pack(chunk, len);
+        }
+        else{
+            chunk->idxCapacity = chunk->idxCapacity > 0 ?
+                2 * chunk->idxCapacity : (chunk->to - chunk->from) /
+                (2 * SPARSE_MIN_BITS_PER_ONE);
+            if(chunk->idxCapacity < chunk->totOnes + len){
+                chunk->idxCapacity = chunk->totOnes + len;
+            }
+            chunk->idx = realloc(chunk->idx, (chunk->idxCapacity + 1) *
+                                             sizeof(uint32_t));
+            if(chunk->row == NULL){
+                chunk->row = malloc((nWords + 1) * sizeof(BitWord));
+            }
+            if(chunk->idx == NULL || chunk->row == NULL){
+                fprintf(stderr, "ERROR: Can't allocate the patterns of a csv "\
+                        "chunk\nExiting...\n");
+                exit(12);
+            }
+        }
+    }
+    if(chunk->nPats < chunk->capacity){
+        return;
+    }
+    if(chunk->capacity > 0){
+        chunk->capacity *= 2;
+    }
+    else{
+        chunk->capacity = (chunk->to - chunk->from) / (len > 0 ? 2 * len : 1)
+                          + 1;
+    }
+    if(chunk->bits != NULL){
+        chunk->bits = realloc(chunk->bits, (chunk->capacity * nWords + 1) *
+                                           sizeof(BitWord));
+    }
+    chunk->nOnes = realloc(chunk->nOnes, chunk->capacity * sizeof(ulong));
+    chunk->classes = realloc(chunk->classes, chunk->capacity * sizeof(ulong));
+    if((chunk->bits == NULL && chunk->idx == NULL) || chunk->nOnes == NULL ||
+       chunk->classes == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the patterns of a csv chunk\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+}
+
+/** Parse the lines of a csv chunk.
+ *
+ * The patterns are stored as the indexes of their 1 or packed (see
+ * chunk_reserve()). The patterns made of 0 only are checked then dropped:
+ * the pattern of the next line overwrites them. The chunk stops at its first error, which is
+ * reported once every chunk is parsed so the first error of the file is the
+ * one reported (see chunks_check()).
+ *
+ * @param[in,out] arg    The csv job (a CsvJob).
+ * @param[in]     iChunk The index of the chunk.
+ */
+static void chunk_parse(void *arg, ulong iChunk){
+    CsvJob *job = arg;
+    CsvChunk *chunk = &job->chunks[iChunk];
+    const ulong nWords = nb_words(job->len);
+    const char *line, *eol, *str, *bad;
+    BitWord *pat;
+    ulong nValues;
+    ulong iClass = 0;
+
+    for(line = chunk->from; line < chunk->to; line = eol + 1){
+        chunk->nLines++;
+        eol = memchr(line, '\n', chunk->to - line);
+        if(eol == NULL){
+            eol = chunk->to;
+        }
+        for(str = line; str < eol && is_blank(*str); str++);
+        if(str == eol || *line == '#'){
+            continue;
+        }
+        if(job->skip){
+            for(; str < eol && *str != ','; str++);
+            iClass = chunk_class(chunk, line, str);
+        }
+        chunk_reserve(chunk, job->len);
+        pat = chunk->bits != NULL ? chunk->bits + chunk->nPats * nWords :
+                                    chunk->row;
+        memset(pat, 0, nWords * sizeof(BitWord));
+        nValues = line_to_pat(pat, &chunk->nOnes[chunk->nPats], &bad, str, eol,
+                              job->len);
+        if(bad != NULL){
+            chunk->error = CSV_BAD_VALUE;
+            chunk->errValues = nValues;
+            chunk->errChar = *bad;
+            return;
+        }
+        if(nValues == 0){
+            vec_pushback(chunk->emptyLines, &chunk->nLines);
+            continue;
+        }
+        if(nValues != job->len){
+            chunk->error = CSV_BAD_LENGTH;
+            chunk->errValues = nValues;
+            return;
+        }
+        if(chunk->nOnes[chunk->nPats] == 0){
+            chunk->nZeros++;
+            continue;
+        }
+        if(chunk->bits == NULL){
+            bits_to_idx(chunk->idx + chunk->totOnes, pat, nWords);
+        }
+        chunk->totOnes += chunk->nOnes[chunk->nPats];
+        chunk->classes[chunk->nPats++] = iClass;
+    }
+}
+
+/** Returns the number of values of the first pattern of a csv file.
+ *
+ * @param[in] str  The content of the file.
+ * @param[in] end  The end of the file.
+ * @param[in] skip Indicate weither the first value of the lines is their
+ *  class.
+ *
+ * @return The number of values, 0 if the file has no pattern.
+ */
+static ulong csv_len(const char *str, const char *end, bool skip){
+    const char *line, *eol, *bad;
+    ulong nValues, nOnes;
+
+    for(line = str; line < end; line = eol + 1){
+        eol = memchr(line, '\n', end - line);
+        if(eol == NULL){
+            eol = end;
+        }
+        for(str = line; str < eol && is_blank(*str); str++);
+        if(str == eol || *line == '#'){
             continue;
         }
-        if(firstLine == false){
-            columns = nb_cols(readline);
-            firstLine = true;
+        if(skip){
+            for(; str < eol && *str != ','; str++);
+        }
+        nValues = line_to_pat(NULL, &nOnes, &bad, str, eol, 0);
+        if(nValues > 0 || bad != NULL){
+            return nValues;
+        }
+    }
+    return 0;
+}
+
+/** Report the skipped lines and the first error of the chunks of a csv file.
+ *
+ * The lines of a chunk are numbered after the lines of the previous chunks.
+ * The program exits on the first error of the file.
+ *
+ * @param[in] job The parsed chunks.
+ */
+static void chunks_check(CsvJob *job){
+    CsvChunk *chunk;
+    ulong iChunk, i, nLine;
+    ulong nLines = 0;
+
+    for(iChunk = 0; iChunk < job->nChunks; iChunk++){
+        chunk = &job->chunks[iChunk];
+        for(i = 0; i < vec_size(chunk->emptyLines); i++){
+            printf("\nline %lu is empty - skipping\n",
+                   nLines + vec_get_as_ulong(chunk->emptyLines, i));
+        }
+        nLine = nLines + chunk->nLines;
+        if(chunk->error == CSV_BAD_VALUE){
+            fprintf(stderr, "\nERROR: value at the line %lu, column %lu "\
+                    "is '%c'. It can only be 1 or 0 (binary patterns)"\
+                    "\nExiting...\n", nLine, job->skip + chunk->errValues + 1,
+                    chunk->errChar);
+            exit(22);
+        }
+        if(chunk->error == CSV_BAD_LENGTH){
+            fprintf(stderr, "\nERROR: line %lu has %lu columns. Previous "\
+                    "lines had %lu columns ...\n\nExiting...\n\n", nLine,
+                    job->skip + chunk->errValues, job->skip + job->len);
+            exit(11);
+        }
+        nLines = nLine;
+    }
+}
+
+/** Split a csv file into chunks of whole lines.
+ *
+ * @param[out] job      The csv job, receiving the chunks.
+ * @param[in]  map      The content of the file.
+ * @param[in]  nThreads The number of threads parsing the chunks.
+ */
+static void chunks_init(CsvJob *job, const FileMap *map, ulong nThreads){
+    const char *end = map->data + map->size;
+    const char *from;
+    ulong iChunk;
+
+    job->nChunks = nThreads > 1 ? nThreads * CSV_CHUNKS_PER_THREAD : 1;
+    if(job->nChunks > map->size / CSV_MIN_CHUNK_BYTES){
+        job->nChunks = map->size / CSV_MIN_CHUNK_BYTES + 1;
+    }
+    job->chunks = calloc(job->nChunks, sizeof(CsvChunk));
+    if(job->chunks == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the csv chunks\nExiting...\n");
+        exit(12);
+    }
+    for(iChunk = 0; iChunk < job->nChunks; iChunk++){
+        // a chunk starts after the end of the line its first byte is in
+        from = map->data + map->size / job->nChunks * iChunk;
+        if(iChunk > 0 && from[-1] != '\n'){
+            from = memchr(from, '\n', end - from);
+            from = from == NULL ? end : from + 1;
+        }
+        if(iChunk > 0 && from < job->chunks[iChunk - 1].from){
+            from = job->chunks[iChunk - 1].from;
+        }
+        job->chunks[iChunk].from = from;
+        if(iChunk > 0){
+            job->chunks[iChunk - 1].to = from;
+        }
+        job->chunks[iChunk].emptyLines = iVector.Create(sizeof(ulong), 1);
+    }
+    job->chunks[job->nChunks - 1].to = end;
+}
+
+/** Free the chunks of a csv file.
+ *
+ * @param[in,out] job The csv job.
+ */
+static void chunks_finalize(CsvJob *job){
+    ulong iChunk;
+
+    for(iChunk = 0; iChunk < job->nChunks; iChunk++){
+        free(job->chunks[iChunk].idx);
+        free(job->chunks[iChunk].row);
+        free(job->chunks[iChunk].bits);
+        free(job->chunks[iChunk].nOnes);
+        free(job->chunks[iChunk].classes);
+        free(job->chunks[iChunk].names);
+        free(job->chunks[iChunk].nameLens);
+        iVector.Finalize(job->chunks[iChunk].emptyLines);
+    }
+    free(job->chunks);
+}
+
+/** Store the patterns of a parsed csv chunk into the patterns set.
+ *
+ * The patterns are copied as they are if the chunk and the set are both
+ * sparse or both packed, otherwise they are packed or unpacked into the set.
+ *
+ * @param[in,out] arg    The csv job (a CsvJob).
+ * @param[in]     iChunk The index of the chunk.
+ */
+static void chunk_store(void *arg, ulong iChunk){
+    CsvJob *job = arg;
+    const CsvChunk *chunk = &job->chunks[iChunk];
+    PatSet *pats = job->pats;
+    ulong i;
+    ulong n = chunk->firstOne;
+
+    if(chunk->nPats == 0){
+        return;
+    }
+    memcpy(pats->nOnes + chunk->first, chunk->nOnes,
+           chunk->nPats * sizeof(ulong));
+    if(pats->idx == NULL && chunk->bits != NULL){
+        memcpy(pat_get(pats, chunk->first), chunk->bits,
+               chunk->nPats * pats->nWords * sizeof(BitWord));
+    }
+    else if(pats->idx == NULL){
+        for(i = 0; i < chunk->nPats; i++){
+            bits_from_idx(pat_get(pats, chunk->first + i),
+                          chunk->idx + n - chunk->firstOne, chunk->nOnes[i],
+                          pats->nWords);
+            n += chunk->nOnes[i];
+        }
+    }
+    else if(chunk->bits != NULL){
+        for(i = 0; i < chunk->nPats; i++){
+            pats->start[chunk->first + i] = n;
+            n += bits_to_idx(pats->idx + n, chunk->bits + i * pats->nWords,
+                             pats->nWords);
+        }
+    }
+    else{
+        memcpy(pats->idx + n, chunk->idx, chunk->totOnes * sizeof(uint32_t));
+        for(i = 0; i < chunk->nPats; i++){
+            pats->start[chunk->first + i] = n;
+            n += chunk->nOnes[i];
         }
-        pat = line_to_pat(readline, skip);
-        patLen = skip + vec_size(pat.val);
+    }
+}
 
-        if(!firstPat){
-            if(lineLen == patLen){
-                iList.Add(lines, &pat);
+/** Read a csv file into a patterns set.
+ *
+ * The file is mapped in memory (see map_file()) and split into chunks of
+ * whole lines parsed by nThreads threads (see chunk_parse()). Each chunk
+ * checks its lines, drops its patterns made of 0 only and stores the others
+ * into its own block along with their number of 1: the indexes of their 1
+ * while they are sparse, so a sparse file never goes through its packed
+ * patterns (see chunk_reserve()). The blocks are then
+ * stored one after the other into the set in the file order, the set being
+ * sparse if the patterns are sparse enough (see pats_sparse_pays()). The
+ * classes of a chunk point in the file, they are interned once merged (see
+ * class_intern()).
+ *
+ * @note Every lines of the csv file must contains the same number of values,
+ *  it is the length of the patterns. The file can contains basic comments:
+ *  each comment lines MUST start with a "#". Moreover a line can be empty, it
+ *  will be ignored.
+ *
+ * @param[out] classes  The vector receiving the class of each pattern, one of
+ *  the strings of 'names' ("" if the lines have no class).
+ * @param[out] names    The vector receiving the distinct classes (strings).
+ * @param[out] nZeros   The number of patterns made of 0 only, which are not
+ *  stored.
+ * @param[in]  name     Path of the csv file.
+ * @param[in]  skip     Indicate weither the first attribute of the csv string
+ *  is the class.
+ * @param[in]  nThreads The number of threads parsing the file.
+ *
+ * @return The patterns, packed or sparse.
+ */
+PatSet *readCsv(Vector *classes, Vector *names, ulong *nZeros,
+                const char *name, bool skip, ulong nThreads){
+    FileMap map;
+    PatSet *pats;
+    CsvJob job;
+    CsvChunk *chunk;
+    ThreadPool *pool = NULL;
+    char **chunkNames;
+    char *class;
+    ulong iChunk, i;
+    ulong nPats = 0;
+    ulong totOnes = 0;
+
+    map_file(&map, name, MADV_SEQUENTIAL);
+    job.skip = skip;
+    job.len = csv_len(map.data, map.data + map.size, skip);
+    chunks_init(&job, &map, nThreads);
+    if(job.nChunks > 1){
+        pool = pool_create(nThreads);
+        pool_run(pool, chunk_parse, &job, job.nChunks);
+    }
+    else{
+        chunk_parse(&job, 0);
+    }
+    chunks_check(&job);
+    *nZeros = 0;
+    for(iChunk = 0; iChunk < job.nChunks; iChunk++){
+        chunk = &job.chunks[iChunk];
+        chunk->first = nPats;
+        chunk->firstOne = totOnes;
+        nPats += chunk->nPats;
+        totOnes += chunk->totOnes;
+        *nZeros += chunk->nZeros;
+    }
+    if(nPats > 0 && pats_sparse_pays(nPats, job.len, totOnes)){
+        pats = pats_create_sparse(nPats, job.len, totOnes);
+    }
+    else{
+        pats = pats_create(nPats > 0 ? nPats : 1, job.len);
+        pats_truncate(pats, nPats);
+    }
+    job.pats = pats;
+    if(pool != NULL){
+        pool_run(pool, chunk_store, &job, job.nChunks);
+        pool_finalize(pool);
+    }
+    else{
+        chunk_store(&job, 0);
+    }
+    iVector.Reserve(classes, nPats + 1);
+    class = skip ? NULL : class_intern(names, "", "");
+    for(iChunk = 0; iChunk < job.nChunks; iChunk++){
+        chunk = &job.chunks[iChunk];
+        chunkNames = malloc((chunk->nNames + 1) * sizeof(char *));
+        if(chunkNames == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the classes\n"\
+                    "Exiting...\n");
+            exit(12);
+        }
+        for(i = 0; i < chunk->nNames; i++){
+            chunkNames[i] = class_intern(names, chunk->names[i],
+                                         chunk->names[i] + chunk->nameLens[i]);
+        }
+        for(i = 0; i < chunk->nPats; i++){
+            if(skip){
+                class = chunkNames[chunk->classes[i]];
             }
-            else if(patLen > 0){
-                fprintf(stderr, "\nERROR: line %lu has %lu columns. Previous "\
-                        "lines had %lu columns ...\n\nExiting...\n\n",
-                        nlines, patLen, lineLen);
-                exit(11);
+            vec_pushback(classes, &class);
+        }
+        free(chunkNames);
+    }
+    chunks_finalize(&job);
+    unmap_file(&map);
+    return pats;
+}
+
+/** Store the values of a line of a categorical csv file.
+ *
+ * The blanks around the values are ignored.
+ *
+ * @param[out]    row   The rank of the value of each encoded column (see
+ *  vocab_find()), RANK_UNKNOWN if it isn't in the vocabulary.
+ * @param[out]    class The class of the line, interned in 'names' (unchanged
+ *  if the lines have no class).
+ * @param[in,out] vocab The vocabulary.
+ * @param[in,out] names The distinct classes.
+ * @param[in]     str   The line.
+ * @param[in]     eol   The end of the line.
+ *
+ * @return The number of values of the line which aren't in the vocabulary
+ *  (it is frozen).
+ */
+static ulong line_to_ranks(uint32_t *row, char **class, Vocab *vocab,
+                           Vector *names, const char *str, const char *eol){
+    const char *end, *from, *to;
+    ulong field, rank;
+    ulong col = 0;
+    ulong nUnknown = 0;
+
+    for(field = 0; field < vocab->nFields; field++, str = end + 1){
+        end = memchr(str, ',', eol - str);
+        if(end == NULL){
+            end = eol;
+        }
+        if(field == vocab->classIdx){
+            *class = class_intern(names, str, end);
+            continue;
+        }
+        for(from = str; from < end && is_blank(*from); from++);
+        for(to = end; to > from && is_blank(to[-1]); to--);
+        rank = vocab_find(vocab, col, from, to - from);
+        row[col] = rank == NOT_FOUND ? RANK_UNKNOWN : (uint32_t)rank;
+        nUnknown += rank == NOT_FOUND;
+        col++;
+    }
+    return nUnknown;
+}
+
+/** Read a categorical csv file into a patterns set, one-hot encoded.
+ *
+ * Each column but the class one is encoded by as many bits as it has
+ * distinct values: a pattern has one bit set per column, the one of its
+ * value (see Vocab). The file is read in a single pass, the values being
+ * replaced by their 32 bits rank in the vocabulary (the bit of a value is
+ * only known once the values of the columns before it are), then the
+ * patterns are built straight from the ranks.
+ *
+ * The training file builds the vocabulary, which is then frozen: the values
+ * of the testing file are only looked up so the patterns are encoded the
+ * same way. A value which isn't in the vocabulary leaves the bits of its
+ * column to 0, the patterns made of 0 only are dropped.
+ *
+ * @note Every lines of the csv file must contains the same number of values.
+ *  The comments lines (starting with a "#") and the empty lines are ignored.
+ *
+ * @param[out]    classes The vector receiving the class of each pattern, one
+ *  of the strings of 'names' ("" if the lines have no class).
+ * @param[out]    names   The vector receiving the distinct classes (strings).
+ * @param[out]    nZeros  The number of patterns made of 0 only, which are not
+ *  stored.
+ * @param[in,out] vocab   The vocabulary, frozen once the file is read.
+ * @param[in]     name    Path of the csv file.
+ *
+ * @return The patterns, packed or sparse if they are sparse enough (see
+ *  pats_sparse_pays()).
+ */
+PatSet *readCategorical(Vector *classes, Vector *names, ulong *nZeros,
+                        Vocab *vocab, const char *name){
+    FileMap map;
+    PatSet *pats;
+    const char *line, *eol, *str, *end;
+    uint32_t *ranks = NULL;     // Rank of the values of every lines
+    char **lineClasses = NULL;  // Class of every lines
+    char *class = NULL;
+    uint32_t *row;
+    ulong iRow, col, n, nFields, len;
+    ulong nLines = 0;
+    ulong nRows = 0;
+    ulong capacity = 0;
+    ulong nUnknown = 0;
+    ulong nPats = 0;
+    ulong totOnes = 0;
+    ulong nIdx = 0;
+
+    map_file(&map, name, MADV_SEQUENTIAL);
+    if(vocab->classCol == 0){
+        class = class_intern(names, "", "");
+    }
+    end = map.data + map.size;
+    for(line = map.data; line < end; line = eol + 1){
+        nLines++;
+        eol = memchr(line, '\n', end - line);
+        if(eol == NULL){
+            eol = end;
+        }
+        for(str = line; str < eol && is_blank(*str); str++);
+        if(str == eol || *line == '#'){
+            continue;
+        }
+        for(nFields = 1; (str = memchr(str, ',', eol - str)) != NULL; str++){
+            nFields++;
+        }
+        if(vocab->nFields == 0){
+            vocab_set_fields(vocab, nFields, name);
+        }
+        if(nFields != vocab->nFields){
+            fprintf(stderr, "\nERROR: line %lu has %lu columns. Previous "\
+                    "lines had %lu columns ...\n\nExiting...\n\n", nLines,
+                    nFields, vocab->nFields);
+            exit(11);
+        }
+        if(nRows == capacity){
+            capacity = capacity > 0 ? 2 * capacity : VOCAB_START_CAPACITY;
+            ranks = realloc(ranks, capacity * (vocab->nCols + 1) *
+                                   sizeof(uint32_t));
+            lineClasses = realloc(lineClasses, capacity * sizeof(char *));
+            if(ranks == NULL || lineClasses == NULL){
+                fprintf(stderr, "\nFAIL\nERROR: Can't allocate the lines of "\
+                        "file \"%s\"\nExiting...\n", name);
+                exit(12);
+            }
+        }
+        nUnknown += line_to_ranks(ranks + nRows * vocab->nCols, &class, vocab,
+                                  names, line, eol);
+        lineClasses[nRows++] = class;
+    }
+    unmap_file(&map);
+    if(nUnknown > 0){
+        printf("\nWARNING: %lu values aren't in the training vocabulary, "\
+               "their columns are left to 0\n", nUnknown);
+    }
+    if(!vocab->frozen && vocab->nFields > 0){
+        vocab_freeze(vocab);
+    }
+    len = vocab->frozen ? vocab->start[vocab->nCols] : 0;
+    *nZeros = 0;
+    for(iRow = 0; iRow < nRows; iRow++){
+        row = ranks + iRow * vocab->nCols;
+        for(col = 0, n = 0; col < vocab->nCols; col++){
+            n += row[col] != RANK_UNKNOWN;
+        }
+        nPats += n > 0;
+        *nZeros += n == 0;
+        totOnes += n;
+    }
+    if(nPats > 0 && pats_sparse_pays(nPats, len, totOnes)){
+        pats = pats_create_sparse(nPats, len, totOnes);
+    }
+    else{
+        pats = pats_create(nPats > 0 ? nPats : 1, len);
+        pats_truncate(pats, nPats);
+    }
+    iVector.Reserve(classes, nPats + 1);
+    for(iRow = 0, nPats = 0; iRow < nRows; iRow++){
+        row = ranks + iRow * vocab->nCols;
+        for(col = 0, n = 0; col < vocab->nCols; col++){
+            n += row[col] != RANK_UNKNOWN;
+        }
+        if(n == 0){
+            continue;
+        }
+        if(pats->idx != NULL){
+            pats->start[nPats] = nIdx;
+        }
+        for(col = 0; col < vocab->nCols; col++){
+            if(row[col] == RANK_UNKNOWN){
+                continue;
+            }
+            if(pats->idx != NULL){
+                pats->idx[nIdx++] = (uint32_t)(vocab->start[col] + row[col]);
             }
             else{
-                printf("\nline %lu is empty - skipping\n", nlines);
+                bit_set(pat_get(pats, nPats), vocab->start[col] + row[col]);
             }
         }
-        else{
-            firstPat = false;
-            lineLen = patLen;
-            iList.Add(lines, &pat);
+        pats->nOnes[nPats++] = n;
+        vec_pushback(classes, &lineClasses[iRow]);
+    }
+    if(pats->idx != NULL){
+        pats->start[nPats] = nIdx;
+    }
+    free(ranks);
+    free(lineClasses);
+    return pats;
+}
+
+/** Round a size up to the alignment of the sections of a binary dataset.
+ *
+ * @param[in] size The size in bytes.
+ *
+ * @return The size rounded up to a multiple of BIN_ALIGN.
+ */
+static uint64_t bin_align(uint64_t size){
+    return (size + BIN_ALIGN - 1) / BIN_ALIGN * BIN_ALIGN;
+}
+
+/** Add bytes of a binary dataset to its checksum.
+ *
+ * The bytes are read 64 bits at once, each word is mixed in with the FNV-1a
+ * prime: the sections are padded to BIN_ALIGN bytes so they are made of
+ * whole words.
+ *
+ * @param[in] hash The checksum of the previous bytes.
+ * @param[in] data The bytes.
+ * @param[in] size The number of bytes, a multiple of 8.
+ *
+ * @return The checksum of the previous bytes and of 'data'.
+ */
+static uint64_t bin_checksum(uint64_t hash, const char *data, uint64_t size){
+    uint64_t word;
+    uint64_t i;
+
+    for(i = 0; i + sizeof(word) <= size; i += sizeof(word)){
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+/** Write a section of a binary dataset, padded to BIN_ALIGN bytes.
+ *
+ * @param[in]     out  The binary dataset.
+ * @param[in]     data The section.
+ * @param[in]     size The size of the section in bytes.
+ * @param[in,out] hash The checksum of the previous sections, updated.
+ */
+static void bin_write(FILE *out, const void *data, uint64_t size,
+                      uint64_t *hash){
+    const uint64_t whole = size / sizeof(uint64_t) * sizeof(uint64_t);
+    char tail[BIN_ALIGN] = {0};
+
+    if(size == 0){
+        return;
+    }
+    // the last partial word and the padding are checksummed together
+    memcpy(tail, (const char *)data + whole, size - whole);
+    fwrite(data, 1, whole, out);
+    fwrite(tail, 1, bin_align(size) - whole, out);
+    *hash = bin_checksum(*hash, data, whole);
+    *hash = bin_checksum(*hash, tail, bin_align(size) - whole);
+}
+
+/** Compare the first pointer of two pairs of pointers for qsort().
+ *
+ * @param[in] elem1 The first pair.
+ * @param[in] elem2 The second pair.
+ *
+ * @return A negative, null or positive value if the first pointer of elem1
+ *  is lower than, equal to or greater than the one of elem2.
+ */
+static int cmp_ptr_pair(const void *elem1, const void *elem2){
+    uintptr_t a = *(const uintptr_t *)elem1;
+    uintptr_t b = *(const uintptr_t *)elem2;
+
+    return (a > b) - (a < b);
+}
+
+/** Returns the index in 'names' of the class of each pattern.
+ *
+ * The classes are interned: each class is one of the strings of 'names', so
+ * it is looked up by its address.
+ *
+ * @param[in] classes The class of each pattern.
+ * @param[in] names   The distinct classes.
+ *
+ * @return The index of the class of each pattern (to free).
+ */
+static uint32_t *class_ids(Vector *classes, Vector *names){
+    const ulong nNames = vec_size(names);
+    uintptr_t *pairs = malloc((2 * nNames + 1) * sizeof(uintptr_t));
+    uint32_t *ids = malloc((vec_size(classes) + 1) * sizeof(uint32_t));
+    uintptr_t *pair;
+    uintptr_t key;
+    ulong i;
+
+    if(pairs == NULL || ids == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the classes of the binary "\
+                "dataset\nExiting...\n");
+        exit(12);
+    }
+    for(i = 0; i < nNames; i++){
+        pairs[2 * i] = (uintptr_t)vec_get_as_str(names, i);
+        pairs[2 * i + 1] = i;
+    }
+    qsort(pairs, nNames, 2 * sizeof(uintptr_t), cmp_ptr_pair);
+    for(i = 0; i < vec_size(classes); i++){
+        key = (uintptr_t)vec_get_as_str(classes, i);
+        pair = bsearch(&key, pairs, nNames, 2 * sizeof(uintptr_t),
+                       cmp_ptr_pair);
+        ids[i] = (uint32_t)pair[1];
+    }
+    free(pairs);
+    return ids;
+}
+
+/** Write a patterns set into a binary dataset.
+ *
+ * The dataset is made of a header (see BinHeader) followed by the arrays of
+ * the set as they are in memory, each one starting on BIN_ALIGN bytes, so
+ * readBin() maps them back without any parsing. The set is stored packed or
+ * sparse, as it is. The classes are stored once, each pattern refers to its
+ * class by its index.
+ *
+ * @param[in] name    Path of the binary dataset.
+ * @param[in] pats    The patterns set.
+ * @param[in] classes The class of each pattern, one of the strings of
+ *  'names'.
+ * @param[in] names   The distinct classes.
+ * @param[in] nZeros  The number of patterns made of 0 only dropped from the
+ *  csv file, reported when the dataset is read.
+ */
+void writeBin(const char *name, const PatSet *pats, Vector *classes,
+              Vector *names, ulong nZeros){
+    BinHeader head;
+    FILE *out;
+    uint32_t *ids;
+    char *namesData;
+    ulong iPat, iName;
+    uint64_t namesSize = 0;
+    uint64_t hash = BIN_CHECKSUM_SEED;
+
+    memset(&head, 0, sizeof(head));
+    strcpy(head.magic, BIN_MAGIC);
+    head.version = BIN_VERSION;
+    head.sparse = pats->idx != NULL;
+    head.nPats = pats->nPats;
+    head.len = pats->len;
+    head.nZeros = nZeros;
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        head.totOnes += pats->nOnes[iPat];
+    }
+    if(pats->nPats > 0 && pats->len > 0){
+        head.density = head.totOnes / ((double)pats->nPats * pats->len);
+    }
+    head.nNames = vec_size(names);
+    head.bitsOff = bin_align(sizeof(head));
+    if(head.sparse){
+        head.startOff = bin_align(head.bitsOff +
+                                  head.totOnes * sizeof(uint32_t));
+        head.nOnesOff = bin_align(head.startOff +
+                                  (pats->nPats + 1) * sizeof(ulong));
+    }
+    else{
+        head.nOnesOff = bin_align(head.bitsOff + pats->nPats * pats->nWords *
+                                                 sizeof(BitWord));
+    }
+    head.classesOff = bin_align(head.nOnesOff + pats->nPats * sizeof(ulong));
+    head.namesOff = bin_align(head.classesOff +
+                              pats->nPats * sizeof(uint32_t));
+    for(iName = 0; iName < head.nNames; iName++){
+        namesSize += strlen(vec_get_as_str(names, iName)) + 1;
+    }
+    head.size = bin_align(head.namesOff + namesSize);
+    namesData = malloc(namesSize + 1);
+    if(namesData == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the classes of the binary "\
+                "dataset\nExiting...\n");
+        exit(12);
+    }
+    for(iName = 0, namesSize = 0; iName < head.nNames; iName++){
+        strcpy(namesData + namesSize, vec_get_as_str(names, iName));
+        namesSize += strlen(namesData + namesSize) + 1;
+    }
+    ids = class_ids(classes, names);
+    openFile(&out, name, "wb");
+    // the header isn't checksummed, it is written again once the sum is known
+    bin_write(out, &head, sizeof(head), &hash);
+    hash = BIN_CHECKSUM_SEED;
+    if(head.sparse){
+        bin_write(out, pats->idx, head.totOnes * sizeof(uint32_t), &hash);
+        bin_write(out, pats->start, (pats->nPats + 1) * sizeof(ulong), &hash);
+    }
+    else{
+        bin_write(out, pats->bits, pats->nPats * pats->nWords *
+                                   sizeof(BitWord), &hash);
+    }
+    bin_write(out, pats->nOnes, pats->nPats * sizeof(ulong), &hash);
+    bin_write(out, ids, pats->nPats * sizeof(uint32_t), &hash);
+    bin_write(out, namesData, namesSize, &hash);
+    head.checksum = hash;
+    rewind(out);
+    fwrite(&head, sizeof(head), 1, out);
+    if(ferror(out) || fclose(out) != 0){
+        fprintf(stderr, "ERROR: Can't write file \"%s\"\nExiting...\n", name);
+        exit(10);
+    }
+    free(ids);
+    free(namesData);
+}
+
+/** Tell if a file is a binary dataset (see writeBin()).
+ *
+ * @param[in] name Path of the file.
+ *
+ * @return true if the file starts with BIN_MAGIC.
+ */
+bool isBinFile(const char *name){
+    char magic[sizeof(BIN_MAGIC)];
+    FILE *in = fopen(name, "rb");
+    bool res;
+
+    if(in == NULL){
+        return false;
+    }
+    res = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+          memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0;
+    fclose(in);
+    return res;
+}
+
+/** Report an invalid binary dataset and exit.
+ *
+ * @param[in] name Path of the binary dataset.
+ * @param[in] what What is wrong with it.
+ */
+static void bin_fail(const char *name, const char *what){
+    fprintf(stderr, "\nFAIL\nERROR: \"%s\" is not a valid binary dataset: "\
+            "%s\nExiting...\n", name, what);
+    exit(10);
+}
+
+/** Tell if a section of a binary dataset fits before the next one.
+ *
+ * @param[in] off   The offset of the section.
+ * @param[in] count The number of elements of the section.
+ * @param[in] size  The size of an element.
+ * @param[in] next  The offset of the next section.
+ *
+ * @return true if the section starts on BIN_ALIGN bytes and ends before
+ *  'next'.
+ */
+static bool bin_fits(uint64_t off, uint64_t count, uint64_t size,
+                     uint64_t next){
+    return off % BIN_ALIGN == 0 && off <= next && count <= (next - off) / size;
+}
+
+/** Check the header of a mapped binary dataset and, optionally, its checksum.
+ *
+ * The header and the class names are always checked, they only take the
+ * first and the last pages of the dataset. The checksum reads every page of
+ * the patterns, so it is only verified on request (see verifyBin()).
+ *
+ * The program exits if the dataset is invalid.
+ *
+ * @param[out] head     The header of the dataset.
+ * @param[in]  map      The content of the dataset.
+ * @param[in]  name     Path of the dataset, for the messages.
+ * @param[in]  checksum Indicate weither the checksum is verified.
+ */
+static void bin_check(BinHeader *head, const FileMap *map, const char *name,
+                      bool checksum){
+    const char *str;
+    uint64_t nWords, nNames;
+    bool ok;
+
+    if(map->size < bin_align(sizeof(*head))){
+        bin_fail(name, "truncated header");
+    }
+    memcpy(head, map->data, sizeof(*head));
+    if(head->version != BIN_VERSION){
+        fprintf(stderr, "\nFAIL\nERROR: \"%s\" is a version %u binary "\
+                "dataset, only version %d is supported\nExiting...\n", name,
+                head->version, BIN_VERSION);
+        exit(10);
+    }
+    if(sizeof(ulong) != sizeof(uint64_t)){
+        bin_fail(name, "the binary datasets need 64 bits integers");
+    }
+    nWords = nb_words(head->len);
+    ok = head->size == map->size &&
+         head->bitsOff >= bin_align(sizeof(*head)) &&
+         bin_fits(head->nOnesOff, head->nPats, sizeof(ulong),
+                  head->classesOff) &&
+         bin_fits(head->classesOff, head->nPats, sizeof(uint32_t),
+                  head->namesOff) &&
+         bin_fits(head->namesOff, 0, 1, head->size);
+    if(head->sparse){
+        ok = ok && head->len - 1 <= UINT32_MAX &&
+             bin_fits(head->bitsOff, head->totOnes, sizeof(uint32_t),
+                      head->startOff) &&
+             bin_fits(head->startOff, head->nPats + 1, sizeof(ulong),
+                      head->nOnesOff);
+    }
+    else{
+        ok = ok && (nWords == 0 ||
+                    bin_fits(head->bitsOff, head->nPats,
+                             nWords * sizeof(BitWord), head->nOnesOff));
+    }
+    if(!ok){
+        bin_fail(name, "bad sections");
+    }
+    if(checksum && bin_checksum(BIN_CHECKSUM_SEED, map->data + head->bitsOff,
+                                head->size - head->bitsOff) != head->checksum){
+        bin_fail(name, "bad checksum");
+    }
+    str = map->data + head->namesOff;
+    for(nNames = 0; nNames < head->nNames; nNames++){
+        str = memchr(str, '\0', map->data + map->size - str);
+        if(str++ == NULL){
+            bin_fail(name, "bad classes");
         }
-        nlines++;
-        if(nlines == ULONG_MAX){
-            fprintf(stderr, "ERROR: The input file contains too much lines");
-            exit(5);
+    }
+}
+
+/** Check the counts of 1 and the indices of a mapped binary dataset.
+ *
+ * The training trusts them to stay in the bounds of its arrays, so a
+ * corrupted dataset is rejected here rather than read out of bounds. The
+ * numbers of 1 are checked against the length and, in a sparse dataset,
+ * against the ranges of 1 indices, which must be increasing and lower than
+ * the length. The words of a packed dataset aren't read.
+ *
+ * The program exits if the dataset is invalid.
+ *
+ * @param[in] head The header of the dataset, checked by bin_check().
+ * @param[in] map  The content of the dataset.
+ * @param[in] name Path of the dataset, for the messages.
+ */
+static void bin_check_pats(const BinHeader *head, const FileMap *map,
+                           const char *name){
+    const ulong *nOnes = (const ulong *)(map->data + head->nOnesOff);
+    const ulong *start = (const ulong *)(map->data + head->startOff);
+    const uint32_t *idx = (const uint32_t *)(map->data + head->bitsOff);
+    ulong iPat, i;
+
+    if(head->sparse && (start[0] != 0 || start[head->nPats] != head->totOnes)){
+        bin_fail(name, "bad patterns");
+    }
+    for(iPat = 0; iPat < head->nPats; iPat++){
+        if(nOnes[iPat] > head->len){
+            bin_fail(name, "bad patterns");
+        }
+        if(!head->sparse){
+            continue;
+        }
+        if(start[iPat + 1] < start[iPat] ||
+           start[iPat + 1] - start[iPat] != nOnes[iPat]){
+            bin_fail(name, "bad patterns");
+        }
+        for(i = start[iPat]; i < start[iPat + 1]; i++){
+            if(idx[i] >= head->len ||
+               (i > start[iPat] && idx[i] <= idx[i - 1])){
+                bin_fail(name, "bad patterns");
+            }
         }
     }
-    *plen = columns - skip;
-    free(readline);
 }
 
-/** Write a pattern (a vector of 0 and 1) on the given file.
+/** Verify the checksum of a binary dataset written by writeBin().
+ *
+ * readBin() doesn't verify the checksum of a dataset, this reads all of it.
+ * The program exits if the dataset is invalid.
+ *
+ * @param[in] name Path of the binary dataset.
+ */
+void verifyBin(const char *name){
+    FileMap map;
+    BinHeader head;
+
+    map_file(&map, name, MADV_SEQUENTIAL);
+    bin_check(&head, &map, name, true);
+    bin_check_pats(&head, &map, name);
+    unmap_file(&map);
+}
+
+/** Read a binary dataset written by writeBin().
+ *
+ * The dataset is mapped in memory and the patterns set points straight into
+ * it. Only its header, its classes, its counts of 1 and, if it is sparse, its
+ * indices are read here (see bin_check_pats()): its checksum isn't verified
+ * (see verifyBin()), so the words of a packed dataset are read by the kernel
+ * in the background and as the patterns are used. The mapping is
+ * copy-on-write, so the noise can be added to the patterns without modifying
+ * the file. The kernel is told every page will be needed and, with
+ * BIN_HUGE_PAGES, to back the mapping with huge pages when it can.
+ *
+ * @param[out] classes The vector receiving the class of each pattern, one of
+ *  the strings of 'names'.
+ * @param[out] names   The vector receiving the distinct classes (strings).
+ * @param[out] nZeros  The number of patterns made of 0 only dropped from the
+ *  csv file.
+ * @param[in]  name    Path of the binary dataset.
+ *
+ * @return The patterns, packed or sparse as they were written.
+ */
+PatSet *readBin(Vector *classes, Vector *names, ulong *nZeros,
+                const char *name){
+    FileMap *map = malloc(sizeof(*map));
+    PatSet *pats = malloc(sizeof(*pats));
+    BinHeader head;
+    const uint32_t *ids;
+    const char *str;
+    char **namesPtr;
+    ulong iPat, iName;
+
+    if(map == NULL || pats == NULL){
+        fprintf(stderr, "\nFAIL\nERROR: Can't allocate the patterns of file "\
+                "\"%s\"\nExiting...\n", name);
+        exit(12);
+    }
+    map_file(map, name, MADV_WILLNEED);
+#if BIN_HUGE_PAGES && defined(MADV_HUGEPAGE)
+    if(map->mapped){
+        madvise(map->data, map->size, MADV_HUGEPAGE);
+    }
+#endif
+    bin_check(&head, map, name, false);
+    bin_check_pats(&head, map, name);
+    pats->nPats = head.nPats;
+    pats->len = head.len;
+    pats->nWords = nb_words(head.len);
+    pats->bits = NULL;
+    pats->idx = NULL;
+    pats->start = NULL;
+    if(head.sparse){
+        pats->idx = (uint32_t *)(map->data + head.bitsOff);
+        pats->start = (ulong *)(map->data + head.startOff);
+    }
+    else{
+        pats->bits = (BitWord *)(map->data + head.bitsOff);
+    }
+    pats->nOnes = (ulong *)(map->data + head.nOnesOff);
+    pats->map = map;
+    *nZeros = head.nZeros;
+    namesPtr = malloc((head.nNames + 1) * sizeof(char *));
+    if(namesPtr == NULL){
+        fprintf(stderr, "\nFAIL\nERROR: Can't allocate the classes of file "\
+                "\"%s\"\nExiting...\n", name);
+        exit(12);
+    }
+    for(iName = 0, str = map->data + head.namesOff; iName < head.nNames;
+        iName++){
+        namesPtr[iName] = class_intern(names, str, str + strlen(str));
+        str += strlen(str) + 1;
+    }
+    ids = (const uint32_t *)(map->data + head.classesOff);
+    iVector.Reserve(classes, head.nPats + 1);
+    for(iPat = 0; iPat < head.nPats; iPat++){
+        if(ids[iPat] >= head.nNames){
+            bin_fail(name, "bad class index");
+        }
+        vec_pushback(classes, &namesPtr[ids[iPat]]);
+    }
+    free(namesPtr);
+    return pats;
+}
+
+/** Write a packed pattern as 0 and 1 on the given file.
  *
  * @param[in] out The output file where the pattern will be written.
- * @param[in] pat The pattern to write.
+ * @param[in] pat The packed pattern to write.
+ * @param[in] len The length of the pattern (its number of bits).
+ */
+static void write_pattern(FILE *out, const BitWord *pat, ulong len){
+    ulong i;
+
+    if(len < 1){
+        printf("WARNING: pattern is empty: nothing to print\n");
+        return;
+    }
+    for(i = 0; i < len - 1; i++){
+        fprintf(out, "%i,", bit_get(pat, i));
+    }
+    fprintf(out, "%i", bit_get(pat, i));
+    fprintf(out, "\n");
+}
+
+/** Write a pattern of a patterns set as 0 and 1 on the given file.
+ *
+ * Same output as write_pattern() whether the set is packed or sparse.
+ *
+ * @param[in] out  The output file where the pattern will be written.
+ * @param[in] pats The patterns set.
+ * @param[in] iPat The index of the pattern to write.
  */
-static void write_vector(FILE *out, Vector *pat){
+static void write_set_pattern(FILE *out, PatSet *pats, ulong iPat){
     ulong i;
+    ulong iOne = 0;
+    const uint32_t *idx;
 
-    if(vec_size(pat) < 1){
+    if(pats->idx == NULL){
+        write_pattern(out, pat_get(pats, iPat), pats->len);
+        return;
+    }
+    if(pats->len < 1){
         printf("WARNING: pattern is empty: nothing to print\n");
         return;
     }
-    for(i = 0; i < vec_size(pat) - 1; i++){
-        fprintf(out, "%i,", vec_get_as_char(pat, i));
+    idx = pat_idx(pats, iPat);
+    for(i = 0; i < pats->len; i++){
+        if(iOne < pats->nOnes[iPat] && idx[iOne] == i){
+            iOne++;
+            fprintf(out, i < pats->len - 1 ? "1," : "1");
+        }
+        else{
+            fprintf(out, i < pats->len - 1 ? "0," : "0");
+        }
     }
-    fprintf(out, "%i", vec_get_as_char(pat, i));
     fprintf(out, "\n");
 }
 
@@ -346,16 +2011,16 @@ static void write_vector(FILE *out, Vector *pat){
  *  wwritten.
  * @param[in] clusts The network clusters.
  */
-static void write_clusts_pat_sets(FILE *out, Vector *clusts){
+static void write_clusts_pat_sets(FILE *out, ClustStore *clusts){
     Vector *patSet;
     ulong iClust, iPatSet;
     
     fprintf(out, "---------------------------------------\n");
     fprintf(out, "------- CLUSTERS'S PATTERNS SETS ------\n");
     fprintf(out, "---------------------------------------\n");
-    for(iClust = 0; iClust < vec_size(clusts); iClust++){
+    for(iClust = 0; iClust < clusts->size; iClust++){
         fprintf(out, "Cluster %4lu: ", iClust);
-        patSet = get_pat_set(vec_get_as_clust(clusts, iClust));
+        patSet = clust_pat_set(clusts, iClust);
         for(iPatSet = 0; iPatSet < vec_size(patSet) - 1; iPatSet++){
             fprintf(out, "%lu, ", vec_get_as_ulong(patSet, iPatSet)); 
         }
@@ -393,7 +2058,7 @@ static void write_clusts_pat_sets(FILE *out, Vector *clusts){
  * @param[in] patsClass    The network training patterns classes.
  */
 static void write_clusts_classes(Vector **clustsClass, FILE *out,
-                                 Vector *clusts, Vector *patsClass){
+                                 ClustStore *clusts, Vector *patsClass){
     Vector *patSet;         // Vector of ulong
     ulong iClust, iPatSet;
     char *c;
@@ -459,13 +2124,13 @@ static void write_clusts_classes(Vector **clustsClass, FILE *out,
     fprintf(out, "------\n");
 
     // Fill the clustsClass vector with anything so you can replace the elements
-    for(iClust = 0; iClust < vec_size(clusts); iClust++){
+    for(iClust = 0; iClust < clusts->size; iClust++){
         vec_pushback(*clustsClass, &dummy);
     }
 
     // Determine the clusters's classes
-    for(iClust = 0; iClust < vec_size(clusts); iClust++){
-        patSet = get_pat_set(vec_get_as_clust(clusts, iClust));
+    for(iClust = 0; iClust < clusts->size; iClust++){
+        patSet = clust_pat_set(clusts, iClust);
         // Set every index of the classesRep (1 index = 1 unique class) to 0
         for(i = 0; i < noUniqueClasses; i++){
             classesRep[i] = 0;
@@ -520,19 +2185,28 @@ static void write_clusts_classes(Vector **clustsClass, FILE *out,
  * @param[in] patsClass   The network training patterns classes.
  * @param[in] clustsClass The network clusters classes.
  */
-static void write_ratio(FILE *out, Vector *pats,  Vector *clusts,
+static void write_ratio(FILE *out, PatSet *pats,  ClustStore *clusts,
                         Vector *patsClass, Vector *clustsClass){
     ulong success = 0;
     ulong fail = 0;
-    ulong iPat;
+    ulong iPat, iClust, i;
     char *class;
+    Vector *patSet;     // Vector of ulongs
+    ulong *patClust = malloc(pats->nPats * sizeof(ulong));
 
+    // Cluster of each pattern, from the clusters's patterns sets
+    for(iClust = 0; iClust < clusts->size; iClust++){
+        patSet = clust_pat_set(clusts, iClust);
+        for(i = 0; i < vec_size(patSet); i++){
+            patClust[vec_get_as_ulong(patSet, i)] = iClust;
+        }
+    }
     fprintf(out, "\n---------------------------------------\n");
     fprintf(out, "--------- SUCCESS / FAIL RATIO --------\n");
     fprintf(out, "---------------------------------------\n");
-    for(iPat = 0; iPat < vec_size(pats); iPat++){
+    for(iPat = 0; iPat < pats->nPats; iPat++){
         class = vec_get_as_str(patsClass, iPat);
-        if(strcmp(vec_get_as_str(clustsClass, pat_in_clust_set(clusts, iPat)), class) == 0){
+        if(strcmp(vec_get_as_str(clustsClass, patClust[iPat]), class) == 0){
             success++;
         }
         else{
@@ -544,6 +2218,7 @@ static void write_ratio(FILE *out, Vector *pats,  Vector *clusts,
     fprintf(out, "FAIL: %lu (%g%%)\n",
             fail, fail * 100 / (float)(success + fail));
     fprintf(out, "RATIO: %g\n\n", success / (float)fail);
+    free(patClust);
 }
 
 /** Write the prototype of every clusters in the given file.
@@ -552,9 +2227,10 @@ static void write_ratio(FILE *out, Vector *pats,  Vector *clusts,
  * @param[in] par     The network parameters.
  * @param[in] clusts  The network clusters.
  * @param[in] nClusts Number of network clusters.
+ * @param[in] len     The length of the prototypes.
  */
-static void write_clusts_prototypes(FILE *out, InParam par, Vector *clusts, 
-                                    ulong nClusts){
+static void write_clusts_prototypes(FILE *out, InParam par, ClustStore *clusts,
+                                    ulong nClusts, ulong len){
     ulong i;
 
     fprintf(out, "\n---------------------------------\n");
@@ -571,7 +2247,7 @@ static void write_clusts_prototypes(FILE *out, InParam par, Vector *clusts,
     }
 	for(i = 0; i < nClusts; i++){
         fprintf(out, "Clust %lu prototype:\n", i);
-        write_vector(out, get_prot(vec_get_as_clust(clusts, i)));
+        write_pattern(out, clust_prot(clusts, i), len);
         fprintf(out, "\n");
 	}
 }
@@ -583,7 +2259,7 @@ static void write_clusts_prototypes(FILE *out, InParam par, Vector *clusts,
  * @param[in] clusts  The network clusters.
  * @param[in] nClusts Number of network clusters.
  */
-static void write_cluster_files(InParam par, Vector *pats, Vector *clusts,
+static void write_cluster_files(InParam par, PatSet *pats, ClustStore *clusts,
                                 ulong nClusts){
     ulong i, j;
 
@@ -596,11 +2272,11 @@ static void write_cluster_files(InParam par, Vector *pats, Vector *clusts,
             break;
         }
         fprintf(of, "# prototype:\n");
-        write_vector(of, get_prot(vec_get_as_clust(clusts, i)));
+        write_pattern(of, clust_prot(clusts, i), pats->len);
         fprintf(of, "\n# patterns:\n");
-		for(j = 0; j < vec_size(get_pat_set(vec_get_as_clust(clusts, i))); j++){
-            write_vector(of, vec_get_as_vec(pats, vec_get_as_ulong(get_pat_set(
-                vec_get_as_clust(clusts, i)), j)));
+		for(j = 0; j < vec_size(clust_pat_set(clusts, i)); j++){
+            write_set_pattern(of, pats,
+                              vec_get_as_ulong(clust_pat_set(clusts, i), j));
 		}
 		fclose(of);
 	}
@@ -628,9 +2304,9 @@ static void write_cluster_files(InParam par, Vector *pats, Vector *clusts,
  * @param[in] patsClass The network training patterns classes.
  */
 void write_train_results(Vector **clustsClasses, InParam par, ulong emptyPats,
-                         float fluc, Vector *pats, ulong nPats, Vector *clusts, 
-                         Vector *patsClass){
-    ulong nClusts = vec_size(clusts);
+                         float fluc, PatSet *pats, ulong nPats,
+                         ClustStore *clusts, Vector *patsClass){
+    ulong nClusts = clusts->size;
     char path[PATH_MAX];
     FILE *out;
 
@@ -655,7 +2331,7 @@ void write_train_results(Vector **clustsClasses, InParam par, ulong emptyPats,
     fprintf(out, "---------------------------------\n");
 	fprintf(out, "Number of resulting clusters: %lu\n", nClusts);
 	fprintf(out, "Minimum fluctuation: %g%%\n", fluc);
-    write_clusts_prototypes(out, par, clusts, nClusts);
+    write_clusts_prototypes(out, par, clusts, nClusts, pats->len);
     write_clusts_pat_sets(out, clusts);
     write_clusts_classes(clustsClasses, out, clusts, patsClass);
     write_ratio(out, pats, clusts, patsClass, *clustsClasses);
@@ -664,8 +2340,53 @@ void write_train_results(Vector **clustsClasses, InParam par, ulong emptyPats,
     fclose(out);
 }
 
-void write_test_results(InParam par, ulong emptyPats, Vector *pats,
-                        ulong nPats, Vector *clusts, Vector *testClasses,
+/** Write the vocabulary of the categorical datasets with the training
+ * results.
+ *
+ * Each line gives the column of a value in the datasets (1 for the first
+ * one), the bit encoding it and the value, in the order of the bits.
+ *
+ * @param[in] par   The network parameters (for the prefix of the file).
+ * @param[in] vocab The frozen vocabulary.
+ */
+void write_vocab(InParam par, const Vocab *vocab){
+    char path[PATH_MAX];
+    FILE *out;
+    ulong *entries;     // The index of the value of each bit
+    ulong e, bit, col;
+    ulong len = vocab->frozen ? vocab->start[vocab->nCols] : 0;
+
+    entries = malloc((len + 1) * sizeof(ulong));
+    if(entries == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+    for(e = 0; e < vocab->nEntries; e++){
+        entries[vocab->start[vocab->cols[e]] + vocab->ranks[e]] = e;
+    }
+    if(snprintf(path, sizeof(path), "%s%s%s%s", RES_FOLDER, TRAIN_FOLDER,
+                par.prefix, VOCAB_SUFFIX) >= (int)sizeof(path)){
+        fprintf(stderr, "ERROR: The vocabulary path of the prefix \"%s\" is "\
+                "too long\nExiting...\n", par.prefix);
+        exit(2);
+    }
+    openFile(&out, path, "w");
+    fprintf(out, "# column,bit,value\n");
+    for(bit = 0; bit < len; bit++){
+        e = entries[bit];
+        col = vocab->cols[e];
+        // the class column isn't encoded, the following ones are shifted
+        if(vocab->classIdx != NOT_FOUND && col >= vocab->classIdx){
+            col++;
+        }
+        fprintf(out, "%lu,%lu,%s\n", col + 1, bit, vocab->values[e]);
+    }
+    fclose(out);
+    free(entries);
+}
+
+void write_test_results(InParam par, ulong emptyPats, PatSet *pats,
+                        ulong nPats, ClustStore *clusts, Vector *testClasses,
                         Vector *testResClasses){
     char path[PATH_MAX];
     FILE *out;
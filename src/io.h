@@ -7,25 +7,66 @@
 
 /*=====| DEFINES |============================================================*/
 #define RES_SUFFIX "_results"
+#define VOCAB_SUFFIX "_vocab"
 #define CLUST_SUFFIX "_clust"
 #define RES_FOLDER "./results/"
 #define CLUST_FOLDER "clusters/"
 #define TRAIN_FOLDER "train/"
 #define TEST_FOLDER "test/"
+// Number of bytes read at once from a file which can't be mapped
+#define FILE_READ_CHUNK 65536
+// Number of chunks of a csv file per thread parsing it
+#define CSV_CHUNKS_PER_THREAD 4
+// Minimum number of bytes of a chunk of a csv file
+#define CSV_MIN_CHUNK_BYTES (1 << 20)
+// Number of bytes of a csv line scanned at once (see line_to_pat())
+#define CSV_BLOCK 64
+// Errors of a chunk of a csv file
+#define CSV_OK 0
+#define CSV_BAD_VALUE 1
+#define CSV_BAD_LENGTH 2
+// Rank of a value of a categorical file missing from the vocabulary
+#define RANK_UNKNOWN UINT32_MAX
+// First bytes and version of the binary datasets (see writeBin())
+#define BIN_MAGIC "ART1BIN"
+#define BIN_VERSION 1
+// Initial value of the checksum of the binary datasets (FNV-1a offset basis)
+#define BIN_CHECKSUM_SEED 0xcbf29ce484222325ULL
+// Alignment in bytes of the sections of a binary dataset
+#define BIN_ALIGN 64
+// Ask for huge pages to back the mapped binary datasets (0 to disable)
+#define BIN_HUGE_PAGES 1
+// Environment variable giving the seed of the random generators
+#define SEED_ENV "ART1_SEED"
 
 /*=====| PROTOTYPES |=========================================================*/
 void set_network_values(InParam *par, int argc, const char *argv[]);
+void set_sweep_values(InParam *par, SweepParam *sweep, int argc,
+                      const char *argv[]);
+void free_sweep_values(SweepParam *sweep);
 void print_network_values(InParam par);
 void vec_print_char_as_int(Vector *vec);
 void vec_print_as_char(Vector *vec);
 void vector_print_ulong(Vector *vec);
 int openFile(FILE **file, const char *name, char const *mode);
-void readCsv(ulong *plen, List *lines, FILE *file, bool skip);
+void map_file(FileMap *map, const char *name, int advice);
+void unmap_file(FileMap *map);
+PatSet *readCsv(Vector *classes, Vector *names, ulong *nZeros,
+                const char *name, bool skip, ulong nThreads);
+PatSet *readCategorical(Vector *classes, Vector *names, ulong *nZeros,
+                        Vocab *vocab, const char *name);
+bool isBinFile(const char *name);
+void verifyBin(const char *name);
+PatSet *readBin(Vector *classes, Vector *names, ulong *nZeros,
+                const char *name);
+void writeBin(const char *name, const PatSet *pats, Vector *classes,
+              Vector *names, ulong nZeros);
 void write_train_results(Vector **clustsClasses, InParam par, ulong emptyPats,
-                         float fluc, Vector *pats, ulong nPats, Vector *clusts, 
-                         Vector *patsClass);
-void write_test_results(InParam par, ulong emptyPats, Vector *pats,
-                        ulong nPats, Vector *clusts, Vector *patsClass,
+                         float fluc, PatSet *pats, ulong nPats,
+                         ClustStore *clusts, Vector *patsClass);
+void write_vocab(InParam par, const Vocab *vocab);
+void write_test_results(InParam par, ulong emptyPats, PatSet *pats,
+                        ulong nPats, ClustStore *clusts, Vector *patsClass,
                         Vector *testResClasses);
 
 #endif
@@ -24,151 +24,309 @@
 #include "art1.h"
 #include "ccl_internal.h"
 
-/*=====| FUNCTIONS |==========================================================*/
-/** Remove empty patterns from the patterns list.
- *
- * Scan every patterns and remove the patterns made of 0 only. Such a pattern is
- * useless for the network and can cause an infitie loop.
- *
- * @param[in] lines The patterns list to check.
+/*=====| TYPEDEFS & STRUCTURES |==============================================*/
+/** The structure holds one network trained by a parameters sweep.
+ */
+typedef struct {
+    /** @var SweepRun::par
+     * The parameters of the network.
+     */
+    InParam par;
+
+    /** @var SweepRun::pats
+     * The training patterns, with the noise of the network added. They are
+     * shared with the other networks using the same noise.
+     */
+    PatSet *pats;
+
+    /** @var SweepRun::nClusts
+     * The number of clusters of the trained network.
+     */
+    ulong nClusts;
+
+    /** @var SweepRun::bestFluc
+     * The lowest fluctuation reached by the training.
+     */
+    float bestFluc;
+
+    /** @var SweepRun::trainAcc
+     * The percentage of training patterns whose class is the class of their
+     * cluster.
+     */
+    float trainAcc;
+
+    /** @var SweepRun::testAcc
+     * The percentage of well classified testing patterns.
+     */
+    float testAcc;
+
+    /** @var SweepRun::seconds
+     * The wall time of the training and the testing of the network.
+     */
+    double seconds;
+} SweepRun;
+
+/** The structure holds what is shared by the networks of a parameters sweep.
  *
- * @return The number of empty patterns removed.
+ * Every field but the runs is only read by the threads.
  */
-static ulong rm_empty_pats(List *lines){
-    ulong i, j, aftersize, count;
-	ulong beforesize = iList.Size(lines);
-    ulong lineSize = vec_size((*(CSVLine *)iList.Front(lines)).val);
-    Vector *val;
+typedef struct {
+    /** @var SweepJob::runs
+     * The networks to train, one per combination of parameters.
+     */
+    SweepRun *runs;
 
-    printf("Removing patterns containing only 0... ");
-    for(i = 0; i < beforesize; i++){
-        count = 0;
-        val = (*(CSVLine *)iList.GetElement(lines, i)).val;
-        for(j = 0; j < lineSize; j++){
-            if(vec_get_as_char(val, j) == 0){
-                count++;
-            }
-        }
-        if(count == lineSize){
-            iList.EraseAt(lines, i);
-        }
-    }
-    aftersize = iList.Size(lines);	
-    printf("OK\n");
-    return beforesize - aftersize;
-}
+    /** @var SweepJob::trainClasses
+     * The classes of the training patterns.
+     */
+    Vector *trainClasses;   // Vector of strings
+
+    /** @var SweepJob::testPats
+     * The testing patterns (NULL if there's none).
+     */
+    PatSet *testPats;
 
+    /** @var SweepJob::testClasses
+     * The classes of the testing patterns.
+     */
+    Vector *testClasses;    // Vector of strings
+} SweepJob;
+
+/*=====| FUNCTIONS |==========================================================*/
 /** Check the patterns validity.
  *
  * Check:
- *  - if there's enough patterns in the patterns list (at least 2).
- *  - if patterns aren't 0000000... (in that case: remove them).
+ *  - if there's enough patterns in the patterns set (at least 2).
+ *  - if patterns aren't 0000000... (in that case: remove them). Such a
+ *    pattern is useless for the network and can cause an infitie loop.
  *
- * @param[in] lines The patterns list to check.
+ * The patterns made of 0 only are already dropped while reading the file (see
+ * readCsv()), they are only reported here.
  *
- * @return The number of empty patterns removed.
+ * @param[in] pats        The patterns set to check.
+ * @param[in] nbEmptyPats The number of patterns made of 0 only of the file.
  */
-static ulong check_pats_validity(List *lines){
-    ulong nbEmptyPats;
-
-    if(iList.Size(lines) < 1){
+static void check_pats_validity(PatSet *pats, ulong nbEmptyPats){
+    if(pats->nPats + nbEmptyPats < 1){
         fprintf(stderr, "ERROR: There is %lu patterns. There must be "\
-                "at least 2 patterns\nExiting...\n", iList.Size(lines));
+                "at least 2 patterns\nExiting...\n", pats->nPats);
         exit(10);
     }
-    nbEmptyPats = rm_empty_pats(lines);
+    printf("Removing patterns containing only 0... ");
+    printf("OK\n");
     if(nbEmptyPats > 0){
         printf("\nWARNING: %lu patterns has been removed\n", nbEmptyPats);
     }
-    if(iList.Size(lines) < 1){
+    if(pats->nPats < 1){
         fprintf(stderr, "ERROR: There is %lu patterns (%lu patterns has been "\
                 "removed). There must be at least 2 patterns\nExiting...\n", 
-                iList.Size(lines), nbEmptyPats);
+                pats->nPats, nbEmptyPats);
         exit(10);
     }
-    return nbEmptyPats;
 }
 
 
+/** Compare two ulong for qsort().
+ *
+ * @param[in] elem1 The first ulong.
+ * @param[in] elem2 The second ulong.
+ *
+ * @return A negative, null or positive value if elem1 is lower than, equal to
+ *  or greater than elem2.
+ */
+static int cmp_ulong(const void *elem1, const void *elem2){
+    ulong a = *(const ulong *)elem1;
+    ulong b = *(const ulong *)elem2;
+
+    return (a > b) - (a < b);
+}
+
+/** Flip 'noise' random bits of each pattern of a sparse patterns set.
+ *
+ * The bits are drawn in the same order as for a packed set. The flips of a
+ * pattern are sorted and merged with its 1 in a single pass: a bit flipped an
+ * odd number of times is switched, the others are left unchanged. The set is
+ * rebuilt as the number of 1 of the patterns changes.
+ *
+ * @param[in,out] pats  The sparse patterns set.
+ * @param[in]     noise The number of bits to flip in each pattern.
+ * @param[in,out] rng   The random generator picking the bits.
+ */
+static void add_noise_sparse(PatSet *pats, ulong noise, Rng *rng){
+    ulong iPat, n, i, j, cnt, val;
+    ulong nIdx = 0;
+    ulong capacity = pats->start[pats->nPats] + noise + 1;
+    ulong *flips = malloc(noise * sizeof(ulong));
+    uint32_t *idx = malloc(capacity * sizeof(uint32_t));
+    const uint32_t *old;
+    bool isOne;
+
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        if(nIdx + pats->nOnes[iPat] + noise >= capacity){
+            capacity = 2 * (nIdx + pats->nOnes[iPat] + noise);
+            idx = realloc(idx, capacity * sizeof(uint32_t));
+        }
+        if(flips == NULL || idx == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the noisy patterns\n"\
+                    "Exiting...\n");
+            exit(12);
+        }
+        for(n = 0; n < noise; n++){
+            flips[n] = rng_next(rng) % pats->len;
+        }
+        qsort(flips, noise, sizeof(ulong), cmp_ulong);
+        // the old 1 are read before the start of the pattern is moved
+        old = pat_idx(pats, iPat);
+        pats->start[iPat] = nIdx;
+        for(i = 0, j = 0; i < pats->nOnes[iPat] || j < noise;){
+            if(j == noise || (i < pats->nOnes[iPat] && old[i] < flips[j])){
+                idx[nIdx++] = old[i++];
+                continue;
+            }
+            val = flips[j];
+            for(cnt = 0; j < noise && flips[j] == val; j++){
+                cnt++;
+            }
+            isOne = i < pats->nOnes[iPat] && old[i] == val;
+            if(isOne){
+                i++;
+            }
+            if(isOne == ((cnt & 1) == 0)){
+                idx[nIdx++] = (uint32_t)val;
+            }
+        }
+        pats->nOnes[iPat] = nIdx - pats->start[iPat];
+    }
+    pats->start[pats->nPats] = nIdx;
+    pats_release(pats, pats->idx);
+    pats->idx = idx;
+    free(flips);
+}
+
 /** Add noise to each patterns of the patterns vector.
  *
  * The noise is added by flipping random bits of the patterns.
  *
  * @param[in,out] pats The patterns which will be "noised".
  * @param[in]     perc The noise percentage to add to the patterns.
+ * @param[in]     seed The seed of the random generator picking the bits.
+ * @param[in]     verbose Print what is done or not.
  */
-static void add_noise(Vector *pats, int perc){
-    char *bit;
-    Vector *pat;
+static void add_noise(PatSet *pats, int perc, unsigned int seed, bool verbose){
+    BitWord *pat;
     ulong n, x, iPat, size, noise;
     ulong c = 0;
+    Rng rng;
 
-    printf("Adding %i%% of noise to each patterns... ", perc);
+    if(verbose){
+        printf("Adding %i%% of noise to each patterns... ", perc);
+    }
     if(perc == 0){
-        printf("OK\n");
+        if(verbose){
+            printf("OK\n");
+        }
         return;
     }
-    if(vec_size(pats) < 1){    // should never happen
-        printf("OK\n");
+    if(pats->nPats < 1){    // should never happen
+        if(verbose){
+            printf("OK\n");
+        }
         fprintf(stderr, "WARNING: 'pats' is empty\n");
         return;
     }
-    srand((unsigned int)time(NULL));
-    size = vec_size(vec_get_as_vec(pats, 0));
+    rng_seed(&rng, seed);
+    size = pats->len;
     noise = (ulong)roundf(perc * size / 100.);
-    for(iPat = 0; iPat < vec_size(pats); iPat++){
-        pat = vec_get_as_vec(pats, iPat);
-        for(n = 0; n < noise; n++){
-            x = rand() % size;
-            bit = &vec_get_as_char(pat, x);
-            if(*bit == 1){
-                *bit = 0;
-            }
-            else{
-                *bit = 1;
+    if(pats->idx != NULL){
+        add_noise_sparse(pats, noise, &rng);
+        c = pats->nPats * noise;
+    }
+    else{
+        for(iPat = 0; iPat < pats->nPats; iPat++){
+            pat = pat_get(pats, iPat);
+            for(n = 0; n < noise; n++){
+                x = rng_next(&rng) % size;
+                if(bit_get(pat, x)){
+                    pats->nOnes[iPat]--;
+                }
+                else{
+                    pats->nOnes[iPat]++;
+                }
+                bit_flip(pat, x);
+                c++;
             }
-            c++;
         }
     }
-    printf("OK\n");
-    printf("%lu pattern's bits have been switched to 0\n", c);
+    if(verbose){
+        printf("OK\n");
+        printf("%lu pattern's bits have been switched to 0\n", c);
+    }
 }
 
-/** Check weither every patterns are maid of binary numbers (0/1).
+/** Read, check and store the patterns of a csv file, of a categorical csv
+ * file (see readCategorical()) or of a binary dataset (see writeBin()).
  *
- * The function dosen't return any boolean because it automaticaly exit the
- * program if the patterns aren't binary: it's impossible to build an ART1
- * network with non-binary patterns.
+ * @param[out] patLen    The length of the patterns.
+ * @param[out] emptyPats The number of empty patterns removed.
+ * @param[out] classes   The vector receiving the class of each pattern.
+ * @param[out] names     The vector receiving the distinct classes, which
+ *  own the strings of 'classes' (see free_classes()).
+ * @param[in]  file      Path of the csv file or of the binary dataset.
+ * @param[in]  skip      Indicate weither the first attribute of the csv
+ *  string is the class (a binary dataset always has the classes).
+ * @param[in]  nThreads  The number of threads parsing the file.
+ * @param[in,out] vocab  The vocabulary of the categorical datasets, NULL if
+ *  the file isn't one.
+ * @param[in]  stage     Name of the stage the patterns are for ("TRAINING" or
+ *  "TESTING"), for the messages.
  *
- * @param[in] lines The list of patterns to check.
- * @param[in] skip  Indicate weither the first attribute of the csv string must
- *  be skipped or not.
+ * @return The patterns, stored sparse if they are sparse enough (see
+ *  pats_sparse_pays()).
  */
-static void check_binary(List *lines, bool skip){
-    List *itline;
-    itline = iList.Copy(lines);
-    CSVLine line;
-    line = *(CSVLine *)iList.GetElement(itline, 0);
-    const ulong size = vec_size(line.val);
-    ulong index = 1;
-    ulong i, j;
-
-    for(i = 0; i < iList.Size(lines); i++){
-        line = *(CSVLine *)iList.GetElement(itline, i);
-        for(j = 0; j < size; j++){
-            int val = vec_get_as_char(line.val, j);
-            if((val != 0) && (val != 1) && (j > skip)){
-                fprintf(stderr, "\nERROR: value at the line %lu, column %lu "\
-                        "is %i. It can only be 1 or 0 (binary patterns)"\
-                        "\nWhole data are in data_tmp.\n Exiting...\n", 
-                        index, j + 1, val);
-                iList.Finalize(itline);
-                exit(22);
-            }
-        }
-        index++;
+static PatSet *load_pats(ulong *patLen, ulong *emptyPats, Vector *classes,
+                         Vector *names, const char *file, bool skip,
+                         ulong nThreads, Vocab *vocab, const char *stage){
+    PatSet *pats;
+
+    printf("\n------------- INTERNING %s PATTERNS ------------\n\n", stage);
+    printf("Reading input file \"%s\"... ", file);
+    if(vocab != NULL){
+        pats = readCategorical(classes, names, emptyPats, vocab, file);
+    }
+    else if(isBinFile(file)){
+        pats = readBin(classes, names, emptyPats, file);
     }
-    iList.Finalize(itline);
+    else{
+        pats = readCsv(classes, names, emptyPats, file, skip, nThreads);
+    }
+    printf("OK\n");
+    *patLen = pats->len;
+    printf("\n--------- CHECKING %s PATTERNS VALIDITY --------\n\n", stage);
+    printf("%lu patterns have been scanned\n", pats->nPats + *emptyPats);
+    printf("Patterns length is %lu\n", *patLen);
+    check_pats_validity(pats, *emptyPats);
+    printf("Number of network patterns: %lu\n", pats->nPats);
+    if(pats->idx != NULL){
+        printf("Patterns density is %g%%: storing them sparse\n",
+               pats->start[pats->nPats] * 100. /
+               ((double)pats->nPats * *patLen));
+    }
+    return pats;
+}
+
+/** Free the distinct classes of a patterns file and the vector of classes.
+ *
+ * @param[in] classes The vector of the classes of the patterns.
+ * @param[in] names   The distinct classes, owning the strings of 'classes'.
+ */
+static void free_classes(Vector *classes, Vector *names){
+    ulong iName;
+
+    for(iName = 0; iName < vec_size(names); iName++){
+        free(vec_get_as_str(names, iName));
+    }
+    iVector.Finalize(names);
+    iVector.Finalize(classes);
 }
 
 /** The main function.
@@ -178,66 +336,50 @@ static void check_binary(List *lines, bool skip){
  * given parameters and then create the test patterns from the input test file
  * and test them on the network.
  */
-static void train_network(ulong *patLen, Vector **bestClusts,
-                          Vector **clustsClasses, InParam par){
-    Vector *pats;       // Vector of vectors
-    List *lines;        // CSVLine
+static void train_network(ulong *patLen, ClustStore **bestClusts,
+                          Vector **clustsClasses, Vocab *vocab, InParam par){
+    PatSet *pats;       // Packed patterns
     Vector *trainClasses = NULL;    // Vector of strings
+    Vector *trainNames = NULL;      // Vector of strings
     float resFluc;
-    ulong emptyPats, iLine;
-    FILE *in;
-
-    lines = iList.Create(sizeof(CSVLine));
-    printf("\n------------- INTERNING TRAINING PATTERNS ------------\n\n");
-    openFile(&in, par.trainFile, "r");
-    printf("Reading input file \"%s\"... ", par.trainFile);
-    readCsv(patLen, lines, in, par.skip);
-    printf("OK\n");
-    fclose(in);
-    printf("\n--------- CHECKING TRAINING PATTERNS VALIDITY --------\n\n");
-    check_binary(lines, par.skip);
-    printf("%lu patterns have been scanned\n", iList.Size(lines));
-    printf("Patterns length is %lu\n", *patLen);
-    emptyPats = check_pats_validity(lines);
-    printf("Number of network patterns: %lu\n", iList.Size(lines));
-    pats = iVector.Create(sizeof(Vector), iList.Size(lines));
-    line_val_to_vec(pats, lines);
-    trainClasses = iVector.Create(sizeof(void *), iList.Size(lines));
-    line_class_to_vec(trainClasses, lines);
+    ulong emptyPats;
+
+    trainClasses = iVector.Create(sizeof(void *), 1);
+    trainNames = iVector.Create(sizeof(void *), 1);
+    pats = load_pats(patLen, &emptyPats, trainClasses, trainNames,
+                     par.trainFile, par.skip, par.nThreads, vocab,
+                     "TRAINING");
     printf("\n-------------------- ADDING NOISE -------------------\n\n");
-    add_noise(pats, par.trainNoise);
+    add_noise(pats, par.trainNoise, par.seed, true);
     printf("\n------------------- TRAINING STAGE ------------------\n\n");
     network_train(bestClusts, &resFluc, par, pats);
     printf("\n-------------- WRITING TRAINING RESULTS -------------\n\n");
     write_train_results(clustsClasses, par, emptyPats, resFluc, pats,
-                        vec_size(pats), *bestClusts, trainClasses);
+                        pats->nPats, *bestClusts, trainClasses);
+    if(vocab != NULL){
+        write_vocab(par, vocab);
+    }
 
     // free
-    iVector.Finalize(pats);
-    for(iLine = 0; iLine < iList.Size(lines); iLine++){
-        iVector.Finalize((*(CSVLine *)(iList.GetElement(lines, iLine))).val);
-    }
-    iList.Finalize(lines);
+    // the class strings are still the classes of the clusters
+    pats_finalize(pats);
     iVector.Finalize(trainClasses);
+    iVector.Finalize(trainNames);
 }
 
-static void test_network(ulong trainPatLen, Vector *clusts,
-                         Vector *clustsClasses, InParam par){
-    Vector *pats;           // Vector of vectors
+static void test_network(ulong trainPatLen, ClustStore *clusts,
+                         Vector *clustsClasses, Vocab *vocab, InParam par){
+    PatSet *pats;           // Packed patterns
     Vector *testClasses;    // Vector of strings
-    List *lines;            // List of CSVLine
-    ulong emptyPats, patLen, iLine, iClass;
-    FILE *in;
+    Vector *testNames;      // Vector of strings
+    ulong emptyPats, patLen;
     Vector *testResClasses; // Vector of strings
 
     testResClasses = iVector.Create(sizeof(void *), 1);
-    lines = iList.Create(sizeof(CSVLine));
-    printf("\n------------- INTERNING TESTING PATTERNS ------------\n\n");
-    openFile(&in, par.testFile, "r");
-    printf("Reading input file \"%s\"... ", par.testFile);
-    readCsv(&patLen, lines, in, par.skip);
-    printf("OK\n");
-    
+    testClasses = iVector.Create(sizeof(void *), 1);
+    testNames = iVector.Create(sizeof(void *), 1);
+    pats = load_pats(&patLen, &emptyPats, testClasses, testNames,
+                     par.testFile, par.skip, par.nThreads, vocab, "TESTING");
     if(trainPatLen != patLen){
         fprintf(stderr, "\nERROR: training and testing sets do not contains "\
                         "patterns of same length. (training patterns are %lu "\
@@ -245,63 +387,260 @@ static void test_network(ulong trainPatLen, Vector *clusts,
                         trainPatLen, patLen);
         exit(30);
     }
-    
-    fclose(in);
-    printf("\n--------- CHECKING TESTING PATTERNS VALIDITY --------\n\n");
-    check_binary(lines, par.skip);
-    printf("%lu patterns have been scanned\n", iList.Size(lines));
-    printf("Patterns length is %lu\n", patLen);
-    emptyPats = check_pats_validity(lines);
-    printf("Number of network patterns: %lu\n", iList.Size(lines));
-    pats = iVector.Create(sizeof(Vector), iList.Size(lines));
-    line_val_to_vec(pats, lines);
-    testClasses = iVector.Create(sizeof(void *), iList.Size(lines));
-    line_class_to_vec(testClasses, lines);
     printf("\n-------------------- ADDING NOISE -------------------\n\n");
-    add_noise(pats, par.testNoise);
+    add_noise(pats, par.testNoise, par.seed, true);
     printf("\n------------------- TESTING STAGE ------------------\n\n");
     network_test(&testResClasses, clusts, par, pats, clustsClasses, 
                  testClasses);
     printf("\n-------------- WRITING TESTING RESULTS -------------\n\n");
-    write_test_results(par, emptyPats, pats, vec_size(pats), clusts,
+    write_test_results(par, emptyPats, pats, pats->nPats, clusts,
                        testClasses, testResClasses);
 
     // free
     iVector.Finalize(testResClasses);
-    for(iClass = 0; iClass < vec_size(testClasses); iClass++){
-        free(vec_get_as_str(testClasses, iClass));
+    free_classes(testClasses, testNames);
+    pats_finalize(pats);
+}
+
+/** Train and test one network of a parameters sweep.
+ *
+ * The networks are independent: each one has its own clusters and random
+ * generators, the patterns and the classes are only read.
+ *
+ * @param[in,out] arg  The sweep (a SweepJob).
+ * @param[in]     iRun The index of the network in the sweep runs.
+ */
+static void sweep_run(void *arg, ulong iRun){
+    SweepJob *job = arg;
+    SweepRun *run = &job->runs[iRun];
+    ClustStore *clusts = NULL;
+    Vector *clustsClasses;  // Vector of strings
+    Vector *testResClasses; // Vector of strings
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    network_train(&clusts, &run->bestFluc, run->par, run->pats);
+    run->nClusts = clusts->size;
+    clustsClasses = iVector.Create(sizeof(void *), clusts->size + 1);
+    clusts_major_classes(clustsClasses, clusts, job->trainClasses);
+    run->trainAcc = clusts_class_matches(clusts, job->trainClasses,
+                                         clustsClasses) * 100.
+                    / run->pats->nPats;
+    run->testAcc = NONE;
+    if(job->testPats != NULL){
+        testResClasses = iVector.Create(sizeof(void *), 1);
+        run->testAcc = network_test(&testResClasses, clusts, run->par,
+                                    job->testPats, clustsClasses,
+                                    job->testClasses) * 100.
+                       / job->testPats->nPats;
+        iVector.Finalize(testResClasses);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    run->seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+    iVector.Finalize(clustsClasses);
+    clusts_finalize(clusts);
+}
+
+/** Train and test a network for every combination of the sweep values.
+ *
+ * The patterns are read once. The training patterns are copied once per
+ * noise value and the networks are trained par.nThreads at a time, each one
+ * on a single thread. A summary table is printed at the end.
+ *
+ * @param[in] par   The parameters shared by every networks.
+ * @param[in] sweep The values of the sweep.
+ */
+static void sweep_network(InParam par, SweepParam sweep){
+    ulong i, iVig, iBeta, iNoise, iBatch, patLen, testPatLen, emptyPats;
+    ulong nRuns = sweep.nVigilances * sweep.nBetas * sweep.nNoises *
+                  sweep.nBatches;
+    PatSet *trainPats;
+    PatSet **noisyPats;
+    SweepJob job;
+    SweepRun *run;
+    ThreadPool *pool;
+    Vector *trainNames; // Vector of strings
+    Vector *testNames;  // Vector of strings
+    Vocab *vocab = par.encode ? vocab_create(par.classCol) : NULL;
+    struct timespec start, end;
+
+    job.trainClasses = iVector.Create(sizeof(void *), 1);
+    trainNames = iVector.Create(sizeof(void *), 1);
+    trainPats = load_pats(&patLen, &emptyPats, job.trainClasses, trainNames,
+                          par.trainFile, par.skip, par.nThreads, vocab,
+                          "TRAINING");
+    job.testPats = NULL;
+    job.testClasses = iVector.Create(sizeof(void *), 1);
+    testNames = iVector.Create(sizeof(void *), 1);
+    if(strcmp(par.testFile, "") != 0){
+        job.testPats = load_pats(&testPatLen, &emptyPats, job.testClasses,
+                                 testNames, par.testFile, par.skip,
+                                 par.nThreads, vocab, "TESTING");
+        if(testPatLen != patLen){
+            fprintf(stderr, "\nERROR: training and testing sets do not "\
+                    "contains patterns of same length. (training patterns "\
+                    "are %lu bits long / testing patterns are %lu bits "\
+                    "long)\n", patLen, testPatLen);
+            exit(30);
+        }
+        add_noise(job.testPats, par.testNoise, par.seed, false);
+    }
+    noisyPats = malloc(sweep.nNoises * sizeof(PatSet *));
+    for(iNoise = 0; iNoise < sweep.nNoises; iNoise++){
+        noisyPats[iNoise] = pats_copy(trainPats);
+        add_noise(noisyPats[iNoise], (int)sweep.noises[iNoise], par.seed,
+                  false);
+    }
+    job.runs = malloc(nRuns * sizeof(SweepRun));
+    run = job.runs;
+    for(iVig = 0; iVig < sweep.nVigilances; iVig++){
+        for(iBeta = 0; iBeta < sweep.nBetas; iBeta++){
+            for(iNoise = 0; iNoise < sweep.nNoises; iNoise++){
+                for(iBatch = 0; iBatch < sweep.nBatches; iBatch++, run++){
+                    run->par = par;
+                    run->par.vigilance = sweep.vigilances[iVig];
+                    run->par.beta = sweep.betas[iBeta];
+                    run->par.trainNoise = (int)sweep.noises[iNoise];
+                    run->par.batchSize = sweep.batches[iBatch];
+                    run->par.nThreads = 1;
+                    run->pats = noisyPats[iNoise];
+                }
+            }
+        }
+    }
+
+    printf("\n-------------------- SWEEP STAGE --------------------\n\n");
+    printf("Training %lu networks on %lu threads...\n\n", nRuns,
+           par.nThreads);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool = pool_create(par.nThreads);
+    pool_run(pool, sweep_run, &job, nRuns);
+    pool_finalize(pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Vigilance |  Beta | Noise |  Batch | No. clusters | Best fluc. | "\
+           "Train acc. | Test acc. | Time (s)\n");
+    printf("----------+-------+-------+--------+--------------+------------+"\
+           "------------+-----------+---------\n");
+    for(i = 0; i < nRuns; i++){
+        run = &job.runs[i];
+        printf("%9g | %5g | %4i%% | ", run->par.vigilance, run->par.beta,
+               run->par.trainNoise);
+        if(run->par.batchSize == 0){
+            printf("%6s | ", "seq.");
+        }
+        else{
+            printf("%6lu | ", run->par.batchSize);
+        }
+        printf("%12lu | %9g%% | %9.2f%% | ", run->nClusts, run->bestFluc,
+               run->trainAcc);
+        if(run->testAcc == NONE){
+            printf("%9s | ", "-");
+        }
+        else{
+            printf("%8.2f%% | ", run->testAcc);
+        }
+        printf("%8.3f\n", run->seconds);
     }
-    iVector.Finalize(testClasses);
-    iVector.Finalize(pats);
-    for(iLine = 0; iLine < iList.Size(lines); iLine++){
-        iVector.Finalize((*(CSVLine *)(iList.GetElement(lines, iLine))).val);
+    printf("\nSweep wall time: %.3f s\n", (end.tv_sec - start.tv_sec) +
+           (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    // free
+    for(iNoise = 0; iNoise < sweep.nNoises; iNoise++){
+        pats_finalize(noisyPats[iNoise]);
     }
-    iList.Finalize(lines);
+    free(noisyPats);
+    free(job.runs);
+    pats_finalize(trainPats);
+    free_classes(job.trainClasses, trainNames);
+    if(job.testPats != NULL){
+        pats_finalize(job.testPats);
+    }
+    free_classes(job.testClasses, testNames);
+    vocab_finalize(vocab);
+}
+
+/** Convert a csv file into a binary dataset (see writeBin()).
+ *
+ * The arguments are: --convert, the csv file, the binary dataset, skip and
+ * optionally the number of threads parsing the csv file (0 or no value means
+ * one thread per online processor). The checksum of the written dataset is
+ * verified (see verifyBin()).
+ *
+ * @param[in] argc Number of arguments in argv.
+ * @param[in] argv The arguments.
+ */
+static void convert_dataset(int argc, const char *argv[]){
+    PatSet *pats;
+    Vector *classes, *names;
+    ulong patLen, emptyPats;
+    ulong nThreads;
+
+    if(argc < 5){
+        fprintf(stderr, "Invalid number of parameters!\nExiting...\n");
+        exit(2);
+    }
+    nThreads = argc > 5 ? atol(argv[5]) : 0;
+    if(nThreads == 0){
+        nThreads = pool_default_threads();
+    }
+    classes = iVector.Create(sizeof(void *), 1);
+    names = iVector.Create(sizeof(void *), 1);
+    pats = load_pats(&patLen, &emptyPats, classes, names, argv[2],
+                     atoi(argv[4]), nThreads, NULL, "CSV");
+    printf("\n---------------- WRITING BINARY DATASET -------------\n\n");
+    printf("Writing \"%s\"... ", argv[3]);
+    writeBin(argv[3], pats, classes, names, emptyPats);
+    printf("OK\n");
+    printf("Verifying \"%s\"... ", argv[3]);
+    verifyBin(argv[3]);
+    printf("OK\n");
+    pats_finalize(pats);
+    free_classes(classes, names);
 }
 
 int main(int argc, const char *argv[]){
-    ulong iClust;
     InParam par;
-    Vector *clusts = NULL;          // Vector of Clusters
+    ClustStore *clusts = NULL;
     Vector *clustsClasses = NULL;   // Vector of strings
+    SweepParam sweep;
+    Vocab *vocab = NULL;
     ulong patLen;
 
+    bits_init();
+    if(argc > 1 && strcmp(argv[1], "--sweep") == 0){
+        set_sweep_values(&par, &sweep, argc, argv);
+        print_network_values(par);
+        sweep_network(par, sweep);
+        free_sweep_values(&sweep);
+        return EXIT_SUCCESS;
+    }
+    if(argc > 1 && strcmp(argv[1], "--convert") == 0){
+        convert_dataset(argc, argv);
+        return EXIT_SUCCESS;
+    }
+    if(argc > 2 && strcmp(argv[1], "--verify") == 0){
+        printf("Verifying \"%s\"... ", argv[2]);
+        verifyBin(argv[2]);
+        printf("OK\n");
+        return EXIT_SUCCESS;
+    }
     clustsClasses = iVector.Create(sizeof(void *), 1);
     set_network_values(&par, argc, argv);
     print_network_values(par);
+    if(par.encode){
+        vocab = vocab_create(par.classCol);
+    }
     if(strcmp(par.trainFile, "") != 0){
-        train_network(&patLen, &clusts, &clustsClasses, par);
+        train_network(&patLen, &clusts, &clustsClasses, vocab, par);
     }
     if(strcmp(par.testFile, "") != 0){
-        test_network(patLen, clusts, clustsClasses, par);
+        test_network(patLen, clusts, clustsClasses, vocab, par);
     }
 
     // free
     iVector.Finalize(clustsClasses);
-    for(iClust = 0; iClust < vec_size(clusts); iClust++){
-        iVector.Finalize((vec_get_as_clust(clusts, iClust)).prot);
-        iVector.Finalize((vec_get_as_clust(clusts, iClust)).patSet);
-    }
-    iVector.Finalize(clusts);
+    clusts_finalize(clusts);
+    vocab_finalize(vocab);
     return EXIT_SUCCESS;
 }
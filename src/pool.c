@@ -0,0 +1,170 @@
+/*############################################################################*\
+#         _   ___ _____ _   ___ ___ __  __ _   _ _      _ _____ ___  ___       #
+#        /_\ | _ \_   _/ | / __|_ _|  \/  | | | | |    /_\_   _/ _ \| _ \      #
+#       / _ \|   / | | | | \__ \| || |\/| | |_| | |__ / _ \| || (_) |   /      #
+#      /_/ \_\_|_\ |_| |_| |___/___|_|  |_|\___/|____/_/ \_\_| \___/|_|_\      #
+#                                                                              #
+#                                                          by Mathieu FOURCROY #
+#                                                                         2015 #
+\*############################################################################*/
+/**
+ * @file pool.c
+ * @author Mathieu Fourcroy
+ * @date June 2015
+ * @version 0.0.1
+ *
+ * This file contains a minimal pool of worker threads.
+ *
+ * pool_run() hands out the indexes 0 to nTasks - 1 to the workers and to the
+ * calling thread, and only returns once every task is done. The tasks of a
+ * batch must not depend on the order they are run in: a task which needs
+ * a deterministic result writes it at its own index and the caller merges
+ * them afterwards.
+ */
+
+/*=====| INCLUDES |===========================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+/*=====| FUNCTIONS |==========================================================*/
+/** Run the tasks of the current batch until there is none left.
+ *
+ * @note The pool lock must be held when calling this function, it is held
+ *  again when it returns.
+ *
+ * @param[in,out] pool The pool.
+ */
+static void run_tasks(ThreadPool *pool){
+    unsigned long iTask;
+
+    while(pool->nextTask < pool->nTasks){
+        iTask = pool->nextTask++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->arg, iTask);
+        pthread_mutex_lock(&pool->lock);
+    }
+}
+
+/** The main function of the worker threads.
+ *
+ * @param[in,out] arg The pool.
+ */
+static void *worker(void *arg){
+    ThreadPool *pool = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;){
+        while(!pool->stop && pool->batch == seen){
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if(pool->stop){
+            break;
+        }
+        seen = pool->batch;
+        run_tasks(pool);
+        if(--pool->nBusy == 0){
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/** Returns the number of threads to use when none is given.
+ *
+ * @return The number of online processors.
+ */
+unsigned long pool_default_threads(void){
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (unsigned long)n : 1;
+}
+
+/** Create a pool running its tasks on 'nThreads' threads.
+ *
+ * The calling thread counts as one of them, so nThreads - 1 workers are
+ * started.
+ *
+ * @param[in] nThreads The number of threads (at least 1).
+ *
+ * @return The created pool.
+ */
+ThreadPool *pool_create(unsigned long nThreads){
+    unsigned long i;
+    ThreadPool *pool = calloc(1, sizeof(*pool));
+
+    if(pool == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the thread pool\nExiting...\n");
+        exit(12);
+    }
+    if(nThreads < 1){
+        nThreads = 1;
+    }
+    pool->threads = malloc(nThreads * sizeof(pthread_t));
+    if(pool->threads == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the thread pool\nExiting...\n");
+        exit(12);
+    }
+    pool->nThreads = nThreads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for(i = 0; i < nThreads - 1; i++){
+        if(pthread_create(&pool->threads[i], NULL, worker, pool) != 0){
+            fprintf(stderr, "ERROR: Can't start thread %lu\nExiting...\n", i);
+            exit(13);
+        }
+    }
+    return pool;
+}
+
+/** Run 'task' for every index from 0 to nTasks - 1 and wait for them.
+ *
+ * @param[in,out] pool   The pool.
+ * @param[in]     task   The function to run.
+ * @param[in]     arg    The argument passed to every calls of 'task'.
+ * @param[in]     nTasks The number of tasks.
+ */
+void pool_run(ThreadPool *pool, PoolTask task, void *arg,
+              unsigned long nTasks){
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->nTasks = nTasks;
+    pool->nextTask = 0;
+    pool->nBusy = pool->nThreads - 1;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->wake);
+    run_tasks(pool);
+    while(pool->nBusy > 0){
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/** Stop the workers of a pool and free it.
+ *
+ * @param[in] pool The pool to free, can be NULL.
+ */
+void pool_finalize(ThreadPool *pool){
+    unsigned long i;
+
+    if(pool == NULL){
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for(i = 0; i < pool->nThreads - 1; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,86 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/*=====| INCLUDES |===========================================================*/
+#include <pthread.h>
+
+/*=====| TYPEDEFS & STRUCTURES |==============================================*/
+/** A task run by the pool: it is called once for each task index.
+ */
+typedef void (*PoolTask)(void *arg, unsigned long iTask);
+
+/** The structure holds a pool of worker threads.
+ *
+ * The workers are started once by pool_create() and sleep between two calls
+ * to pool_run().
+ */
+typedef struct {
+    /** @var ThreadPool::threads
+     * The worker threads (the thread calling pool_run() is not one of them).
+     */
+    pthread_t *threads;
+
+    /** @var ThreadPool::nThreads
+     * The number of threads running the tasks, the calling thread included.
+     */
+    unsigned long nThreads;
+
+    /** @var ThreadPool::lock
+     * The mutex protecting every following fields.
+     */
+    pthread_mutex_t lock;
+
+    /** @var ThreadPool::wake
+     * Signaled when a new batch of tasks is ready or the pool is stopping.
+     */
+    pthread_cond_t wake;
+
+    /** @var ThreadPool::done
+     * Signaled when the last worker is done with the current batch.
+     */
+    pthread_cond_t done;
+
+    /** @var ThreadPool::task
+     * The function run by the current batch of tasks.
+     */
+    PoolTask task;
+
+    /** @var ThreadPool::arg
+     * The argument passed to every tasks of the current batch.
+     */
+    void *arg;
+
+    /** @var ThreadPool::nTasks
+     * The number of tasks of the current batch.
+     */
+    unsigned long nTasks;
+
+    /** @var ThreadPool::nextTask
+     * The index of the next task to run.
+     */
+    unsigned long nextTask;
+
+    /** @var ThreadPool::nBusy
+     * The number of workers which haven't finished the current batch yet.
+     */
+    unsigned long nBusy;
+
+    /** @var ThreadPool::batch
+     * Incremented for every new batch so the workers know there is work.
+     */
+    unsigned long batch;
+
+    /** @var ThreadPool::stop
+     * Set when the pool is finalized.
+     */
+    int stop;
+} ThreadPool;
+
+/*=====| PROTOTYPES |=========================================================*/
+unsigned long pool_default_threads(void);
+ThreadPool *pool_create(unsigned long nThreads);
+void pool_run(ThreadPool *pool, PoolTask task, void *arg,
+              unsigned long nTasks);
+void pool_finalize(ThreadPool *pool);
+
+#endif
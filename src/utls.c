@@ -20,6 +20,9 @@
  */
 /*=====| INCLUDES |===========================================================*/
 #include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "utls.h"
 #include "io.h"
 #include "ccl_internal.h"
@@ -50,61 +53,1240 @@ ulong pat_in_set(Vector *set, Vector *pat){
     return index;
 }
 
-/** Check if a given pattern is in a cluster patterns set.
+/** Create a set of 'nPats' packed patterns of length 'len'.
  *
- * @param[in] clusts The network clusters.
- * @param[in] pat    The pattern to check.
+ * Every bits of the created patterns are set to 0.
  *
- * @return The cluster index containing the pattern or NOT_FOUND if the pattern
- *  dosen't belongs to any cluster.
+ * @param[in] nPats Number of patterns of the set.
+ * @param[in] len   Length of the patterns.
+ *
+ * @return The created patterns set.
+ */
+PatSet *pats_create(ulong nPats, ulong len){
+    PatSet *pats = malloc(sizeof(*pats));
+
+    pats->nPats = nPats;
+    pats->len = len;
+    pats->nWords = nb_words(len);
+    pats->bits = calloc(nPats * pats->nWords, sizeof(BitWord));
+    pats->idx = NULL;
+    pats->start = NULL;
+    pats->nOnes = calloc(nPats, sizeof(ulong));
+    pats->map = NULL;
+    if(pats->bits == NULL || pats->nOnes == NULL){
+        fprintf(stderr, "ERROR: Can't allocate %lu patterns of %lu bits\n"\
+                "Exiting...\n", nPats, len);
+        exit(12);
+    }
+    return pats;
+}
+
+/** Create a set of 'nPats' sparse patterns of length 'len'.
+ *
+ * The indexes arrays are allocated but not filled: pats->start and
+ * pats->nOnes must be set along with the indexes.
+ *
+ * @param[in] nPats   Number of patterns of the set.
+ * @param[in] len     Length of the patterns.
+ * @param[in] totOnes Number of 1 of all the patterns.
+ *
+ * @return The created patterns set.
+ */
+PatSet *pats_create_sparse(ulong nPats, ulong len, ulong totOnes){
+    PatSet *pats = malloc(sizeof(*pats));
+
+    pats->nPats = nPats;
+    pats->len = len;
+    pats->nWords = nb_words(len);
+    pats->bits = NULL;
+    pats->idx = malloc((totOnes + 1) * sizeof(uint32_t));
+    pats->start = calloc(nPats + 1, sizeof(ulong));
+    pats->nOnes = calloc(nPats, sizeof(ulong));
+    pats->map = NULL;
+    if(pats->idx == NULL || pats->start == NULL || pats->nOnes == NULL){
+        fprintf(stderr, "ERROR: Can't allocate %lu patterns of %lu bits\n"\
+                "Exiting...\n", nPats, len);
+        exit(12);
+    }
+    pats->start[nPats] = totOnes;
+    return pats;
+}
+
+/** Tell if a patterns set is better stored sparse.
+ *
+ * A sparse pattern takes 32 bits per 1 and is matched in as many probes as it
+ * has 1, a packed one takes 1 bit per value and is matched in nWords words:
+ * the patterns are stored sparse if they have at most one 1 out of
+ * SPARSE_MIN_BITS_PER_ONE values on average.
+ *
+ * @param[in] nPats   Number of patterns of the set.
+ * @param[in] len     Length of the patterns.
+ * @param[in] totOnes Number of 1 of all the patterns.
+ *
+ * @return true if the set should be created with pats_create_sparse().
+ */
+bool pats_sparse_pays(ulong nPats, ulong len, ulong totOnes){
+    return len - 1 <= UINT32_MAX &&
+           (uwide)totOnes * SPARSE_MIN_BITS_PER_ONE <= (uwide)nPats * len;
+}
+
+/** Copy a patterns set.
+ *
+ * @param[in] pats The patterns set to copy.
+ *
+ * @return The created copy, to free with pats_finalize().
  */
-ulong pat_in_clust_set(const Vector *clusts, ulong pat){
-    ulong i, j;
-	ulong prot_number = NOT_FOUND;
-    Vector *elem;
+PatSet *pats_copy(const PatSet *pats){
+    PatSet *res;
 
-	for(i = 0; i < iVector.Size(clusts); i++){
-        elem = get_pat_set(vec_get_as_clust(clusts, i));
-		for(j = 0; j < iVector.Size(elem); j++){
-			if(*(ulong *)iVector.GetElement(elem, j) == pat){
-				prot_number = i;
-				break;
+    if(pats->idx != NULL){
+        res = pats_create_sparse(pats->nPats, pats->len,
+                                 pats->start[pats->nPats]);
+        memcpy(res->idx, pats->idx, pats->start[pats->nPats] *
+                                    sizeof(uint32_t));
+        memcpy(res->start, pats->start, (pats->nPats + 1) * sizeof(ulong));
+    }
+    else{
+        res = pats_create(pats->nPats, pats->len);
+        memcpy(res->bits, pats->bits,
+               pats->nPats * pats->nWords * sizeof(BitWord));
+    }
+    memcpy(res->nOnes, pats->nOnes, pats->nPats * sizeof(ulong));
+    return res;
+}
+
+/** Free an array of a patterns set, unless it points in the binary dataset
+ * the set is mapped from (see readBin()).
+ *
+ * @param[in] pats  The patterns set.
+ * @param[in] array The array to free, can be NULL.
+ */
+void pats_release(const PatSet *pats, void *array){
+    const char *ptr = array;
+
+    if(pats->map == NULL || ptr < pats->map->data ||
+       ptr >= pats->map->data + pats->map->size){
+        free(array);
+    }
+}
+
+/** Free a patterns set created with pats_create(), pats_create_sparse() or
+ * readBin().
+ *
+ * @param[in] pats The patterns set to free.
+ */
+void pats_finalize(PatSet *pats){
+    pats_release(pats, pats->bits);
+    pats_release(pats, pats->idx);
+    pats_release(pats, pats->start);
+    pats_release(pats, pats->nOnes);
+    if(pats->map != NULL){
+        unmap_file(pats->map);
+        free(pats->map);
+    }
+    free(pats);
+}
+
+/** Keep only the first 'nPats' patterns of a packed patterns set.
+ *
+ * @param[in,out] pats  The packed patterns set.
+ * @param[in]     nPats The number of patterns to keep, at most pats->nPats.
+ */
+void pats_truncate(PatSet *pats, ulong nPats){
+    BitWord *bits;
+    ulong *nOnes;
+
+    pats->nPats = nPats;
+    if(nPats == 0){
+        return;
+    }
+    // shrinking can't fail but the blocks may move
+    bits = realloc(pats->bits, nPats * pats->nWords * sizeof(BitWord));
+    nOnes = realloc(pats->nOnes, nPats * sizeof(ulong));
+    if(bits != NULL){
+        pats->bits = bits;
+    }
+    if(nOnes != NULL){
+        pats->nOnes = nOnes;
+    }
+}
+
+/** Returns the fingerprint of a pattern of a patterns set.
+ *
+ * @param[in] pats The patterns set.
+ * @param[in] iPat The index of the pattern.
+ *
+ * @return The fingerprint (see bits_fingerprint()).
+ */
+static BitWord pat_key(const PatSet *pats, ulong iPat){
+    if(pats->idx != NULL){
+        return bits_idx_fingerprint(pat_idx(pats, iPat), pats->nOnes[iPat]);
+    }
+    return bits_fingerprint(pat_get(pats, iPat), pats->nWords);
+}
+
+/** Tell if two patterns of a patterns set are equal.
+ *
+ * @param[in] pats  The patterns set.
+ * @param[in] iPat1 The index of the first pattern.
+ * @param[in] iPat2 The index of the second pattern.
+ *
+ * @return true if the patterns are equal.
+ */
+static bool pats_equal(const PatSet *pats, ulong iPat1, ulong iPat2){
+    if(pats->nOnes[iPat1] != pats->nOnes[iPat2]){
+        return false;
+    }
+    if(pats->idx != NULL){
+        return memcmp(pat_idx(pats, iPat1), pat_idx(pats, iPat2),
+                      pats->nOnes[iPat1] * sizeof(uint32_t)) == 0;
+    }
+    return memcmp(pat_get(pats, iPat1), pat_get(pats, iPat2),
+                  pats->nWords * sizeof(BitWord)) == 0;
+}
+
+/** Copy the patterns of a set picked by a list of IDs into a new set.
+ *
+ * @param[in] pats  The patterns set.
+ * @param[in] ids   The IDs of the patterns to copy, in the new set order.
+ * @param[in] nPats The number of patterns to copy.
+ *
+ * @return The created patterns set, sparse if 'pats' is sparse.
+ */
+static PatSet *pats_pick(const PatSet *pats, const ulong *ids, ulong nPats){
+    PatSet *res;
+    ulong i;
+    ulong totOnes = 0;
+
+    for(i = 0; i < nPats; i++){
+        totOnes += pats->nOnes[ids[i]];
+    }
+    if(pats->idx != NULL){
+        res = pats_create_sparse(nPats, pats->len, totOnes);
+        for(i = 0, totOnes = 0; i < nPats; i++){
+            res->start[i] = totOnes;
+            memcpy(res->idx + totOnes, pat_idx(pats, ids[i]),
+                   pats->nOnes[ids[i]] * sizeof(uint32_t));
+            totOnes += pats->nOnes[ids[i]];
+        }
+    }
+    else{
+        res = pats_create(nPats, pats->len);
+        for(i = 0; i < nPats; i++){
+            bits_copy(pat_get(res, i), pat_get(pats, ids[i]), pats->nWords);
+        }
+    }
+    for(i = 0; i < nPats; i++){
+        res->nOnes[i] = pats->nOnes[ids[i]];
+    }
+    return res;
+}
+
+/** Collapse the copies of the patterns of a set into unique patterns.
+ *
+ * The patterns are hashed by fingerprint in an open addressing table of at
+ * least twice as much slots as there are patterns, the ones with the same
+ * fingerprint are compared.
+ *
+ * @param[in] pats The patterns set.
+ *
+ * @return The unique patterns, to free with uniq_finalize(), NULL if every
+ *  pattern of the set is unique.
+ */
+UniqPats *pats_unique(const PatSet *pats){
+    UniqPats *res;
+    ulong iPat, slot, u;
+    ulong nUniq = 0;
+    ulong nSlots = CLUSTS_START_CAPACITY;
+    ulong *uniqOf = malloc(pats->nPats * sizeof(ulong));
+    ulong *firsts = malloc(pats->nPats * sizeof(ulong));
+    BitWord *keys = malloc(pats->nPats * sizeof(BitWord));
+    ulong *slots;
+
+    while(nSlots < 2 * pats->nPats){
+        nSlots *= 2;
+    }
+    slots = malloc(nSlots * sizeof(ulong));
+    if(uniqOf == NULL || firsts == NULL || keys == NULL || slots == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the unique patterns\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    for(slot = 0; slot < nSlots; slot++){
+        slots[slot] = NOT_FOUND;
+    }
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        keys[nUniq] = pat_key(pats, iPat);
+        for(slot = keys[nUniq] & (nSlots - 1); slots[slot] != NOT_FOUND;
+            slot = (slot + 1) & (nSlots - 1)){
+            u = slots[slot];
+            if(keys[u] == keys[nUniq] && pats_equal(pats, firsts[u], iPat)){
+                break;
             }
-		}
-		if(prot_number != NOT_FOUND){
-            break;
         }
-	}
-	return prot_number;
+        if(slots[slot] == NOT_FOUND){
+            slots[slot] = nUniq;
+            firsts[nUniq++] = iPat;
+        }
+        uniqOf[iPat] = slots[slot];
+    }
+    free(slots);
+    free(keys);
+    if(nUniq == pats->nPats){
+        free(uniqOf);
+        free(firsts);
+        return NULL;
+    }
+    res = malloc(sizeof(*res));
+    if(res == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the unique patterns\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    res->pats = pats_pick(pats, firsts, nUniq);
+    res->copies = malloc(pats->nPats * sizeof(ulong));
+    res->copyStart = calloc(nUniq + 1, sizeof(ulong));
+    if(res->copies == NULL || res->copyStart == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the unique patterns\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    // count the copies, then place them by increasing ID
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        res->copyStart[uniqOf[iPat] + 1]++;
+    }
+    for(u = 0; u < nUniq; u++){
+        res->copyStart[u + 1] += res->copyStart[u];
+        firsts[u] = res->copyStart[u];
+    }
+    for(iPat = 0; iPat < pats->nPats; iPat++){
+        res->copies[firsts[uniqOf[iPat]]++] = iPat;
+    }
+    free(uniqOf);
+    free(firsts);
+    return res;
+}
+
+/** Free the unique patterns created by pats_unique().
+ *
+ * @param[in] uniq The unique patterns, can be NULL.
+ */
+void uniq_finalize(UniqPats *uniq){
+    if(uniq == NULL){
+        return;
+    }
+    pats_finalize(uniq->pats);
+    free(uniq->copies);
+    free(uniq->copyStart);
+    free(uniq);
+}
+
+/** Create an empty vocabulary of categorical datasets.
+ *
+ * @param[in] classCol The column of the class: 1 for the first one, -1 for
+ *  the last one, 0 if the lines have no class.
+ *
+ * @return The created vocabulary, to free with vocab_finalize().
+ */
+Vocab *vocab_create(long classCol){
+    Vocab *vocab = calloc(1, sizeof(*vocab));
+    ulong slot;
+
+    if(vocab == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+    vocab->classCol = classCol;
+    vocab->classIdx = NOT_FOUND;
+    vocab->nSlots = 2 * VOCAB_START_CAPACITY;
+    vocab->slots = malloc(vocab->nSlots * sizeof(ulong));
+    if(vocab->slots == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+    for(slot = 0; slot < vocab->nSlots; slot++){
+        vocab->slots[slot] = NOT_FOUND;
+    }
+    return vocab;
+}
+
+/** Set the number of values of the lines of the categorical datasets.
+ *
+ * The program exits if the class column isn't one of them.
+ *
+ * @param[in,out] vocab   The vocabulary.
+ * @param[in]     nFields The number of values of the first line, class
+ *  included.
+ * @param[in]     name    Path of the dataset, for the messages.
+ */
+void vocab_set_fields(Vocab *vocab, ulong nFields, const char *name){
+    if(vocab->classCol > (long)nFields || -vocab->classCol > (long)nFields){
+        fprintf(stderr, "\nERROR: the class column %ld doesn't exist, the "\
+                "lines of \"%s\" have %lu columns\nExiting...\n",
+                vocab->classCol, name, nFields);
+        exit(2);
+    }
+    vocab->nFields = nFields;
+    if(vocab->classCol > 0){
+        vocab->classIdx = vocab->classCol - 1;
+    }
+    else if(vocab->classCol < 0){
+        vocab->classIdx = nFields + vocab->classCol;
+    }
+    vocab->nCols = nFields - (vocab->classIdx != NOT_FOUND);
+    vocab->nValues = calloc(vocab->nCols + 1, sizeof(ulong));
+    if(vocab->nValues == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+}
+
+/** Returns the hash of a value of a column (FNV-1a).
+ *
+ * @param[in] col The column.
+ * @param[in] str The value.
+ * @param[in] len The length of the value.
+ *
+ * @return The hash.
+ */
+static uint64_t value_hash(ulong col, const char *str, ulong len){
+    uint64_t hash = 0xcbf29ce484222325ULL ^ col;
+    ulong i;
+
+    for(i = 0; i < len; i++){
+        hash = (hash ^ (unsigned char)str[i]) * 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/** Double the hash table of a vocabulary.
+ *
+ * @param[in,out] vocab The vocabulary.
+ */
+static void vocab_rehash(Vocab *vocab){
+    ulong e, slot;
+
+    vocab->nSlots *= 2;
+    free(vocab->slots);
+    vocab->slots = malloc(vocab->nSlots * sizeof(ulong));
+    if(vocab->slots == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+    for(slot = 0; slot < vocab->nSlots; slot++){
+        vocab->slots[slot] = NOT_FOUND;
+    }
+    for(e = 0; e < vocab->nEntries; e++){
+        for(slot = vocab->hashes[e] & (vocab->nSlots - 1);
+            vocab->slots[slot] != NOT_FOUND;
+            slot = (slot + 1) & (vocab->nSlots - 1));
+        vocab->slots[slot] = e;
+    }
+}
+
+/** Add a value to a vocabulary.
+ *
+ * @param[in,out] vocab The vocabulary, not frozen.
+ * @param[in]     col   The encoded column of the value.
+ * @param[in]     str   The value.
+ * @param[in]     len   The length of the value.
+ * @param[in]     hash  The hash of the value (see value_hash()).
+ * @param[in]     slot  The free slot of the value in the hash table.
+ *
+ * @return The rank of the value among the values of its column.
+ */
+static ulong vocab_add(Vocab *vocab, ulong col, const char *str, ulong len,
+                       uint64_t hash, ulong slot){
+    const ulong e = vocab->nEntries;
+
+    if(e == vocab->capacity){
+        vocab->capacity = e > 0 ? 2 * e : VOCAB_START_CAPACITY;
+        vocab->values = realloc(vocab->values,
+                                vocab->capacity * sizeof(char *));
+        vocab->lens = realloc(vocab->lens, vocab->capacity * sizeof(ulong));
+        vocab->cols = realloc(vocab->cols, vocab->capacity * sizeof(ulong));
+        vocab->ranks = realloc(vocab->ranks, vocab->capacity * sizeof(ulong));
+        vocab->hashes = realloc(vocab->hashes,
+                                vocab->capacity * sizeof(uint64_t));
+        if(vocab->values == NULL || vocab->lens == NULL ||
+           vocab->cols == NULL || vocab->ranks == NULL ||
+           vocab->hashes == NULL){
+            fprintf(stderr, "ERROR: Can't allocate the vocabulary\n"\
+                    "Exiting...\n");
+            exit(12);
+        }
+    }
+    vocab->values[e] = malloc(len + 1);
+    if(vocab->values[e] == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+    memcpy(vocab->values[e], str, len);
+    vocab->values[e][len] = '\0';
+    vocab->lens[e] = len;
+    vocab->cols[e] = col;
+    vocab->ranks[e] = vocab->nValues[col]++;
+    vocab->hashes[e] = hash;
+    vocab->slots[slot] = e;
+    vocab->nEntries++;
+    if(2 * vocab->nEntries > vocab->nSlots){
+        vocab_rehash(vocab);
+    }
+    return vocab->ranks[e];
+}
+
+/** Returns the rank of a value among the values of its column, the value is
+ * added to the vocabulary unless it is frozen.
+ *
+ * @param[in,out] vocab The vocabulary.
+ * @param[in]     col   The encoded column of the value.
+ * @param[in]     str   The value.
+ * @param[in]     len   The length of the value.
+ *
+ * @return The rank, NOT_FOUND if the vocabulary is frozen and the value isn't
+ *  one of its values.
+ */
+ulong vocab_find(Vocab *vocab, ulong col, const char *str, ulong len){
+    const uint64_t hash = value_hash(col, str, len);
+    ulong slot, e;
+
+    for(slot = hash & (vocab->nSlots - 1); vocab->slots[slot] != NOT_FOUND;
+        slot = (slot + 1) & (vocab->nSlots - 1)){
+        e = vocab->slots[slot];
+        if(vocab->hashes[e] == hash && vocab->cols[e] == col &&
+           vocab->lens[e] == len && memcmp(vocab->values[e], str, len) == 0){
+            return vocab->ranks[e];
+        }
+    }
+    if(vocab->frozen){
+        return NOT_FOUND;
+    }
+    return vocab_add(vocab, col, str, len, hash, slot);
+}
+
+/** Freeze a vocabulary: the bits of its values are set once for all.
+ *
+ * @param[in,out] vocab The vocabulary.
+ */
+void vocab_freeze(Vocab *vocab){
+    ulong col;
+
+    vocab->start = malloc((vocab->nCols + 1) * sizeof(ulong));
+    if(vocab->start == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the vocabulary\nExiting...\n");
+        exit(12);
+    }
+    vocab->start[0] = 0;
+    for(col = 0; col < vocab->nCols; col++){
+        vocab->start[col + 1] = vocab->start[col] + vocab->nValues[col];
+    }
+    vocab->frozen = true;
+}
+
+/** Free a vocabulary created with vocab_create().
+ *
+ * @param[in] vocab The vocabulary, can be NULL.
+ */
+void vocab_finalize(Vocab *vocab){
+    ulong e;
+
+    if(vocab == NULL){
+        return;
+    }
+    for(e = 0; e < vocab->nEntries; e++){
+        free(vocab->values[e]);
+    }
+    free(vocab->values);
+    free(vocab->lens);
+    free(vocab->cols);
+    free(vocab->ranks);
+    free(vocab->hashes);
+    free(vocab->slots);
+    free(vocab->nValues);
+    free(vocab->start);
+    free(vocab);
+}
+
+/** Allocate an array aligned on a cache line, exit if there's no memory.
+ *
+ * @param[in] size The size of the array in bytes.
+ *
+ * @return The allocated array.
+ */
+static void *aligned_malloc(size_t size){
+    void *res = NULL;
+
+    if(posix_memalign(&res, CACHE_LINE, size > 0 ? size : CACHE_LINE) != 0){
+        fprintf(stderr, "ERROR: Can't allocate %zu bytes\nExiting...\n", size);
+        exit(12);
+    }
+    return res;
+}
+
+/** Resize the columns of the bit-sliced index of a clusters store.
+ *
+ * @param[in,out] clusts   The clusters store.
+ * @param[in]     colWords The new number of words of each column.
+ */
+static void clusts_resize_cols(ClustStore *clusts, ulong colWords){
+    ulong bit;
+    BitWord *cols = aligned_malloc(clusts->len * colWords * sizeof(BitWord));
+
+    memset(cols, 0, clusts->len * colWords * sizeof(BitWord));
+    for(bit = 0; bit < clusts->len && clusts->cols != NULL; bit++){
+        memcpy(cols + bit * colWords, clust_col(clusts, bit),
+               clusts->colWords * sizeof(BitWord));
+    }
+    free(clusts->cols);
+    clusts->cols = cols;
+    clusts->colWords = colWords;
+}
+
+/** Copy the prototype of a cluster to the bit-sliced index.
+ *
+ * @param[in,out] clusts The clusters store, nothing is done if it has no
+ *  index.
+ * @param[in]     iClust The index of the cluster.
+ */
+static void clusts_sync_col(ClustStore *clusts, ulong iClust){
+    ulong bit;
+    const BitWord *prot = clust_prot(clusts, iClust);
+    BitWord *col;
+
+    if(clusts->cols == NULL){
+        return;
+    }
+    col = clusts->cols + iClust / WORD_BITS;
+    for(bit = 0; bit < clusts->len; bit++, col += clusts->colWords){
+        if(bit_get(prot, bit)){
+            *col |= bit_mask(iClust);
+        }
+        else{
+            *col &= ~bit_mask(iClust);
+        }
+    }
+}
+
+/** Chain a cluster in the prototypes hash table.
+ *
+ * @param[in,out] clusts The clusters store.
+ * @param[in]     iClust The index of the cluster, its fingerprint is set.
+ */
+static void clusts_link_key(ClustStore *clusts, ulong iClust){
+    ulong *head = &clusts->keyHeads[clusts->protKeys[iClust] %
+                                    clusts->capacity];
+
+    clusts->keyPrev[iClust] = NOT_FOUND;
+    clusts->keyNext[iClust] = *head;
+    if(*head != NOT_FOUND){
+        clusts->keyPrev[*head] = iClust;
+    }
+    *head = iClust;
 }
 
-/** Push each pattern of a list of CSVLine structures into a vector.
+/** Unchain a cluster from the prototypes hash table.
  *
- * @param[in] lines The list of CSVLine structures.
+ * @param[in,out] clusts The clusters store.
+ * @param[in]     iClust The index of the cluster.
+ */
+static void clusts_unlink_key(ClustStore *clusts, ulong iClust){
+    ulong next = clusts->keyNext[iClust];
+    ulong prev = clusts->keyPrev[iClust];
+
+    if(prev == NOT_FOUND){
+        clusts->keyHeads[clusts->protKeys[iClust] % clusts->capacity] = next;
+    }
+    else{
+        clusts->keyNext[prev] = next;
+    }
+    if(next != NOT_FOUND){
+        clusts->keyPrev[next] = prev;
+    }
+}
+
+/** Resize the prototypes hash table to the capacity of a clusters store and
+ * chain every clusters again.
  *
- * @return The created vector containing the patterns.
+ * @param[in,out] clusts The clusters store.
  */
-void line_val_to_vec(Vector *res, List *lines){
+static void clusts_rehash(ClustStore *clusts){
     ulong i;
+    const ulong capacity = clusts->capacity;
 
-    for(i = 0; i < iList.Size(lines); i++){
-        vec_pushback(res, (*(CSVLine *)iList.GetElement(lines, i)).val);
+    clusts->protKeys = realloc(clusts->protKeys, capacity * sizeof(BitWord));
+    clusts->keyHeads = realloc(clusts->keyHeads, capacity * sizeof(ulong));
+    clusts->keyNext = realloc(clusts->keyNext, capacity * sizeof(ulong));
+    clusts->keyPrev = realloc(clusts->keyPrev, capacity * sizeof(ulong));
+    if(clusts->protKeys == NULL || clusts->keyHeads == NULL ||
+       clusts->keyNext == NULL || clusts->keyPrev == NULL){
+        fprintf(stderr, "ERROR: Can't allocate %lu clusters\nExiting...\n",
+                capacity);
+        exit(12);
+    }
+    for(i = 0; i < capacity; i++){
+        clusts->keyHeads[i] = NOT_FOUND;
+    }
+    for(i = 0; i < clusts->size; i++){
+        clusts_link_key(clusts, i);
     }
 }
 
-/** Push each class variable of a list of CSVLine structures into a vector.
+/** Grow the arrays of a clusters store so it can hold 'capacity' clusters.
  *
- * @note The elements of the vector or of variable size so we must create the 
- *  vector with sizeof(void *) and push a pointer to the elements.
+ * @param[in,out] clusts   The clusters store.
+ * @param[in]     capacity The new capacity.
+ */
+static void clusts_reserve(ClustStore *clusts, ulong capacity){
+    ulong i;
+    BitWord *prots = aligned_malloc(capacity * clusts->nWords *
+                                    sizeof(BitWord));
+
+    if(clusts->size > 0){
+        memcpy(prots, clusts->prots, clusts->size * clusts->nWords *
+               sizeof(BitWord));
+    }
+    free(clusts->prots);
+    clusts->prots = prots;
+    clusts->nOnes = realloc(clusts->nOnes, capacity * sizeof(ulong));
+    clusts->patSets = realloc(clusts->patSets, capacity * sizeof(Vector *));
+    clusts->bitCounts = realloc(clusts->bitCounts,
+                                capacity * clusts->len * sizeof(uint32_t));
+    if(clusts->nOnes == NULL || clusts->patSets == NULL ||
+       clusts->bitCounts == NULL){
+        fprintf(stderr, "ERROR: Can't allocate %lu clusters\nExiting...\n",
+                capacity);
+        exit(12);
+    }
+    for(i = clusts->capacity; i < capacity; i++){
+        clusts->patSets[i] = NULL;
+    }
+    if(clusts->cols != NULL){
+        clusts_resize_cols(clusts, nb_words(capacity));
+    }
+    clusts->capacity = capacity;
+    clusts_rehash(clusts);
+}
+
+/** Create an empty clusters store for prototypes of length 'len'.
  *
- * @param[in] lines The list of CSVLine structures.
+ * @param[in] len The length of the prototypes.
  *
- * @return The created vector containing the classes names.
+ * @return The created clusters store.
  */
-void line_class_to_vec(Vector *res, List *lines){
+ClustStore *clusts_create(ulong len){
+    ClustStore *clusts = calloc(1, sizeof(*clusts));
+
+    clusts->len = len;
+    clusts->nWords = nb_words(len);
+    clusts_reserve(clusts, CLUSTS_START_CAPACITY);
+    return clusts;
+}
+
+/** Free a clusters store created with clusts_create().
+ *
+ * @param[in] clusts The clusters store to free.
+ */
+void clusts_finalize(ClustStore *clusts){
     ulong i;
 
-    for(i = 0; i < iList.Size(lines); i++){
-        vec_pushback(res, &(*(CSVLine *)iList.GetElement(lines, i)).class);
+    if(clusts == NULL){
+        return;
+    }
+    for(i = 0; i < clusts->capacity; i++){
+        if(clusts->patSets[i] != NULL){
+            iVector.Finalize(clusts->patSets[i]);
+        }
+    }
+    free(clusts->prots);
+    free(clusts->nOnes);
+    free(clusts->patSets);
+    free(clusts->bitCounts);
+    free(clusts->cols);
+    free(clusts->protKeys);
+    free(clusts->keyHeads);
+    free(clusts->keyNext);
+    free(clusts->keyPrev);
+    free(clusts);
+}
+
+/** Add a cluster at the end of a clusters store.
+ *
+ * The prototype and the counters of the new cluster are set to 0, its
+ * patterns set is empty. The patterns set left by a removed cluster is reused
+ * if there is one.
+ *
+ * @param[in,out] clusts The clusters store.
+ *
+ * @return The index of the new cluster.
+ */
+ulong clusts_push(ClustStore *clusts){
+    ulong iClust = clusts->size;
+
+    if(clusts->size == clusts->capacity){
+        clusts_reserve(clusts, clusts->capacity * 2);
+    }
+    memset(clust_prot(clusts, iClust), 0, clusts->nWords * sizeof(BitWord));
+    memset(clust_bit_count(clusts, iClust), 0, clusts->len * sizeof(uint32_t));
+    clusts->nOnes[iClust] = 0;
+    clusts_sync_col(clusts, iClust);
+    clusts->protKeys[iClust] = 0;
+    clusts_link_key(clusts, iClust);
+    if(clusts->patSets[iClust] == NULL){
+        clusts->patSets[iClust] = iVector.Create(sizeof(ulong), 1);
+    }
+    clusts->size++;
+    return iClust;
+}
+
+/** Remove a cluster from a clusters store.
+ *
+ * The last cluster is moved at index 'iClust' so nothing has to be shifted.
+ * The patterns set of the removed cluster is cleared and kept after the last
+ * cluster to be reused by clusts_push().
+ *
+ * @param[in,out] clusts The clusters store.
+ * @param[in]     iClust The index of the cluster to remove.
+ */
+void clusts_swap_remove(ClustStore *clusts, ulong iClust){
+    ulong last = clusts->size - 1;
+    Vector *patSet = clusts->patSets[iClust];
+
+    vec_clear(patSet);
+    clusts_unlink_key(clusts, iClust);
+    if(iClust != last){
+        clusts_unlink_key(clusts, last);
+        memcpy(clust_prot(clusts, iClust), clust_prot(clusts, last),
+               clusts->nWords * sizeof(BitWord));
+        memcpy(clust_bit_count(clusts, iClust), clust_bit_count(clusts, last),
+               clusts->len * sizeof(uint32_t));
+        clusts->nOnes[iClust] = clusts->nOnes[last];
+        clusts->patSets[iClust] = clusts->patSets[last];
+        clusts->patSets[last] = patSet;
+        clusts->protKeys[iClust] = clusts->protKeys[last];
+        clusts_sync_col(clusts, iClust);
+        clusts_link_key(clusts, iClust);
+    }
+    clusts->size--;
+}
+
+/** Build the bit-sliced index of the prototypes of a clusters store.
+ *
+ * The index stores the prototypes by column: for each bit index, the bits of
+ * every prototypes at this index are packed in a column. The number of 1 a
+ * pattern has in common with every prototypes is then the sum of the columns
+ * of the 1 of the pattern. Once built, the index is kept up to date by
+ * clusts_push(), clusts_swap_remove() and clusts_sync_prot().
+ *
+ * @param[in,out] clusts The clusters store, nothing is done if it already has
+ *  an index.
+ */
+void clusts_index(ClustStore *clusts){
+    ulong iClust;
+
+    if(clusts->cols != NULL){
+        return;
+    }
+    clusts_resize_cols(clusts, nb_words(clusts->capacity));
+    for(iClust = 0; iClust < clusts->size; iClust++){
+        clusts_sync_col(clusts, iClust);
+    }
+}
+
+/** Update the bit-sliced index and the fingerprint of a modified prototype.
+ *
+ * It must be called every time a prototype is modified.
+ *
+ * @param[in,out] clusts The clusters store.
+ * @param[in]     iClust The index of the modified cluster.
+ */
+void clusts_sync_prot(ClustStore *clusts, ulong iClust){
+    clusts_sync_col(clusts, iClust);
+    clusts_unlink_key(clusts, iClust);
+    clusts->protKeys[iClust] = bits_fingerprint(clust_prot(clusts, iClust),
+                                                clusts->nWords);
+    clusts_link_key(clusts, iClust);
+}
+
+/** Returns the first cluster whose prototype has a given fingerprint.
+ *
+ * The clusters having the fingerprint are enumerated with clusts_key_next(),
+ * in no particular order. Their prototypes still have to be compared to the
+ * pattern the fingerprint comes from.
+ *
+ * @param[in] clusts The clusters store.
+ * @param[in] key    The fingerprint.
+ *
+ * @return The index of the cluster, NOT_FOUND if there's none.
+ */
+ulong clusts_key_first(const ClustStore *clusts, BitWord key){
+    ulong iClust = clusts->keyHeads[key % clusts->capacity];
+
+    while(iClust != NOT_FOUND && clusts->protKeys[iClust] != key){
+        iClust = clusts->keyNext[iClust];
+    }
+    return iClust;
+}
+
+/** Returns the next cluster whose prototype has the fingerprint of a given
+ * cluster (see clusts_key_first()).
+ *
+ * @param[in] clusts The clusters store.
+ * @param[in] iClust The index of the current cluster.
+ *
+ * @return The index of the next cluster, NOT_FOUND if there's none.
+ */
+ulong clusts_key_next(const ClustStore *clusts, ulong iClust){
+    const BitWord key = clusts->protKeys[iClust];
+
+    do{
+        iClust = clusts->keyNext[iClust];
+    } while(iClust != NOT_FOUND && clusts->protKeys[iClust] != key);
+    return iClust;
+}
+
+/** Allocate a chunk of a concurrent clusters table.
+ *
+ * @param[in] hog The clusters table.
+ *
+ * @return The allocated chunk, none of its clusters is ready.
+ */
+static HogChunk *hog_chunk_create(const HogStore *hog){
+    HogChunk *chunk = malloc(sizeof(*chunk));
+
+    if(chunk == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the clusters table\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    chunk->prots = aligned_malloc(HOG_CHUNK_CLUSTS * hog->nWords *
+                                  sizeof(BitWord));
+    chunk->nOnes = aligned_malloc(HOG_CHUNK_CLUSTS * sizeof(ulong));
+    chunk->ready = calloc(HOG_CHUNK_CLUSTS, sizeof(int));
+    if(chunk->ready == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the clusters table\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    return chunk;
+}
+
+/** Free a chunk of a concurrent clusters table.
+ *
+ * @param[in] chunk The chunk to free.
+ */
+static void hog_chunk_finalize(HogChunk *chunk){
+    free(chunk->prots);
+    free(chunk->nOnes);
+    free(chunk->ready);
+    free(chunk);
+}
+
+/** Create a concurrent clusters table holding the prototypes of a clusters
+ * store.
+ *
+ * The clusters keep their index.
+ *
+ * @param[in] clusts    The clusters store.
+ * @param[in] maxClusts The maximum number of clusters of the table.
+ *
+ * @return The created clusters table.
+ */
+HogStore *hog_create(const ClustStore *clusts, ulong maxClusts){
+    ulong i, iClust;
+    HogStore *hog = calloc(1, sizeof(*hog));
+
+    if(hog == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the clusters table\n"\
+                "Exiting...\n");
+        exit(12);
+    }
+    hog->len = clusts->len;
+    hog->nWords = clusts->nWords;
+    hog->nChunks = maxClusts / HOG_CHUNK_CLUSTS + 1;
+    hog->chunks = calloc(hog->nChunks, sizeof(HogChunk *));
+    if(hog->chunks == NULL){
+        fprintf(stderr, "ERROR: Can't allocate the clusters table\n"\
+                "Exiting...\n");
+        exit(12);
     }
+    for(i = 0; i < clusts->size; i++){
+        iClust = hog_reserve(hog);
+        memcpy(hog_prot(hog, iClust), clust_prot(clusts, i),
+               hog->nWords * sizeof(BitWord));
+        hog_publish(hog, iClust, clusts->nOnes[i]);
+    }
+    return hog;
+}
+
+/** Free a concurrent clusters table created with hog_create().
+ *
+ * @param[in] hog The clusters table to free.
+ */
+void hog_finalize(HogStore *hog){
+    ulong i;
+
+    for(i = 0; i < hog->nChunks; i++){
+        if(hog->chunks[i] != NULL){
+            hog_chunk_finalize(hog->chunks[i]);
+        }
+    }
+    free(hog->chunks);
+    free(hog);
+}
+
+/** Add a cluster at the end of a concurrent clusters table.
+ *
+ * The cluster can only be read once its prototype is written and
+ * hog_publish() is called. If its chunk isn't allocated yet the thread
+ * allocates it, only the first allocation is kept if several threads do.
+ *
+ * @param[in,out] hog The clusters table.
+ *
+ * @return The index of the new cluster.
+ */
+ulong hog_reserve(HogStore *hog){
+    const ulong iClust = __atomic_fetch_add(&hog->size, 1, __ATOMIC_ACQ_REL);
+    HogChunk *chunk;
+    HogChunk *expected = NULL;
+    HogChunk **slot;
+
+    if(iClust / HOG_CHUNK_CLUSTS >= hog->nChunks){
+        fprintf(stderr, "ERROR: The clusters table is full\nExiting...\n");
+        exit(12);
+    }
+    slot = &hog_chunk(hog, iClust);
+    if(__atomic_load_n(slot, __ATOMIC_ACQUIRE) == NULL){
+        chunk = hog_chunk_create(hog);
+        if(!__atomic_compare_exchange_n(slot, &expected, chunk, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            hog_chunk_finalize(chunk);
+        }
+    }
+    return iClust;
+}
+
+/** Make a cluster added by hog_reserve() readable by every threads.
+ *
+ * @param[in,out] hog    The clusters table.
+ * @param[in]     iClust The index of the cluster, its prototype written.
+ * @param[in]     nOnes  The number of 1 of the prototype.
+ */
+void hog_publish(HogStore *hog, ulong iClust, ulong nOnes){
+    *hog_ones(hog, iClust) = nOnes;
+    __atomic_store_n(&hog_chunk(hog, iClust)->ready[iClust % HOG_CHUNK_CLUSTS],
+                     1, __ATOMIC_RELEASE);
+}
+
+/** Tell if a cluster of a concurrent clusters table can be read.
+ *
+ * @param[in] hog    The clusters table.
+ * @param[in] iClust The index of the cluster, lower than hog->size.
+ *
+ * @return true if the cluster has been published.
+ */
+bool hog_is_ready(HogStore *hog, ulong iClust){
+    HogChunk *chunk = __atomic_load_n(&hog_chunk(hog, iClust),
+                                      __ATOMIC_ACQUIRE);
+
+    return chunk != NULL &&
+           __atomic_load_n(&chunk->ready[iClust % HOG_CHUNK_CLUSTS],
+                           __ATOMIC_ACQUIRE);
+}
+
+/** Set the class of every clusters: the prominent class of its patterns.
+ *
+ * If two classes are equally prominent, the one of the first pattern of the
+ * training set wins.
+ *
+ * @param[out] clustsClass The vector receiving one class per cluster.
+ * @param[in]  clusts      The network clusters.
+ * @param[in]  patsClass   The classes of the training patterns.
+ */
+void clusts_major_classes(Vector *clustsClass, ClustStore *clusts,
+                          Vector *patsClass){
+    ulong i, j, iClust;
+    char *class;
+    Vector *patSet;         // Vector of ulongs
+    Vector *uniqueClasses;  // Vector of strings
+    ulong *classesRep;
+    ulong best;
+
+    uniqueClasses = iVector.Create(sizeof(void *), 1);
+    for(i = 0; i < vec_size(patsClass); i++){
+        class = vec_get_as_str(patsClass, i);
+        for(j = 0; j < vec_size(uniqueClasses); j++){
+            if(strcmp(class, vec_get_as_str(uniqueClasses, j)) == 0){
+                break;
+            }
+        }
+        if(j == vec_size(uniqueClasses)){
+            vec_pushback(uniqueClasses, &class);
+        }
+    }
+    classesRep = malloc(vec_size(uniqueClasses) * sizeof(ulong));
+    for(iClust = 0; iClust < clusts->size; iClust++){
+        patSet = clust_pat_set(clusts, iClust);
+        memset(classesRep, 0, vec_size(uniqueClasses) * sizeof(ulong));
+        for(i = 0; i < vec_size(patSet); i++){
+            class = vec_get_as_str(patsClass, vec_get_as_ulong(patSet, i));
+            for(j = 0; j < vec_size(uniqueClasses); j++){
+                if(strcmp(class, vec_get_as_str(uniqueClasses, j)) == 0){
+                    classesRep[j]++;
+                    break;
+                }
+            }
+        }
+        best = 0;
+        for(j = 1; j < vec_size(uniqueClasses); j++){
+            if(classesRep[j] > classesRep[best]){
+                best = j;
+            }
+        }
+        class = vec_get_as_str(uniqueClasses, best);
+        vec_pushback(clustsClass, &class);
+    }
+    free(classesRep);
+    iVector.Finalize(uniqueClasses);
+}
+
+/** Count the training patterns whose class is the class of their cluster.
+ *
+ * @param[in] clusts      The network clusters.
+ * @param[in] patsClass   The classes of the training patterns.
+ * @param[in] clustsClass The classes of the clusters.
+ *
+ * @return The number of training patterns matching their cluster class.
+ */
+ulong clusts_class_matches(ClustStore *clusts, Vector *patsClass,
+                           Vector *clustsClass){
+    ulong i, iClust;
+    ulong success = 0;
+    char *clustClass;
+    Vector *patSet;     // Vector of ulongs
+
+    for(iClust = 0; iClust < clusts->size; iClust++){
+        patSet = clust_pat_set(clusts, iClust);
+        clustClass = vec_get_as_str(clustsClass, iClust);
+        for(i = 0; i < vec_size(patSet); i++){
+            if(strcmp(clustClass, vec_get_as_str(patsClass,
+                      vec_get_as_ulong(patSet, i))) == 0){
+                success++;
+            }
+        }
+    }
+    return success;
+}
+
+/** Returns a float as a fraction whose denominator is a power of two.
+ *
+ * A float is mant * 2^exp with an integer mant of 24 bits, so the fraction is
+ * exact as long as the denominator stays below 2^RATIO_MAX_SHIFT. The values
+ * needing a bigger denominator are rounded to the nearest multiple of
+ * 2^-RATIO_MAX_SHIFT.
+ *
+ * @param[in] value The value, 0 or negative values give 0.
+ *
+ * @return The fraction.
+ */
+Ratio ratio_from_float(float value){
+    Ratio res = {0, 1};
+    int exp;
+    int shift;
+
+    if(!(value > 0)){
+        return res;
+    }
+    res.num = (ulong)ldexpf(frexpf(value, &exp), 24);
+    exp -= 24;
+    if(exp >= 0){
+        if(exp > 63 - 24){
+            fprintf(stderr, "ERROR: %g is too big to be used as a parameter\n"\
+                    "Exiting...\n", value);
+            exit(14);
+        }
+        res.num <<= exp;
+        return res;
+    }
+    // drop the trailing 0 of the numerator
+    while(exp < 0 && (res.num & 1) == 0){
+        res.num >>= 1;
+        exp++;
+    }
+    if(exp < -RATIO_MAX_SHIFT){
+        shift = -RATIO_MAX_SHIFT - exp;
+        res.num = shift < 64 ? (res.num + (1UL << (shift - 1))) >> shift : 0;
+        exp = -RATIO_MAX_SHIFT;
+    }
+    res.den = 1UL << -exp;
+    return res;
+}
+
+/** Seed a random generator.
+ *
+ * The generator gives the same numbers as rand() after srand(seed), but its
+ * state belongs to the caller so several networks can be trained at once.
+ *
+ * @param[out] rng  The random generator.
+ * @param[in]  seed The seed.
+ */
+void rng_seed(Rng *rng, unsigned int seed){
+    memset(rng, 0, sizeof(*rng));
+    initstate_r(seed, rng->state, sizeof(rng->state), &rng->data);
+}
+
+/** Returns the next number of a random generator.
+ *
+ * @param[in,out] rng The random generator.
+ *
+ * @return A number between 0 and RAND_MAX.
+ */
+int rng_next(Rng *rng){
+    int32_t res;
+
+    random_r(&rng->data, &res);
+    return res;
+}
+
+#ifdef COUNT_ALLOCS
+/* In a debug build the program is linked with --wrap for each allocation
+ * function (see CMakeLists.txt): every call made by the program and by ccl
+ * lands here first and is counted.
+ */
+static ulong allocCount = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size){
+    allocCount++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size){
+    allocCount++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+    allocCount++;
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size){
+    allocCount++;
+    return __real_posix_memalign(memptr, alignment, size);
+}
+
+/** Returns the number of heap allocations made since the program started.
+ *
+ * Only available in a debug build.
+ *
+ * @return The number of calls to malloc(), calloc(), realloc() and
+ *  posix_memalign().
+ */
+ulong alloc_count(void){
+    return allocCount;
 }
+#endif
@@ -3,11 +3,26 @@
 
 /*=====| INCLUDES |===========================================================*/
 #include <stdbool.h>
+#include <stdlib.h>
 #include <limits.h>
 #include "containers.h"
+#include "bitpat.h"
+#include "pool.h"
 
 /*=====| DEFINES |============================================================*/
 #define NOT_FOUND ULONG_MAX
+#define CACHE_LINE 64
+#define CLUSTS_START_CAPACITY 16
+// Maximum power of two of the denominators of the Ratio structures
+#define RATIO_MAX_SHIFT 32
+// Patterns are stored sparse if they have at most 1 bit set out of this many
+#define SPARSE_MIN_BITS_PER_ONE 64
+// Maximum number of best matching clusters kept for a training pattern
+#define MATCH_MAX_TIES 8
+// Number of clusters of each chunk of a concurrent clusters table
+#define HOG_CHUNK_CLUSTS 256
+// Number of values a vocabulary of categorical datasets holds before growing
+#define VOCAB_START_CAPACITY 64
 #define TRAIN 200
 #define TEST 300
 #define vec_get_as_str(pat, idx) *(char **)iVector.GetElement(pat, idx)
@@ -16,8 +31,6 @@
 #define vec_get_as_ulong(pat, idx) *(ulong *)iVector.GetElement(pat, idx)
 #define vec_get_as_size_t(pat, idx) *(size_t *)iVector.GetElement(pat, idx)
 #define vec_get_as_vec(pat, idx) (Vector *)iVector.GetElement(pat, idx)
-#define vec_get_as_clust(pat, idx) *(Cluster *)iVector.GetElement(pat, idx)
-#define vec_get_as_CSVLine(pat, idx) *(CSVLine *)iVector.GetElement(pat, idx)
 #define vec_get(pat, idx) iVector.GetElement(pat, idx)
 #define vec_size(vec) iVector.Size(vec)
 #define vec_replace_at(vec, idx, data) iVector.ReplaceAt(vec, idx, data)
@@ -28,51 +41,495 @@
 #define vec_copy(vec) iVector.Copy(vec)
 #define vec_equal(vec1, vec2) iVector.Copy(vec)
 #define vec_set_cmp_fun(vec, fun) iVector.SetCompareFunction(vec, fun)
-#define get_pat_set(clust) (&clust)->patSet
-#define get_prot(clust) (&clust)->prot
-#define get_inhib(clust) (&clust)->inhib
+#define clust_prot(clusts, idx) ((clusts)->prots + (idx) * (clusts)->nWords)
+#define clust_bit_count(clusts, idx) \
+    ((clusts)->bitCounts + (idx) * (clusts)->len)
+#define clust_pat_set(clusts, idx) (clusts)->patSets[idx]
+#define clust_col(clusts, bit) ((clusts)->cols + (bit) * (clusts)->colWords)
+#define pat_get(pats, idx) ((pats)->bits + (idx) * (pats)->nWords)
+#define pat_idx(pats, i) ((pats)->idx + (pats)->start[i])
+#define hog_chunk(hog, i) (hog)->chunks[(i) / HOG_CHUNK_CLUSTS]
+#define hog_prot(hog, i) \
+    (hog_chunk(hog, i)->prots + ((i) % HOG_CHUNK_CLUSTS) * (hog)->nWords)
+#define hog_ones(hog, i) (&hog_chunk(hog, i)->nOnes[(i) % HOG_CHUNK_CLUSTS])
 
 /*=====| TYPEDEFS & STRUCTURES |==============================================*/
 typedef unsigned long ulong;    // For the sake of clarity
+typedef unsigned __int128 uwide;    // Holds the scores cross-products
 
-/** The structure holds an input file line.
+/** The structure holds the state of a random generator (see rng_seed()).
  */
 typedef struct {
-   /** @var CSVLine::class
-    * The class is the first column of every valid line of the input dataset 
-    * file (for now, it can only be the first column). In the mushrooms dataset
-    * it can be 'p' for poisonous or 'e' for edible
+    /** @var Rng::data
+     * The generator, as used by random_r().
+     */
+    struct random_data data;
+
+    /** @var Rng::state
+     * The state array of the generator (the size used by rand()).
+     */
+    char state[128];
+} Rng;
+
+/** The structure holds the content of an input file (see io.c).
+ */
+typedef struct {
+   /** @var FileMap::data
+    * The bytes of the file. The file is mapped in memory, or read in a
+    * buffer if it can't be mapped (e.g.: a pipe or an empty file).
+    */
+    char *data;
+
+   /** @var FileMap::size
+    * The number of bytes of the file.
+    */
+    size_t size;
+
+   /** @var FileMap::mapped
+    * Tell if 'data' is mapped (or an allocated buffer).
+    */
+    bool mapped;
+} FileMap;
+
+/** The structure holds the header of a binary dataset (see writeBin()).
+ *
+ * The header is followed by sections starting on BIN_ALIGN bytes: the
+ * patterns (packed, or the indexes of their 1 and the start of each pattern
+ * if sparse), the number of 1 of each pattern, the class of each pattern and
+ * the distinct classes.
+ */
+typedef struct {
+   /** @var BinHeader::magic
+    * BIN_MAGIC, NUL terminated.
+    */
+    char magic[8];
+
+   /** @var BinHeader::version
+    * The version of the format, BIN_VERSION.
+    */
+    uint32_t version;
+
+   /** @var BinHeader::sparse
+    * 1 if the patterns are stored sparse, 0 if they are packed.
+    */
+    uint32_t sparse;
+
+   /** @var BinHeader::nPats
+    * The number of patterns.
+    */
+    uint64_t nPats;
+
+   /** @var BinHeader::len
+    * The length of the patterns.
+    */
+    uint64_t len;
+
+   /** @var BinHeader::nZeros
+    * The number of patterns made of 0 only dropped from the csv file.
+    */
+    uint64_t nZeros;
+
+   /** @var BinHeader::totOnes
+    * The number of 1 of every patterns.
+    */
+    uint64_t totOnes;
+
+   /** @var BinHeader::density
+    * The proportion of 1 in the patterns: totOnes / (nPats * len).
+    */
+    double density;
+
+   /** @var BinHeader::nNames
+    * The number of distinct classes.
+    */
+    uint64_t nNames;
+
+   /** @var BinHeader::bitsOff
+    * The offset of the packed patterns, or of the indexes of their 1 (32 bits
+    * each) if they are sparse.
+    */
+    uint64_t bitsOff;
+
+   /** @var BinHeader::startOff
+    * The offset of the start of each sparse pattern in the indexes (nPats + 1
+    * values), 0 if the patterns are packed.
+    */
+    uint64_t startOff;
+
+   /** @var BinHeader::nOnesOff
+    * The offset of the number of 1 of each pattern.
+    */
+    uint64_t nOnesOff;
+
+   /** @var BinHeader::classesOff
+    * The offset of the class of each pattern, its index in the distinct
+    * classes (32 bits each).
+    */
+    uint64_t classesOff;
+
+   /** @var BinHeader::namesOff
+    * The offset of the distinct classes, NUL terminated strings one after
+    * the other.
+    */
+    uint64_t namesOff;
+
+   /** @var BinHeader::size
+    * The size of the file.
+    */
+    uint64_t size;
+
+   /** @var BinHeader::checksum
+    * The checksum of everything following the header (see bin_checksum()).
+    */
+    uint64_t checksum;
+} BinHeader;
+
+/** The structure holds a set of binary patterns.
+ *
+ * A set is either dense or sparse, depending on the density of its patterns
+ * (see pats_sparse_pays()):
+ *  - Dense: every patterns are packed one after the other in a single array
+ *    so the pattern at index i starts at word i * nWords (see pat_get()).
+ *  - Sparse: every patterns are stored as the sorted list of the indexes of
+ *    their 1, one list after the other (see pat_idx()).
+ */
+typedef struct {
+   /** @var PatSet::bits
+    * The packed patterns, nWords words per pattern (see bitpat.c). NULL if
+    * the set is sparse.
+    */
+    BitWord *bits;
+
+   /** @var PatSet::idx
+    * The indexes of the 1 of every patterns, in increasing order for each
+    * pattern. NULL if the set is dense.
+    */
+    uint32_t *idx;
+
+   /** @var PatSet::start
+    * The index in 'idx' of the first 1 of each pattern, plus the total
+    * number of 1 at index nPats. NULL if the set is dense.
+    */
+    ulong *start;
+
+   /** @var PatSet::nPats
+    * The number of patterns of the set.
+    */
+    ulong nPats;
+
+   /** @var PatSet::len
+    * The length of the patterns (their number of bits).
+    */
+    ulong len;
+
+   /** @var PatSet::nWords
+    * The number of words used by each pattern.
+    */
+    ulong nWords;
+
+   /** @var PatSet::nOnes
+    * The number of 1 of each pattern, computed once when the patterns are
+    * interned and kept up to date when noise is added.
+    */
+    ulong *nOnes;
+
+   /** @var PatSet::map
+    * The binary dataset the arrays point in (see readBin()), NULL if they are
+    * allocated. The file is mapped copy-on-write so the noise can be added
+    * to the patterns in place.
+    */
+    FileMap *map;
+} PatSet;
+
+/** The structure holds the vocabulary of categorical datasets: the distinct
+ * values of each column and the bit encoding each one (see
+ * readCategorical()).
+ *
+ * The bit of a value is start[c] plus the rank of the value among the values
+ * of its column c, in the order they first appear. The values are found
+ * through an open addressing hash table of their indexes.
+ */
+typedef struct {
+   /** @var Vocab::classCol
+    * The column of the class: 1 for the first one, -1 for the last one, 0 if
+    * the lines have no class.
+    */
+    long classCol;
+
+   /** @var Vocab::nFields
+    * The number of values of the lines, class included. 0 until the first
+    * line is read.
+    */
+    ulong nFields;
+
+   /** @var Vocab::classIdx
+    * The index of the class among the values of the lines, NOT_FOUND if the
+    * lines have no class.
+    */
+    ulong classIdx;
+
+   /** @var Vocab::nCols
+    * The number of encoded columns (every columns but the class).
+    */
+    ulong nCols;
+
+   /** @var Vocab::nValues
+    * The number of distinct values of each encoded column.
+    */
+    ulong *nValues;
+
+   /** @var Vocab::start
+    * The first bit of each encoded column, plus the length of the patterns
+    * at index nCols. NULL until the vocabulary is frozen.
+    */
+    ulong *start;
+
+   /** @var Vocab::values
+    * The distinct values, in the order they first appear.
+    */
+    char **values;
+
+   /** @var Vocab::lens
+    * The length of each value.
+    */
+    ulong *lens;
+
+   /** @var Vocab::cols
+    * The encoded column of each value.
+    */
+    ulong *cols;
+
+   /** @var Vocab::ranks
+    * The rank of each value among the values of its column.
+    */
+    ulong *ranks;
+
+   /** @var Vocab::hashes
+    * The hash of each value along with its column.
+    */
+    uint64_t *hashes;
+
+   /** @var Vocab::nEntries
+    * The number of distinct values.
+    */
+    ulong nEntries;
+
+   /** @var Vocab::capacity
+    * The number of values the arrays can hold before growing.
+    */
+    ulong capacity;
+
+   /** @var Vocab::slots
+    * The hash table: the index of a value in each slot, NOT_FOUND if the slot
+    * is free.
     */
-	char *class;
+    ulong *slots;
 
-   /** @var CSVLine::val
-    * The val is the actual pattern of the input file line.
+   /** @var Vocab::nSlots
+    * The number of slots, a power of two at least twice nEntries.
     */
-    Vector *val;    // Vector of char
-} CSVLine;
+    ulong nSlots;
 
-/** The structure for a cluster, holding its prototype and assigned patterns.
+   /** @var Vocab::frozen
+    * No value is added anymore: the values of the testing patterns are only
+    * looked up.
+    */
+    bool frozen;
+} Vocab;
+
+/** The structure holds every clusters of the network.
+ *
+ * The clusters are stored as a structure of arrays: the cluster at index i is
+ * made of the i-th element (or row) of every array. The arrays read for every
+ * cluster when a pattern is scored (prototypes and their number of 1) are
+ * kept apart from the ones only used when a pattern
+ * joins or leaves a cluster (patterns sets and members counters). Scoring all
+ * the clusters is then a linear read of the prototypes matrix.
+ */
+typedef struct {
+    /** @var ClustStore::prots
+     * The clusters prototypes, nWords words per prototype, one after the
+     * other (see clust_prot()). A prototype is the centroid of the cluster,
+     * it's basically a pattern wich contains 1 only where every patterns of
+     * the cluster have a 1. The matrix is aligned on a cache line.
+     */
+    BitWord *prots;
+
+    /** @var ClustStore::nOnes
+     * The number of 1 of each prototype. It is updated every time the
+     * prototype changes so it never has to be recounted.
+     */
+    ulong *nOnes;
+
+    /** @var ClustStore::patSets
+     * For each cluster, the set of patterns ID which belong to it. It means
+     * that the prototype has been shaped by these patterns when they where
+     * added to the cluster.
+     */
+    Vector **patSets;   // Vectors of ulongs
+
+    /** @var ClustStore::bitCounts
+     * For each cluster and each bit index, the number of member patterns
+     * having a 1 at this index, len counters per cluster (see
+     * clust_bit_count()). The prototype can be rebuilt from them when a
+     * pattern leaves the cluster without looking at the other members.
+     */
+    uint32_t *bitCounts;
+
+    /** @var ClustStore::cols
+     * The bit-sliced index of the prototypes (NULL if there's none, see
+     * clusts_index()): for each bit index, a column of colWords words whose
+     * bit i is the bit of the prototype of the cluster i (see clust_col()).
+     * The column bits of the clusters after the last one are meaningless.
+     */
+    BitWord *cols;
+
+    /** @var ClustStore::colWords
+     * The number of words of each column of the index.
+     */
+    ulong colWords;
+
+    /** @var ClustStore::protKeys
+     * The fingerprint of each prototype (see bits_fingerprint()), updated
+     * along with the prototype by clusts_sync_prot().
+     */
+    BitWord *protKeys;
+
+    /** @var ClustStore::keyHeads
+     * The first cluster of each of the 'capacity' chains of the prototypes
+     * hash table, NOT_FOUND if the chain is empty. A cluster is chained in
+     * the chain protKeys[i] % capacity (see clusts_key_first()).
+     */
+    ulong *keyHeads;
+
+    /** @var ClustStore::keyNext
+     * The next cluster of the chain of each cluster, NOT_FOUND at the end.
+     */
+    ulong *keyNext;
+
+    /** @var ClustStore::keyPrev
+     * The previous cluster of the chain of each cluster, NOT_FOUND at the
+     * head.
+     */
+    ulong *keyPrev;
+
+    /** @var ClustStore::size
+     * The number of clusters.
+     */
+    ulong size;
+
+    /** @var ClustStore::capacity
+     * The number of clusters the arrays can hold before growing.
+     */
+    ulong capacity;
+
+    /** @var ClustStore::len
+     * The length of the prototypes (their number of bits).
+     */
+    ulong len;
+
+    /** @var ClustStore::nWords
+     * The number of words used by each prototype.
+     */
+    ulong nWords;
+} ClustStore;
+
+/** The structure holds a chunk of the clusters of a concurrent clusters table.
+ */
+typedef struct {
+    /** @var HogChunk::prots
+     * The prototypes of the chunk, one after the other.
+     */
+    BitWord *prots;
+
+    /** @var HogChunk::nOnes
+     * The number of 1 of each prototype of the chunk.
+     */
+    ulong *nOnes;
+
+    /** @var HogChunk::ready
+     * Set once the prototype of the cluster is written.
+     */
+    int *ready;
+} HogChunk;
+
+/** The structure holds the prototypes of a concurrent clusters table.
+ *
+ * The clusters are only appended and their prototypes only lose 1, so the
+ * threads update them without any lock: a new cluster takes the next index
+ * with an atomic increment and the 1 of a prototype are cleared with atomic
+ * ANDs. The clusters are stored in chunks of HOG_CHUNK_CLUSTS clusters which
+ * are allocated when first needed and never move, so a cluster can be read
+ * while others are added.
  */
 typedef struct {
-    /** @var Cluster::prot
-     * The cluster prototype. it's the centroid of the cluster, it's basically 
-     * a pattern wich contains 1 only where every patterns of the cluster have 
-     * a 1.
+    /** @var HogStore::chunks
+     * The chunks of the table, NULL until they are needed (see hog_chunk()).
      */
-    Vector *prot;       // Vector of chars
+    HogChunk **chunks;
 
-    /** @var Cluster::patSet
-     * patSet is a set of patterns ID which belong to the cluster. It means
-     * that the previous prot vector has been shaped by these patterns when
-     * they where added to the cluster.
+    /** @var HogStore::nChunks
+     * The number of elements of the chunks array.
      */
-    Vector *patSet;    // Vector of ulongs
+    ulong nChunks;
 
-    /** @var Cluster::inhib
-     * The inhib boolean is a flag indicated whether the cluster is inhibited.
+    /** @var HogStore::size
+     * The number of clusters which have been added, some of them may not be
+     * ready yet.
      */
-    bool inhib;
-} Cluster;
+    ulong size;
+
+    /** @var HogStore::len
+     * The length of the prototypes.
+     */
+    ulong len;
+
+    /** @var HogStore::nWords
+     * The number of words used by each prototype.
+     */
+    ulong nWords;
+} HogStore;
+
+/** The structure holds the unique patterns of a patterns set (see
+ * pats_unique()).
+ */
+typedef struct {
+    /** @var UniqPats::pats
+     * The unique patterns, in the order of their first copy.
+     */
+    PatSet *pats;
+
+    /** @var UniqPats::copies
+     * The IDs of the copies of every unique patterns in the original set,
+     * unique pattern after unique pattern, by increasing ID for each of them.
+     */
+    ulong *copies;
+
+    /** @var UniqPats::copyStart
+     * The index in 'copies' of the first copy of each unique pattern, plus the
+     * number of original patterns at index pats->nPats: the unique pattern u
+     * has copyStart[u + 1] - copyStart[u] copies.
+     */
+    ulong *copyStart;
+} UniqPats;
+
+/** The structure holds a positive number as a fraction whose denominator is a
+ * power of two (see ratio_from_float()).
+ *
+ * Every float is such a fraction, so the scores can be compared exactly with
+ * integer cross-multiplications instead of double divisions.
+ */
+typedef struct {
+    /** @var Ratio::num
+     * The numerator.
+     */
+    ulong num;
+
+    /** @var Ratio::den
+     * The denominator, a power of two.
+     */
+    ulong den;
+} Ratio;
 
 /** This structure holds every parameters of the network.
  *
@@ -124,6 +581,49 @@ typedef struct {
      */
     int testNoise;
 
+    /** @var InParam::nThreads
+     * The number of threads used to score the clusters once there are at
+     * least PAR_SCORES_MIN_CLUSTS of them.
+     */
+    unsigned long nThreads;
+
+    /** @var InParam::batchSize
+     * The number of training patterns assigned at once against the same
+     * prototypes by the mini-batch engine. 0 selects the sequential engine,
+     * which updates the prototypes after every pattern.
+     */
+    unsigned long batchSize;
+
+    /** @var InParam::hogwild
+     * Assign the training patterns on every threads at once, without lock
+     * (see network_train()). The clusters then depend on the timing of the
+     * threads.
+     */
+    bool hogwild;
+
+    /** @var InParam::encode
+     * The datasets are categorical csv files, one-hot encoded by the program
+     * (see readCategorical()), instead of binary ones.
+     */
+    bool encode;
+
+    /** @var InParam::classCol
+     * The column of the class of the categorical datasets: 1 for the first
+     * one, -1 for the last one, 0 if they have no class.
+     */
+    long classCol;
+
+    /** @var InParam::seed
+     * The seed of the random generators (noise and ties breaking).
+     */
+    unsigned int seed;
+
+    /** @var InParam::quiet
+     * Don't print the passes table and the testing ratio (used when several
+     * networks are trained at once).
+     */
+    bool quiet;
+
     /** @var InParam::prefix
      * The prefix is the string that will be added to output files containing
      * the results.
@@ -141,11 +641,92 @@ typedef struct {
     char testFile[PATH_MAX];
 } InParam;   
 
+/** The structure holds the values tried by a parameters sweep.
+ *
+ * Every combination of a vigilance, a beta, a noise and a batch size is
+ * trained.
+ */
+typedef struct {
+    /** @var SweepParam::vigilances
+     * The vigilance values.
+     */
+    float *vigilances;
+
+    /** @var SweepParam::nVigilances
+     * The number of vigilance values.
+     */
+    ulong nVigilances;
+
+    /** @var SweepParam::betas
+     * The beta values.
+     */
+    float *betas;
+
+    /** @var SweepParam::nBetas
+     * The number of beta values.
+     */
+    ulong nBetas;
+
+    /** @var SweepParam::noises
+     * The training noise values (in percent).
+     */
+    float *noises;
+
+    /** @var SweepParam::nNoises
+     * The number of training noise values.
+     */
+    ulong nNoises;
+
+    /** @var SweepParam::batches
+     * The batch sizes of the training engine (0 for the sequential one).
+     */
+    ulong *batches;
+
+    /** @var SweepParam::nBatches
+     * The number of batch sizes.
+     */
+    ulong nBatches;
+} SweepParam;
+
 /*=====| PROTOTYPES |=========================================================*/
 int cmpFun(const void *elem1, const void *elem2, CompareInfo *ExtraArgs);
-unsigned long pat_in_clust_set(const Vector *clust, unsigned long set);
 unsigned long pat_in_set(Vector *set, Vector *pat);
-void line_val_to_vec(Vector *res, List *lines);
-void line_class_to_vec(Vector *res, List *lines);
+PatSet *pats_create(ulong nPats, ulong len);
+PatSet *pats_create_sparse(ulong nPats, ulong len, ulong totOnes);
+bool pats_sparse_pays(ulong nPats, ulong len, ulong totOnes);
+PatSet *pats_copy(const PatSet *pats);
+void pats_release(const PatSet *pats, void *array);
+void pats_finalize(PatSet *pats);
+void pats_truncate(PatSet *pats, ulong nPats);
+UniqPats *pats_unique(const PatSet *pats);
+void uniq_finalize(UniqPats *uniq);
+Vocab *vocab_create(long classCol);
+void vocab_set_fields(Vocab *vocab, ulong nFields, const char *name);
+ulong vocab_find(Vocab *vocab, ulong col, const char *str, ulong len);
+void vocab_freeze(Vocab *vocab);
+void vocab_finalize(Vocab *vocab);
+ClustStore *clusts_create(ulong len);
+void clusts_finalize(ClustStore *clusts);
+ulong clusts_push(ClustStore *clusts);
+void clusts_swap_remove(ClustStore *clusts, ulong iClust);
+void clusts_index(ClustStore *clusts);
+void clusts_sync_prot(ClustStore *clusts, ulong iClust);
+ulong clusts_key_first(const ClustStore *clusts, BitWord key);
+ulong clusts_key_next(const ClustStore *clusts, ulong iClust);
+HogStore *hog_create(const ClustStore *clusts, ulong maxClusts);
+void hog_finalize(HogStore *hog);
+ulong hog_reserve(HogStore *hog);
+void hog_publish(HogStore *hog, ulong iClust, ulong nOnes);
+bool hog_is_ready(HogStore *hog, ulong iClust);
+void clusts_major_classes(Vector *clustsClass, ClustStore *clusts,
+                          Vector *patsClass);
+ulong clusts_class_matches(ClustStore *clusts, Vector *patsClass,
+                           Vector *clustsClass);
+Ratio ratio_from_float(float value);
+void rng_seed(Rng *rng, unsigned int seed);
+int rng_next(Rng *rng);
+#ifdef COUNT_ALLOCS
+ulong alloc_count(void);
+#endif
 
 #endif
@@ -0,0 +1,58 @@
+#!/bin/bash
+#
+# Train two networks on the same patterns with the same seed and check that
+# their results are identical: the training results and the cluster files.
+#
+# USAGE: same_results.sh train_file copies noise vigilance batch \
+#                        art1_a threads_a art1_b threads_b
+#
+# The first column of the training file is the class of the patterns. When
+# copies is 1 every pattern of the file is trained twice. art1_a and art1_b
+# are the programs to compare (they can be the same one run with different
+# numbers of threads).
+
+if [ $# -ne 9 ]; then
+    echo "USAGE: same_results.sh train_file copies noise vigilance batch"\
+         "art1_a threads_a art1_b threads_b" >&2
+    exit 2
+fi
+
+TRAIN=$1
+COPIES=$2
+NOISE=$3
+VIGILANCE=$4
+BATCH=$5
+SEED=1433
+PASSES=8
+
+WORK=$(mktemp -d) || exit 2
+trap 'rm -rf "$WORK"' EXIT
+
+if [ "$COPIES" -eq 1 ]; then
+    cat "$TRAIN" "$TRAIN" > "$WORK/train.csv"
+else
+    cp "$TRAIN" "$WORK/train.csv"
+fi
+
+# run name art1 threads
+run(){
+    mkdir -p "$WORK/$1/results/train" "$WORK/$1/results/test" \
+             "$WORK/$1/results/clusters"
+    (cd "$WORK/$1" &&
+     ART1_SEED=$SEED "$2" "$WORK/train.csv" "" art 1 "$NOISE" 0 1 \
+         "$VIGILANCE" 0 $PASSES "$3" "$BATCH" 0 > out.txt 2>&1)
+    if [ $? -ne 0 ]; then
+        echo "ERROR: $2 failed:" >&2
+        cat "$WORK/$1/out.txt" >&2
+        exit 1
+    fi
+}
+
+run a "$6" "$7"
+run b "$8" "$9"
+if ! diff -r "$WORK/a/results" "$WORK/b/results"; then
+    echo "ERROR: $6 ($7 threads) and $8 ($9 threads) disagree" >&2
+    exit 1
+fi
+echo "Same results: $(grep -c . "$WORK/a/results/train/art_results") lines,"\
+     "$(ls "$WORK/a/results/clusters" | wc -l) clusters"